@@ -0,0 +1,12 @@
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+#
+
+set(ZLIB_BUILD_EXAMPLES OFF)
+add_subdirectory(lib/zlib EXCLUDE_FROM_ALL)
+
+include_directories(
+    ${PROJECT_SOURCE_DIR}/lib/zlib
+    ${PROJECT_BINARY_DIR}/lib/zlib
+)
@@ -0,0 +1,259 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <audit.h>
+#include <state.h>
+
+static const struct option
+options[] = {
+    {"help",    no_argument,        0,  'h'},
+    {"log",     required_argument,  0,  'l'},
+    { }, /* NULL */
+};
+
+static __bfdev_noreturn void
+usage(void)
+{
+    bfdev_log_err("Usage: w80xprog audit [options]\n");
+    bfdev_log_err("\t-h, --help                display this message\n");
+    bfdev_log_err("\t-l, --log <file>          audit log to dump\n");
+    exit(1);
+}
+
+/* File size holding the records below seq, in whole chunks */
+static inline size_t
+audit_size(uint64_t seq)
+{
+    return sizeof(struct audit_head) + sizeof(struct audit_record) *
+           BFDEV_DIV_ROUND_UP(bfdev_max(seq, 1), AUDIT_RECORDS) *
+           AUDIT_RECORDS;
+}
+
+static int
+audit_map(int fd, bool create, struct audit_head **headp, size_t *sizep)
+{
+    struct audit_head *head;
+    struct stat stat;
+    int prot;
+
+    /* Only the first process to get here lays the file out */
+    if (create) {
+        flock(fd, LOCK_EX);
+        if (fstat(fd, &stat) || ((size_t)stat.st_size < audit_size(0) &&
+            ftruncate(fd, audit_size(0)))) {
+            flock(fd, LOCK_UN);
+            return -BFDEV_EPERM;
+        }
+    } else if (fstat(fd, &stat) || (size_t)stat.st_size < audit_size(0))
+        return -BFDEV_EBADMSG;
+
+    prot = create ? PROT_READ | PROT_WRITE : PROT_READ;
+    *sizep = create ? sizeof(*head) : (size_t)stat.st_size;
+    head = mmap(NULL, *sizep, prot, MAP_SHARED, fd, 0);
+    if (head == MAP_FAILED) {
+        if (create)
+            flock(fd, LOCK_UN);
+        return -BFDEV_ENOMEM;
+    }
+
+    if (create && !head->magic) {
+        head->version = AUDIT_VERSION;
+        head->record = sizeof(struct audit_record);
+        head->capacity = AUDIT_RECORDS;
+        atomic_init(&head->next, 0);
+        head->magic = AUDIT_MAGIC;
+    }
+
+    if (create)
+        flock(fd, LOCK_UN);
+
+    if (head->magic != AUDIT_MAGIC || head->version != AUDIT_VERSION ||
+        head->record != sizeof(struct audit_record) ||
+        head->capacity != AUDIT_RECORDS) {
+        munmap(head, *sizep);
+        return -BFDEV_EBADMSG;
+    }
+
+    *headp = head;
+    return -BFDEV_ENOERR;
+}
+
+static int
+audit_grow(int fd, uint64_t seq)
+{
+    struct stat stat;
+    int retval;
+
+    if (!fstat(fd, &stat) && (size_t)stat.st_size >= audit_size(seq + 1))
+        return -BFDEV_ENOERR;
+
+    /* Grown a chunk at a time, by whoever first reserves past the end */
+    flock(fd, LOCK_EX);
+    retval = -BFDEV_ENOERR;
+    if (fstat(fd, &stat) || ((size_t)stat.st_size < audit_size(seq + 1) &&
+        ftruncate(fd, audit_size(seq + 1))))
+        retval = -BFDEV_ENOSPC;
+    flock(fd, LOCK_UN);
+
+    return retval;
+}
+
+static inline off_t
+audit_offset(uint64_t seq)
+{
+    return sizeof(struct audit_head) + sizeof(struct audit_record) * seq;
+}
+
+int
+audit_append(struct audit_record *record)
+{
+    struct audit_record *slot;
+    struct audit_head *head;
+    char path[PATH_MAX];
+    size_t size, page;
+    void *map;
+    off_t offset;
+    uint64_t seq;
+    int fd, retval;
+
+    retval = state_path(path, sizeof(path), "audit.log");
+    if (retval)
+        return retval;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -BFDEV_ENOENT;
+
+    retval = audit_map(fd, true, &head, &size);
+    if (retval) {
+        close(fd);
+        return retval;
+    }
+
+    /* Reservation is the only shared write, no lock is held for it */
+    seq = atomic_fetch_add(&head->next, 1);
+    munmap(head, size);
+
+    /* Records are never overwritten, the log grows past a full chunk */
+    retval = audit_grow(fd, seq);
+    if (retval) {
+        close(fd);
+        return retval;
+    }
+
+    page = sysconf(_SC_PAGESIZE);
+    offset = audit_offset(seq) - audit_offset(seq) % page;
+    size = audit_offset(seq) - offset + sizeof(*slot);
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -BFDEV_ENOMEM;
+    slot = map + (audit_offset(seq) - offset);
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy((void *)slot + sizeof(slot->seq), (void *)record + sizeof(record->seq),
+           sizeof(*record) - sizeof(record->seq));
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+
+    munmap(map, size);
+    return -BFDEV_ENOERR;
+}
+
+static void
+audit_print(const struct audit_record *record, uint64_t seq)
+{
+    char hash[SHA256_DIGEST_SIZE * 2 + 1];
+
+    printf("%llu,%lld.%09lld,%u,%s,%d,%llu,%u.%03u,%s,%s,%s,%s\n",
+           (unsigned long long)seq, (long long)(record->time / 1000000000),
+           (long long)(record->time % 1000000000), record->pid,
+           record->port, record->status, (unsigned long long)record->size,
+           record->elapsed / 1000, record->elapsed % 1000,
+           sha256_hex(record->hash, hash), record->wmac,
+           record->bmac, record->gain);
+}
+
+int
+audit_main(int argc, char *const argv[])
+{
+    struct audit_record *slot, copy;
+    struct audit_head *head;
+    const char *path, *errname;
+    char buff[PATH_MAX];
+    uint64_t seq, next;
+    size_t size;
+    int optidx, retval, fd;
+    char arg;
+
+    path = NULL;
+    for (;;) {
+        arg = getopt_long(argc, argv, "l:h", options, &optidx);
+        if (arg == -1)
+            break;
+
+        switch (arg) {
+            case 'l':
+                path = optarg;
+                break;
+
+            case 'h': default:
+                usage();
+        }
+    }
+
+    if (!path) {
+        retval = state_path(buff, sizeof(buff), "audit.log");
+        if (retval)
+            return retval;
+        path = buff;
+    }
+
+    fd = open(path, O_RDONLY);
+    retval = fd < 0 ? -BFDEV_ENOENT : audit_map(fd, false, &head, &size);
+    if (fd >= 0)
+        close(fd);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_err("Failed to open audit log: %s\n", errname);
+        return retval;
+    }
+
+    printf("seq,time,pid,port,status,size,elapsed,sha256,wmac,bmac,gain\n");
+    next = atomic_load(&head->next);
+
+    /* A slot is consistent if its sequence is the same before and after */
+    for (seq = 0; seq < next; ++seq) {
+        /* Reserved by a writer that has not grown the file yet */
+        if ((size_t)audit_offset(seq + 1) > size)
+            break;
+
+        slot = (struct audit_record *)(head + 1) + seq;
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != seq + 1)
+            continue;
+
+        memcpy((void *)&copy + sizeof(copy.seq), (void *)slot + sizeof(slot->seq),
+               sizeof(copy) - sizeof(copy.seq));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq + 1)
+            continue;
+
+        audit_print(&copy, seq);
+    }
+
+    munmap(head, size);
+    return -BFDEV_ENOERR;
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _AUDIT_H_
+#define _AUDIT_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <bfdev.h>
+#include <sha256.h>
+#include <w80xprog.h>
+
+#define AUDIT_MAGIC 0x4c413857 /* "W8AL" */
+#define AUDIT_VERSION 2
+#define AUDIT_RECORDS 4096
+#define AUDIT_GAIN_LEN 168
+
+/*
+ * One fixed size slot per flashing session. The slot is claimed with
+ * an atomic add on the shared head and published by writing its
+ * sequence number last, so readers skip slots still being filled.
+ */
+struct audit_record {
+    _Atomic uint64_t seq;
+    int64_t time;
+    uint64_t size;
+    uint32_t pid;
+    int32_t status;
+    uint32_t elapsed;
+    uint32_t reserved;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    char wmac[ETH_STR_ALEN];
+    char bmac[ETH_STR_ALEN];
+    char port[40];
+    char gain[AUDIT_GAIN_LEN + 4];
+};
+
+struct audit_head {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record;
+    uint32_t capacity;
+    _Atomic uint64_t next;
+    uint8_t reserved[40];
+};
+
+extern int
+audit_append(struct audit_record *record);
+
+extern int
+audit_main(int argc, char *const argv[]);
+
+#endif /* _AUDIT_H_ */
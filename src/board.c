@@ -0,0 +1,420 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <board.h>
+#include <state.h>
+#include <timeout.h>
+
+#define BOARD_SIZE (sizeof(struct board_head) + \
+                    sizeof(struct board_slot) * BOARD_SLOTS)
+
+static struct board_head *board;
+static struct board_slot *board_mine;
+static uint32_t board_seq;
+
+static const char *
+phase_name[] = {
+    [BOARD_IDLE] = "idle",
+    [BOARD_ENTRY] = "entry",
+    [BOARD_SPEED] = "speed",
+    [BOARD_COMMAND] = "command",
+    [BOARD_FLASH] = "flash",
+    [BOARD_RESET] = "reset",
+    [BOARD_BOOT] = "boot",
+    [BOARD_DONE] = "done",
+};
+
+static const struct option
+options[] = {
+    {"help",     no_argument,        0,  'h'},
+    {"file",     required_argument,  0,  'f'},
+    {"interval", required_argument,  0,  'i'},
+    {"once",     no_argument,        0,  '1'},
+    { }, /* NULL */
+};
+
+static __bfdev_noreturn void
+usage(void)
+{
+    bfdev_log_err("Usage: w80xprog board [options]\n");
+    bfdev_log_err("\t-h, --help                display this message\n");
+    bfdev_log_err("\t-f, --file <file>         status board to show\n");
+    bfdev_log_err("\t-i, --interval <ms>       refresh period\n");
+    bfdev_log_err("\t-1, --once                print one frame and exit\n");
+    exit(1);
+}
+
+static int
+board_lock(int fd, unsigned int index, int cmd, short type)
+{
+    struct flock lock = {
+        .l_type = type,
+        .l_whence = SEEK_SET,
+        .l_start = index,
+        .l_len = 1,
+    };
+
+    if (fcntl(fd, cmd, &lock))
+        return -BFDEV_EBUSY;
+
+    /* STATE_GETLK reports F_UNLCK when nobody holds the slot */
+    if (cmd == STATE_GETLK && lock.l_type != F_UNLCK)
+        return -BFDEV_EBUSY;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+board_map(const char *path, bool create, struct board_head **headp, int *fdp)
+{
+    struct board_head *head;
+    struct stat stat;
+    int fd;
+
+    fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0)
+        return -BFDEV_ENOENT;
+
+    /*
+     * Only the first process to get here lays the file out. The lock
+     * is a byte past the slots, flock() would share one lock with the
+     * slot locks on BSD.
+     */
+    if (create) {
+        board_lock(fd, BOARD_SLOTS, STATE_SETLKW, F_WRLCK);
+        if (fstat(fd, &stat) || ((size_t)stat.st_size < BOARD_SIZE &&
+            ftruncate(fd, BOARD_SIZE))) {
+            close(fd);
+            return -BFDEV_EPERM;
+        }
+    } else if (fstat(fd, &stat) || (size_t)stat.st_size < BOARD_SIZE) {
+        close(fd);
+        return -BFDEV_EBADMSG;
+    }
+
+    head = mmap(NULL, BOARD_SIZE, create ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED, fd, 0);
+    if (head == MAP_FAILED) {
+        close(fd);
+        return -BFDEV_ENOMEM;
+    }
+
+    if (create && !head->magic) {
+        head->version = BOARD_VERSION;
+        head->slot = sizeof(struct board_slot);
+        head->capacity = BOARD_SLOTS;
+        head->magic = BOARD_MAGIC;
+    }
+
+    if (create)
+        board_lock(fd, BOARD_SLOTS, STATE_SETLK, F_UNLCK);
+
+    if (head->magic != BOARD_MAGIC || head->version != BOARD_VERSION ||
+        head->slot != sizeof(struct board_slot) ||
+        head->capacity != BOARD_SLOTS) {
+        munmap(head, BOARD_SIZE);
+        close(fd);
+        return -BFDEV_EBADMSG;
+    }
+
+    *headp = head;
+    *fdp = fd;
+    return -BFDEV_ENOERR;
+}
+
+static inline struct board_slot *
+board_slot(struct board_head *head, unsigned int index)
+{
+    return (struct board_slot *)(head + 1) + index;
+}
+
+
+static inline void
+board_begin(void)
+{
+    atomic_store_explicit(&board_mine->seq, ++board_seq, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void
+board_end(void)
+{
+    board_mine->updated = timeout_now();
+    atomic_store_explicit(&board_mine->seq, ++board_seq, memory_order_release);
+}
+
+void
+board_open(const char *port)
+{
+    struct board_head *head;
+    struct board_slot *slot;
+    char path[PATH_MAX];
+    unsigned int index, pass;
+    int fd;
+
+    if (state_path(path, sizeof(path), "board") ||
+        board_map(path, true, &head, &fd)) {
+        bfdev_log_debug("\tboard: status board unavailable\n");
+        return;
+    }
+
+    /*
+     * A port keeps its old slot when it is free, so dashboards do not
+     * reshuffle between boards. The fd stays open, the kernel drops
+     * the slot lock when this process exits.
+     */
+    for (pass = 0; pass < 2; ++pass) {
+        for (index = 0; index < BOARD_SLOTS; ++index) {
+            slot = board_slot(head, index);
+            if (!pass && strncmp(slot->port, port, sizeof(slot->port)))
+                continue;
+            if (!board_lock(fd, index, STATE_SETLK, F_WRLCK))
+                goto found;
+        }
+    }
+
+    bfdev_log_debug("\tboard: all %u slots taken\n", BOARD_SLOTS);
+    munmap(head, BOARD_SIZE);
+    close(fd);
+    return;
+
+found:
+    board = head;
+    board_mine = slot;
+
+    /* A previous owner may have died halfway through a write */
+    board_seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    board_seq += board_seq & 1;
+
+    board_begin();
+    slot->pid = getpid();
+    slot->phase = BOARD_IDLE;
+    slot->status = 0;
+    slot->done = slot->total = 0;
+    slot->rate = 0;
+    slot->retries = slot->timeouts = 0;
+    snprintf(slot->port, sizeof(slot->port), "%s", port);
+    board_end();
+
+    bfdev_log_debug("\tboard: slot %u\n", index);
+}
+
+void
+board_phase(enum board_phase phase)
+{
+    if (!board_mine)
+        return;
+
+    board_begin();
+    board_mine->phase = phase;
+    board_end();
+}
+
+void
+board_progress(uint64_t done, uint64_t total, double rate)
+{
+    if (!board_mine)
+        return;
+
+    board_begin();
+    board_mine->done = done;
+    board_mine->total = total;
+    board_mine->rate = rate;
+    board_end();
+}
+
+void
+board_retry(bool timeout)
+{
+    if (!board_mine)
+        return;
+
+    board_begin();
+    board_mine->retries++;
+    if (timeout)
+        board_mine->timeouts++;
+    board_end();
+}
+
+void
+board_status(uint8_t status)
+{
+    if (!board_mine)
+        return;
+
+    board_begin();
+    board_mine->status = status;
+    board_end();
+}
+
+static bool
+board_read(const struct board_slot *slot, struct board_slot *copy)
+{
+    unsigned int retry;
+    uint32_t seq;
+
+    /* Give up on a slot that is always mid-write, never wait on it */
+    for (retry = 0; retry < BOARD_READ_RETRY; ++retry) {
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+
+        memcpy((void *)copy + sizeof(copy->seq), (void *)slot + sizeof(slot->seq),
+               sizeof(*copy) - sizeof(copy->seq));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+            return true;
+    }
+
+    return false;
+}
+
+static void
+board_render(struct board_head *head, int fd)
+{
+    struct board_slot *slot, copy;
+    char state[16], status[8];
+    unsigned int index;
+    double now, ratio;
+    bool alive;
+
+    now = timeout_now();
+    printf("%-4s %-20s %-8s %-8s %6s %12s %11s %6s %5s %6s %8s\n",
+           "slot", "port", "pid", "phase", "done", "bytes", "rate",
+           "retry", "tmo", "status", "age");
+
+    for (index = 0; index < BOARD_SLOTS; ++index) {
+        slot = board_slot(head, index);
+        if (!atomic_load_explicit(&slot->seq, memory_order_relaxed))
+            continue;
+
+        if (!board_read(slot, &copy)) {
+            printf("%-4u %-20s\n", index, "(busy)");
+            continue;
+        }
+
+        /* An unlocked slot belongs to a process that has exited */
+        alive = !!board_lock(fd, index, STATE_GETLK, F_WRLCK);
+        snprintf(state, sizeof(state), "%s", copy.phase <= BOARD_DONE ?
+                 phase_name[copy.phase] : "?");
+        if (!alive && copy.phase != BOARD_DONE)
+            snprintf(state, sizeof(state), "aborted");
+
+        snprintf(status, sizeof(status), copy.status ? "%#04x" : "-",
+                 copy.status);
+        ratio = copy.total ? (double)copy.done / copy.total * 100 : 0;
+
+        printf("%-4u %-20.20s %-8u %-8s %5.1f%% %12llu %7.1fKB/s %6u %5u "
+               "%6s %7.1fs\n", index, copy.port, copy.pid, state, ratio,
+               (unsigned long long)copy.done, copy.rate / 1024,
+               copy.retries, copy.timeouts, status, now - copy.updated);
+    }
+
+    fflush(stdout);
+}
+
+static void
+board_sleep(double until)
+{
+    struct timespec delay;
+    double wait;
+
+    wait = until - timeout_now();
+    if (wait <= 0)
+        return;
+
+    /* A signal cuts the sleep short, carry on with what is left */
+    delay.tv_sec = wait;
+    delay.tv_nsec = (wait - delay.tv_sec) * 1000000000;
+    while (nanosleep(&delay, &delay) && errno == EINTR)
+        ;
+}
+
+int
+board_main(int argc, char *const argv[])
+{
+    struct board_head *head;
+    const char *path, *errname;
+    char buff[PATH_MAX];
+    unsigned int interval;
+    int optidx, retval, fd;
+    double next;
+    bool once;
+    char arg;
+
+    path = NULL;
+    interval = BOARD_REFRESH;
+    once = false;
+
+    for (;;) {
+        arg = getopt_long(argc, argv, "f:i:1h", options, &optidx);
+        if (arg == -1)
+            break;
+
+        switch (arg) {
+            case 'f':
+                path = optarg;
+                break;
+
+            case 'i':
+                interval = strtoul(optarg, NULL, 0);
+                if (!interval)
+                    usage();
+                break;
+
+            case '1':
+                once = true;
+                break;
+
+            case 'h': default:
+                usage();
+        }
+    }
+
+    if (!path) {
+        retval = state_path(buff, sizeof(buff), "board");
+        if (retval)
+            return retval;
+        path = buff;
+    }
+
+    retval = board_map(path, false, &head, &fd);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_err("Failed to open status board: %s\n", errname);
+        return retval;
+    }
+
+    /* Frames go out on a fixed period, however long one takes to print */
+    next = timeout_now();
+    for (;;) {
+        if (!once && isatty(STDOUT_FILENO))
+            printf("\033[H\033[J");
+        board_render(head, fd);
+        if (once)
+            break;
+
+        next += interval / 1000.0;
+        board_sleep(next);
+
+        if (!isatty(STDOUT_FILENO))
+            printf("\n");
+    }
+
+    munmap(head, BOARD_SIZE);
+    close(fd);
+    return -BFDEV_ENOERR;
+}
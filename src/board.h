@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BOARD_H_
+#define _BOARD_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define BOARD_MAGIC 0x44423857 /* "W8BD" */
+#define BOARD_VERSION 1
+
+enum board_phase {
+    BOARD_IDLE = 0,
+    BOARD_ENTRY,
+    BOARD_SPEED,
+    BOARD_COMMAND,
+    BOARD_FLASH,
+    BOARD_RESET,
+    BOARD_BOOT,
+    BOARD_DONE,
+};
+
+/*
+ * One slot per flashing process, owned through a byte range lock on
+ * the slot index. The owner bumps the sequence to odd before writing
+ * and to even after, readers retry a copy that straddled a write.
+ */
+struct board_slot {
+    _Atomic uint32_t seq;
+    uint32_t pid;
+    uint32_t phase;
+    uint32_t status;
+    uint64_t done;
+    uint64_t total;
+    double rate;
+    double updated;
+    uint32_t retries;
+    uint32_t timeouts;
+    char port[40];
+    uint8_t reserved[32];
+};
+
+struct board_head {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot;
+    uint32_t capacity;
+    uint8_t reserved[48];
+};
+
+extern void
+board_open(const char *port);
+
+extern void
+board_phase(enum board_phase phase);
+
+extern void
+board_progress(uint64_t done, uint64_t total, double rate);
+
+extern void
+board_retry(bool timeout);
+
+extern void
+board_status(uint8_t status);
+
+extern int
+board_main(int argc, char *const argv[]);
+
+#endif /* _BOARD_H_ */
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <boot.h>
+#include <term.h>
+#include <timeout.h>
+
+int
+boot_init(struct boot_check *check, const char *banner, const char *crash,
+          unsigned int speed, unsigned int timeout)
+{
+    if (regcomp(&check->banner, banner, REG_EXTENDED | REG_NOSUB))
+        return -BFDEV_EINVAL;
+
+    check->crashre = !!crash;
+    if (crash && regcomp(&check->crash, crash, REG_EXTENDED | REG_NOSUB)) {
+        regfree(&check->banner);
+        return -BFDEV_EINVAL;
+    }
+
+    check->speed = speed;
+    check->timeout = timeout;
+
+    return -BFDEV_ENOERR;
+}
+
+void
+boot_release(struct boot_check *check)
+{
+    regfree(&check->banner);
+    if (check->crashre)
+        regfree(&check->crash);
+}
+
+static int
+boot_match(struct boot_check *check, const char *line)
+{
+    if (!regexec(&check->banner, line, 0, NULL, 0))
+        return BOOT_BOOTED;
+
+    if (check->crashre && !regexec(&check->crash, line, 0, NULL, 0))
+        return BOOT_CRASHED;
+
+    return -BFDEV_ENOENT;
+}
+
+static int
+boot_end(struct boot_check *check, struct boot_line *line)
+{
+    int retval;
+
+    line->text[line->len] = '\0';
+    if (!line->len)
+        return -BFDEV_ENOENT;
+
+    bfdev_log_debug("\tboot: %s\n", line->text);
+    retval = boot_match(check, line->text);
+    if (retval < 0)
+        line->len = 0;
+
+    return retval;
+}
+
+static int
+boot_feed(struct boot_check *check, struct boot_line *line,
+          const uint8_t *data, unsigned int count)
+{
+    unsigned int index;
+    int retval;
+
+    for (index = 0; index < count; ++index) {
+        /* An overlong line is matched in pieces, no byte is lost */
+        if (line->len == BOOT_LINE) {
+            retval = boot_end(check, line);
+            if (retval >= 0)
+                return retval;
+        }
+
+        if (data[index] == '\r' || data[index] == '\n') {
+            retval = boot_end(check, line);
+            if (retval >= 0)
+                return retval;
+            continue;
+        }
+
+        line->text[line->len++] = isprint(data[index]) ? data[index] : '.';
+    }
+
+    /*
+     * The tail stays in the buffer until the rest of its line comes in
+     * with a later read. A banner may never get its newline, so the
+     * partial line is matched as it stands too.
+     */
+    line->text[line->len] = '\0';
+    return line->len ? boot_match(check, line->text) : -BFDEV_ENOENT;
+}
+
+int
+boot_confirm(struct boot_check *check, double start)
+{
+    struct boot_line line;
+    uint8_t buff[64];
+    double deadline;
+    size_t bytes;
+    int retval;
+
+    bfdev_log_info("Boot check:\n");
+
+    /* The reset opcode has to leave at the old speed */
+    term_drain();
+    if (check->speed != term_getspeed()) {
+        retval = term_setspeed(check->speed);
+        if (retval)
+            return retval;
+    }
+
+    deadline = start + check->timeout / 1000.0;
+    line.len = 0;
+    bytes = 0;
+
+    for (;;) {
+        retval = term_read(buff, sizeof(buff));
+        if (retval < 0)
+            return retval;
+
+        if (!retval) {
+            retval = term_wait(deadline);
+            if (retval == -BFDEV_ETIMEDOUT)
+                break;
+            else if (retval)
+                return retval;
+            continue;
+        }
+
+        bytes += retval;
+        retval = boot_feed(check, &line, buff, retval);
+        if (retval >= 0)
+            goto finish;
+    }
+
+    if (!bytes) {
+        bfdev_log_err("\tSilent for %.3fs\n", timeout_now() - start);
+        return BOOT_SILENT;
+    }
+
+    bfdev_log_err("\tNo banner in %zu bytes after %.3fs\n",
+                  bytes, timeout_now() - start);
+    return BOOT_CRASHED;
+
+finish:
+    if (retval == BOOT_BOOTED)
+        bfdev_log_info("\tBooted in %.3fs: %s\n", timeout_now() - start,
+                       line.text);
+    else
+        bfdev_log_err("\tCrashed after %.3fs: %s\n", timeout_now() - start,
+                      line.text);
+
+    return retval;
+}
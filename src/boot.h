@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BOOT_H_
+#define _BOOT_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <regex.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define BOOT_LINE 256
+
+/* Process exit codes of a boot confirmation */
+enum boot_result {
+    BOOT_BOOTED = 0,
+    BOOT_SILENT = 2,    /* Nothing at all before the deadline */
+    BOOT_CRASHED = 3,   /* Output, but a crash match or no banner */
+};
+
+/* Console line being assembled, kept across reads */
+struct boot_line {
+    char text[BOOT_LINE + 1];
+    unsigned int len;
+};
+
+struct boot_check {
+    regex_t banner;
+    regex_t crash;
+    bool crashre;
+    unsigned int speed;
+    unsigned int timeout;
+};
+
+extern int
+boot_init(struct boot_check *check, const char *banner, const char *crash,
+          unsigned int speed, unsigned int timeout);
+
+extern int
+boot_confirm(struct boot_check *check, double start);
+
+extern void
+boot_release(struct boot_check *check);
+
+#endif /* _BOOT_H_ */
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <budget.h>
+
+#ifdef W80XPROG_SMALL
+# include <malloc.h>
+#endif
+
+static size_t budget_limit;
+static atomic_bool budget_sealed;
+static _Atomic unsigned long budget_allocs;
+static _Atomic unsigned long budget_late;
+static _Atomic size_t budget_heap;
+
+#ifdef W80XPROG_SMALL
+/*
+ * Linked with --wrap, so every allocation made by this program and the
+ * static libraries goes through here. The C library's own are not seen.
+ */
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+extern void __real_free(void *ptr);
+
+static void *
+budget_count(void *ptr)
+{
+    if (!ptr)
+        return NULL;
+
+    atomic_fetch_add_explicit(&budget_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&budget_heap, malloc_usable_size(ptr),
+                              memory_order_relaxed);
+    if (atomic_load_explicit(&budget_sealed, memory_order_relaxed))
+        atomic_fetch_add_explicit(&budget_late, 1, memory_order_relaxed);
+
+    return ptr;
+}
+
+static void
+budget_uncount(void *ptr)
+{
+    if (ptr)
+        atomic_fetch_sub_explicit(&budget_heap, malloc_usable_size(ptr),
+                                  memory_order_relaxed);
+}
+
+void *
+__wrap_malloc(size_t size)
+{
+    return budget_count(__real_malloc(size));
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+    return budget_count(__real_calloc(nmemb, size));
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    size_t old;
+    void *new;
+
+    old = ptr ? malloc_usable_size(ptr) : 0;
+    new = __real_realloc(ptr, size);
+    if (!new && size)
+        return NULL;
+
+    atomic_fetch_sub_explicit(&budget_heap, old, memory_order_relaxed);
+    return budget_count(new);
+}
+
+void
+__wrap_free(void *ptr)
+{
+    budget_uncount(ptr);
+    __real_free(ptr);
+}
+#endif
+
+void
+budget_start(size_t limit)
+{
+    budget_limit = limit;
+}
+
+void
+budget_seal(void)
+{
+    /* From here on the run should only use what it already holds */
+    atomic_store(&budget_sealed, true);
+}
+
+static size_t
+budget_field(const char *status, const char *name)
+{
+    const char *walk;
+
+    walk = strstr(status, name);
+    if (!walk)
+        return 0;
+
+    return strtoul(walk + strlen(name), NULL, 10) * 1024;
+}
+
+void
+budget_stat(struct budget_stat *stat)
+{
+    struct rusage usage;
+    char status[2048];
+    ssize_t len;
+    int fd;
+
+    /*
+     * Not getrusage, after exec its high-water mark still holds the
+     * shell that started us. No stdio either, it would allocate.
+     */
+    stat->rss = stat->peak = 0;
+    fd = open("/proc/self/status", O_RDONLY);
+    if (fd >= 0) {
+        len = read(fd, status, sizeof(status) - 1);
+        if (len > 0) {
+            status[len] = '\0';
+            stat->rss = budget_field(status, "\nVmRSS:");
+            stat->peak = budget_field(status, "\nVmHWM:");
+        }
+        close(fd);
+    }
+
+    /* Without procfs the high-water mark is the best there is */
+    if (!stat->peak && !getrusage(RUSAGE_SELF, &usage)) {
+#ifdef __APPLE__
+        stat->peak = usage.ru_maxrss;
+#else
+        stat->peak = (size_t)usage.ru_maxrss * 1024;
+#endif
+    }
+
+    stat->allocs = atomic_load(&budget_allocs);
+    stat->late = atomic_load(&budget_late);
+    stat->heap = atomic_load(&budget_heap);
+}
+
+int
+budget_check(const char *phase)
+{
+    struct budget_stat stat;
+
+    if (!budget_limit)
+        return -BFDEV_ENOERR;
+
+    budget_stat(&stat);
+    if (stat.peak <= budget_limit)
+        return -BFDEV_ENOERR;
+
+    bfdev_log_err("Memory budget exceeded %s: peak %zu KiB of %zu KiB\n",
+                  phase, stat.peak / 1024, budget_limit / 1024);
+    return -BFDEV_ENOMEM;
+}
+
+void
+budget_report(void)
+{
+    struct budget_stat stat;
+
+    budget_stat(&stat);
+    bfdev_log_info("Memory:\n");
+
+    bfdev_log_info("\tPeak RSS %zu KiB of %zu KiB, now %zu KiB\n",
+                   stat.peak / 1024, budget_limit / 1024, stat.rss / 1024);
+
+#ifdef W80XPROG_SMALL
+    bfdev_log_info("\t%lu allocations, %lu after startup, %zu KiB heap\n",
+                   stat.allocs, stat.late, stat.heap / 1024);
+#endif
+}
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+
+/*
+ * Memory use of one run. Allocations are only counted in the small
+ * build, which links with the allocator wrapped, elsewhere they read
+ * zero and only the resident set is known.
+ */
+struct budget_stat {
+    size_t rss;
+    size_t peak;
+    unsigned long allocs;
+    unsigned long late;
+    size_t heap;
+};
+
+extern void
+budget_start(size_t limit);
+
+extern void
+budget_seal(void);
+
+extern void
+budget_stat(struct budget_stat *stat);
+
+extern int
+budget_check(const char *phase);
+
+extern void
+budget_report(void);
+
+#endif /* _BUDGET_H_ */
@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <builder.h>
+#include <image.h>
+#include <timeout.h>
+
+struct builder_part {
+    struct image_header head;
+    const char *file;
+    void *map;
+    size_t size;
+    unsigned int type;
+    uint32_t addr;
+};
+
+struct builder_type {
+    const char *name;
+    unsigned int type;
+};
+
+static const struct builder_type
+type_table[] = {
+    {"secboot", IMAGE_TYPE_SECBOOT},
+    {"app",     IMAGE_TYPE_FLASHOS},
+    {"cpft",    IMAGE_TYPE_CPFT},
+    {"user",    IMAGE_TYPE_USER},
+    { }, /* NULL */
+};
+
+static const struct option
+options[] = {
+    {"help",    no_argument,        0,  'h'},
+    {"output",  required_argument,  0,  'o'},
+    {"version", required_argument,  0,  'V'},
+    { }, /* NULL */
+};
+
+static __bfdev_noreturn void
+usage(void)
+{
+    bfdev_log_err("Usage: w80xprog build [options] <type>:<addr>:<file>...\n");
+    bfdev_log_err("\t-h, --help                display this message\n");
+    bfdev_log_err("\t-o, --output <file>       write flashable image to file\n");
+    bfdev_log_err("\t-V, --version <string>    set image version string\n");
+    bfdev_log_err("\ttypes: secboot, app, cpft, user or a number\n");
+    exit(1);
+}
+
+static int
+parse_part(struct builder_part *part, char *spec)
+{
+    const struct builder_type *walk;
+    char *addr, *file, *endp;
+
+    addr = strchr(spec, ':');
+    if (!addr)
+        return -BFDEV_EINVAL;
+
+    *addr++ = '\0';
+    file = strchr(addr, ':');
+    if (!file)
+        return -BFDEV_EINVAL;
+
+    *file++ = '\0';
+    part->file = file;
+
+    for (walk = type_table; walk->name; ++walk) {
+        if (!strcmp(walk->name, spec))
+            break;
+    }
+
+    if (walk->name)
+        part->type = walk->type;
+    else {
+        part->type = strtoul(spec, &endp, 0);
+        if (*endp || part->type > 0x0f)
+            return -BFDEV_EINVAL;
+    }
+
+    part->addr = strtoul(addr, &endp, 0);
+    if (*endp || part->addr % SPINOR_PAGE_SIZE ||
+        part->addr < SPINOR_BASE + BUILDER_HEADER_SLOT)
+        return -BFDEV_EINVAL;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+load_part(struct builder_part *part, const char *version)
+{
+    struct image_header *head;
+    struct stat stat;
+    int fd, retval;
+
+    fd = open(part->file, O_RDONLY);
+    if (fd < 0)
+        return -BFDEV_ENOENT;
+
+    retval = fstat(fd, &stat);
+    if (retval) {
+        close(fd);
+        return -BFDEV_EIO;
+    }
+
+    part->size = stat.st_size;
+    part->map = NULL;
+
+    if (part->size) {
+        part->map = mmap(NULL, part->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (part->map == MAP_FAILED) {
+            close(fd);
+            return -BFDEV_ENOMEM;
+        }
+        madvise(part->map, part->size, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    /* Header sits in its own slot right below the payload */
+    head = &part->head;
+    memset(head, 0, sizeof(*head));
+    head->magic = bfdev_cpu_to_le32(IMAGE_MAGIC);
+    head->attr = bfdev_cpu_to_le32(part->type);
+    head->addr = bfdev_cpu_to_le32(part->addr);
+    head->length = bfdev_cpu_to_le32(part->size);
+    head->header = bfdev_cpu_to_le32(part->addr - BUILDER_HEADER_SLOT);
+    strncpy((char *)head->version, version, sizeof(head->version));
+
+    head->checksum = bfdev_cpu_to_le32(image_crc(part->map, part->size,
+                                                 IMAGE_CRC_INIT));
+    head->hcrc = bfdev_cpu_to_le32(image_hcrc(head));
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+write_parts(int fd, struct builder_part *parts, unsigned int count)
+{
+    struct iovec iov[BUILDER_MAX_PARTS * 2];
+    unsigned int index, iovcnt;
+    ssize_t retval;
+
+    /* Headers and mapped payloads go out without an intermediate copy */
+    for (index = iovcnt = 0; index < count; ++index) {
+        iov[iovcnt].iov_base = &parts[index].head;
+        iov[iovcnt++].iov_len = sizeof(parts[index].head);
+
+        if (parts[index].size) {
+            iov[iovcnt].iov_base = parts[index].map;
+            iov[iovcnt++].iov_len = parts[index].size;
+        }
+    }
+
+    for (index = 0; index < iovcnt;) {
+        retval = writev(fd, iov + index, iovcnt - index);
+        if (retval < 0)
+            return -BFDEV_EIO;
+
+        while (index < iovcnt && (size_t)retval >= iov[index].iov_len)
+            retval -= iov[index++].iov_len;
+
+        if (index < iovcnt) {
+            iov[index].iov_base += retval;
+            iov[index].iov_len -= retval;
+        }
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+int
+builder_main(int argc, char *const argv[])
+{
+    struct builder_part parts[BUILDER_MAX_PARTS];
+    struct image_range ranges[BUILDER_MAX_PARTS * 2];
+    const char *output, *version, *errname;
+    unsigned int count, index;
+    size_t total;
+    double start, elapsed;
+    int optidx, retval, fd;
+    char arg;
+
+    output = NULL;
+    version = "";
+
+    for (;;) {
+        arg = getopt_long(argc, argv, "o:V:h", options, &optidx);
+        if (arg == -1)
+            break;
+
+        switch (arg) {
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'V':
+                version = optarg;
+                break;
+
+            case 'h': default:
+                usage();
+        }
+    }
+
+    count = argc - optind;
+    if (!output || !count || count > BUILDER_MAX_PARTS)
+        usage();
+
+    start = timeout_now();
+    total = 0;
+
+    bfdev_log_info("Image build:\n");
+    for (index = 0; index < count; ++index) {
+        retval = parse_part(&parts[index], argv[optind + index]);
+        if (retval)
+            usage();
+
+        retval = load_part(&parts[index], version);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Failed to load %s: %s\n", parts[index].file, errname);
+            return retval;
+        }
+
+        total += sizeof(parts[index].head) + parts[index].size;
+        bfdev_log_info("\t[%u] type %u, %zu bytes at %#010x: %s\n", index,
+                       parts[index].type, parts[index].size,
+                       parts[index].addr, parts[index].file);
+
+        /* The ROM would refuse the file, never write it */
+        retval = image_place(&parts[index].head, index, ranges);
+        if (retval) {
+            bfdev_log_err("Failed to place %s\n", parts[index].file);
+            return retval;
+        }
+    }
+
+    fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        bfdev_log_err("Failed to open output\n");
+        return -BFDEV_EPERM;
+    }
+
+    retval = write_parts(fd, parts, count);
+    close(fd);
+
+    for (index = 0; index < count; ++index) {
+        if (parts[index].size)
+            munmap(parts[index].map, parts[index].size);
+    }
+
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_err("Failed to write output: %s\n", errname);
+        return retval;
+    }
+
+    elapsed = timeout_now() - start;
+    bfdev_log_info("\t%zu bytes in %.3fms, %.1f MB/s\n", total, elapsed * 1000,
+                   total / bfdev_max(elapsed, 1e-9) / (1024 * 1024));
+
+    return -BFDEV_ENOERR;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BUILDER_H_
+#define _BUILDER_H_
+
+#include <config.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define BUILDER_HEADER_SLOT 0x400
+#define BUILDER_MAX_PARTS 16
+
+extern int
+builder_main(int argc, char *const argv[]);
+
+#endif /* _BUILDER_H_ */
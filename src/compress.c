@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <zlib.h>
+#include <compress.h>
+#include <image.h>
+#include <timeout.h>
+#include <realtime.h>
+
+struct compress_chunk {
+    const uint8_t *src;
+    size_t len;
+    uint8_t *out;
+    size_t olen;
+    size_t osize;
+    uint32_t crc;
+    int retval;
+};
+
+struct compress_pool {
+    struct compress_chunk *chunks;
+    unsigned int count;
+    atomic_uint next;
+};
+
+static const uint8_t
+gzip_head[10] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03,
+};
+
+/* CRC-32 and input size after the deflate data */
+#define GZIP_TAIL 8
+
+static inline void
+gzip_le32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = value >> 0;
+    dest[1] = value >> 8;
+    dest[2] = value >> 16;
+    dest[3] = value >> 24;
+}
+
+static int
+chunk_deflate(struct compress_pool *pool, unsigned int index)
+{
+    struct compress_chunk *chunk;
+    z_stream zs;
+    int flush, retval;
+
+    chunk = &pool->chunks[index];
+    memset(&zs, 0, sizeof(zs));
+
+    retval = deflateInit2(&zs, COMPRESS_LEVEL, Z_DEFLATED, -15, 8,
+                          Z_DEFAULT_STRATEGY);
+    if (retval != Z_OK)
+        return -BFDEV_ENOMEM;
+
+    /*
+     * Prime each chunk with the tail of its predecessor so the
+     * independently compressed pieces are as good as one stream.
+     */
+    if (index)
+        deflateSetDictionary(&zs, chunk->src - COMPRESS_DICT, COMPRESS_DICT);
+
+    flush = index + 1 == pool->count ? Z_FINISH : Z_SYNC_FLUSH;
+    zs.next_in = (void *)chunk->src;
+    zs.avail_in = chunk->len;
+    zs.next_out = chunk->out;
+    zs.avail_out = chunk->osize;
+
+    retval = deflate(&zs, flush);
+    chunk->olen = zs.total_out;
+    deflateEnd(&zs);
+
+    if (zs.avail_in || (flush == Z_FINISH && retval != Z_STREAM_END))
+        return -BFDEV_EOVERFLOW;
+
+    chunk->crc = crc32(0, chunk->src, chunk->len);
+    return -BFDEV_ENOERR;
+}
+
+static void *
+compress_worker(void *pdata)
+{
+    struct compress_pool *pool;
+    unsigned int index;
+
+    pool = pdata;
+    while ((index = atomic_fetch_add(&pool->next, 1)) < pool->count)
+        pool->chunks[index].retval = chunk_deflate(pool, index);
+
+    return NULL;
+}
+
+static void *
+compress_thread(void *pdata)
+{
+    /* Started after rt_enter(), keep them off the link's cpu */
+    rt_worker();
+    return compress_worker(pdata);
+}
+
+static int
+compress_image(const struct image_info *info, unsigned int jobs,
+               uint8_t *out, size_t *olen)
+{
+    struct compress_pool pool;
+    struct image_header *head;
+    pthread_t *threads;
+    unsigned int index, count, started;
+    uint8_t *walk, *gzip, *end;
+    uint32_t crc;
+    int retval;
+
+    count = BFDEV_DIV_ROUND_UP(info->length, COMPRESS_CHUNK);
+    pool.chunks = calloc(count, sizeof(*pool.chunks));
+    threads = calloc(jobs, sizeof(*threads));
+    if (!pool.chunks || !threads) {
+        retval = -BFDEV_ENOMEM;
+        goto finish;
+    }
+
+    pool.count = count;
+    atomic_init(&pool.next, 0);
+
+    for (index = 0; index < count; ++index) {
+        struct compress_chunk *chunk = &pool.chunks[index];
+
+        chunk->src = info->payload + (size_t)index * COMPRESS_CHUNK;
+        chunk->len = bfdev_min(COMPRESS_CHUNK, info->length -
+                               (size_t)index * COMPRESS_CHUNK);
+        chunk->osize = compressBound(chunk->len) + 16;
+        chunk->out = malloc(chunk->osize);
+        if (!chunk->out) {
+            retval = -BFDEV_ENOMEM;
+            goto finish;
+        }
+    }
+
+    jobs = bfdev_min(jobs, count);
+    for (started = 0; started < jobs; ++started) {
+        if (pthread_create(&threads[started], NULL, compress_thread, &pool))
+            break;
+    }
+
+    /* Chunks are pulled from the pool, whatever is left is done here */
+    if (started < jobs)
+        compress_worker(&pool);
+
+    for (index = 0; index < started; ++index)
+        pthread_join(threads[index], NULL);
+
+    /*
+     * Stitch the chunks into one gzip member. The output may only take
+     * the room of the plain image, a member that would not fit in it
+     * does not pay off and the caller keeps the plain form.
+     */
+    *olen = info->size;
+    end = out + info->size;
+
+    head = (void *)out;
+    gzip = walk = out + sizeof(*head);
+    if (sizeof(gzip_head) + GZIP_TAIL > (size_t)(end - walk)) {
+        retval = -BFDEV_ENOERR;
+        goto finish;
+    }
+
+    memcpy(head, info->head, sizeof(*head));
+    memcpy(walk, gzip_head, sizeof(gzip_head));
+    walk += sizeof(gzip_head);
+
+    crc = crc32(0, NULL, 0);
+    for (index = 0; index < count; ++index) {
+        struct compress_chunk *chunk = &pool.chunks[index];
+
+        retval = chunk->retval;
+        if (retval)
+            goto finish;
+
+        if (chunk->olen + GZIP_TAIL > (size_t)(end - walk))
+            goto finish;
+
+        memcpy(walk, chunk->out, chunk->olen);
+        walk += chunk->olen;
+        crc = crc32_combine(crc, chunk->crc, chunk->len);
+    }
+
+    gzip_le32(walk, crc);
+    gzip_le32(walk + 4, info->length);
+    walk += GZIP_TAIL;
+
+    head->attr = bfdev_cpu_to_le32(info->attr | IMAGE_ATTR_ZIP);
+    head->length = bfdev_cpu_to_le32(walk - gzip);
+    head->checksum = bfdev_cpu_to_le32(image_crc(gzip, walk - gzip,
+                                       IMAGE_CRC_INIT));
+    head->hcrc = bfdev_cpu_to_le32(image_hcrc(head));
+
+    *olen = walk - out;
+    retval = -BFDEV_ENOERR;
+
+finish:
+    for (index = 0; pool.chunks && index < count; ++index)
+        free(pool.chunks[index].out);
+    free(pool.chunks);
+    free(threads);
+
+    return retval;
+}
+
+static bool
+compress_suitable(const struct image_info *info)
+{
+    /* The ROM must run secboot as is, signatures cover plain data */
+    if (IMAGE_ATTR_TYPE(info->attr) == IMAGE_TYPE_SECBOOT)
+        return false;
+
+    if (info->attr & (IMAGE_ATTR_ZIP | IMAGE_ATTR_SIGN))
+        return false;
+
+    return info->length > 0;
+}
+
+int
+compress_stream(const void *src, size_t size, unsigned int jobs,
+                uint8_t **dest, size_t *dsize, struct compress_stat *stat)
+{
+    struct image_info info;
+    size_t offset, olen;
+    uint8_t *buff, *walk;
+    double start;
+    int retval;
+
+    olen = 0;
+    start = timeout_now();
+    memset(stat, 0, sizeof(*stat));
+    stat->jobs = jobs = bfdev_max(jobs, 1);
+    stat->isize = size;
+
+    /* An image is only replaced by something smaller, never grows */
+    for (offset = 0; !(retval = image_parse(src, size, offset, &info));
+         offset += info.size)
+        ;
+
+    if (retval != -BFDEV_ENODATA)
+        return retval;
+
+    buff = walk = malloc(size);
+    if (!buff)
+        return -BFDEV_ENOMEM;
+
+    for (offset = 0; !image_parse(src, size, offset, &info);
+         offset += info.size) {
+        stat->images++;
+
+        if (!compress_suitable(&info)) {
+            memcpy(walk, info.head, info.size);
+            walk += info.size;
+            continue;
+        }
+
+        retval = compress_image(&info, jobs, walk, &olen);
+        if (retval) {
+            free(buff);
+            return retval;
+        }
+
+        /* Keep the plain form when deflate does not help */
+        if (olen >= info.size) {
+            memcpy(walk, info.head, info.size);
+            walk += info.size;
+            continue;
+        }
+
+        walk += olen;
+        stat->zipped++;
+    }
+
+    *dest = buff;
+    *dsize = stat->osize = walk - buff;
+    stat->elapsed = timeout_now() - start;
+
+    return -BFDEV_ENOERR;
+}
+
+void
+compress_report(const struct compress_stat *stat, double transfer)
+{
+    unsigned int ipackets, opackets;
+    double plain, saved;
+
+    ipackets = BFDEV_DIV_ROUND_UP(stat->isize, PAYLOAD_SIZE);
+    opackets = BFDEV_DIV_ROUND_UP(stat->osize, PAYLOAD_SIZE);
+
+    /* Scale the measured transfer to what the plain stream would cost */
+    plain = transfer * ipackets / bfdev_max(opackets, 1);
+    saved = plain - transfer - stat->elapsed;
+
+    bfdev_log_info("\tCompress: %u/%u images, %zu -> %zu bytes (%.1f%%), "
+                   "%.1fms on %u jobs\n", stat->zipped, stat->images,
+                   stat->isize, stat->osize,
+                   100.0 * stat->osize / bfdev_max(stat->isize, 1),
+                   stat->elapsed * 1000, stat->jobs);
+    bfdev_log_info("\tSaved: %.3fs of %.3fs end-to-end\n", saved, plain);
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <bfdev.h>
+
+#define COMPRESS_CHUNK (128 * 1024)
+#define COMPRESS_DICT (32 * 1024)
+#define COMPRESS_LEVEL 9
+
+struct compress_stat {
+    size_t isize;
+    size_t osize;
+    unsigned int images;
+    unsigned int zipped;
+    unsigned int jobs;
+    double elapsed;
+};
+
+extern int
+compress_stream(const void *src, size_t size, unsigned int jobs,
+                uint8_t **dest, size_t *dsize, struct compress_stat *stat);
+
+extern void
+compress_report(const struct compress_stat *stat, double transfer);
+
+#endif /* _COMPRESS_H_ */
@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fixture.h>
+#include <timeout.h>
+
+static struct fixture *fixture_current;
+
+static void
+fixture_forward(int sig, siginfo_t *info, void *context)
+{
+    unsigned int index;
+
+    /* The terminal already signals the whole group, only relay kill(2) */
+    if (info->si_code != SI_USER && info->si_code != SI_QUEUE)
+        return;
+
+    for (index = 0; index < fixture_current->count; ++index) {
+        if (fixture_current->pids[index] > 0)
+            kill(fixture_current->pids[index], sig);
+    }
+}
+
+int
+fixture_open(struct fixture *fix, const char *spec)
+{
+    int retval;
+
+    memset(fix, 0, sizeof(*fix));
+    fix->ready[0] = fix->ready[1] = -1;
+    fix->go[0] = fix->go[1] = -1;
+
+    bfdev_log_info("Fixture:\n");
+    retval = gpio_parse(&fix->gpio, spec);
+    if (retval) {
+        bfdev_log_err("\tExpected <chip>:<reset,...>[:<boot,...>]\n");
+        return retval;
+    }
+
+    return gpio_open(&fix->gpio);
+}
+
+int
+fixture_add(struct fixture *fix, const char *port)
+{
+    if (fix->count == FIXTURE_MAX_PORTS)
+        return -BFDEV_ENOSPC;
+
+    fix->ports[fix->count++] = port;
+    return -BFDEV_ENOERR;
+}
+
+int
+fixture_fork(struct fixture *fix, const char **port)
+{
+    unsigned int index;
+    pid_t pid;
+
+    if (pipe(fix->ready) || pipe(fix->go))
+        return -BFDEV_EIO;
+
+    /* Anything still buffered would be printed once per child */
+    fflush(stdout);
+    fflush(stderr);
+
+    for (index = 0; index < fix->count; ++index) {
+        pid = fork();
+        if (pid < 0) {
+            /* Children already started see the go pipe close and quit */
+            bfdev_log_err("\tFailed to start %s\n", fix->ports[index]);
+            break;
+        }
+
+        if (!pid) {
+            close(fix->ready[0]);
+            close(fix->go[1]);
+            gpio_close(&fix->gpio);
+            *port = fix->ports[index];
+            return 0;
+        }
+
+        fix->pids[index] = pid;
+    }
+
+    close(fix->ready[1]);
+    close(fix->go[0]);
+
+    if (!index) {
+        close(fix->ready[0]);
+        close(fix->go[1]);
+        return -BFDEV_ENOMEM;
+    }
+
+    return index;
+}
+
+int
+fixture_ready(struct fixture *fix)
+{
+    ssize_t retval;
+    uint8_t value;
+
+    value = 'R';
+    retval = write(fix->ready[1], &value, 1);
+    close(fix->ready[1]);
+    if (retval != 1)
+        return -BFDEV_EIO;
+
+    /* One byte per child means go, end of file means the parent gave up */
+    retval = read(fix->go[0], &value, 1);
+    close(fix->go[0]);
+
+    return retval == 1 ? -BFDEV_ENOERR : -BFDEV_ECANCELED;
+}
+
+static void
+fixture_reap(struct fixture *fix, pid_t pid, int status, int *result)
+{
+    unsigned int index;
+    int code;
+
+    for (index = 0; index < fix->count; ++index) {
+        if (fix->pids[index] == pid)
+            break;
+    }
+
+    if (index == fix->count)
+        return;
+
+    fix->pids[index] = -1;
+    code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (code)
+        bfdev_log_err("\t[%u] %s: failed, status %d\n", index,
+                      fix->ports[index], code);
+    else
+        bfdev_log_info("\t[%u] %s: done\n", index, fix->ports[index]);
+
+    if (code && !*result)
+        *result = code;
+}
+
+int
+fixture_run(struct fixture *fix)
+{
+    struct sigaction action;
+    struct pollfd pfd;
+    struct timespec hold;
+    unsigned int index, ready, gone, started;
+    double deadline, width;
+    uint8_t value[FIXTURE_MAX_PORTS];
+    int retval, result, status;
+    pid_t pid;
+
+    fixture_current = fix;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = fixture_forward;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+
+    for (started = 0; started < fix->count && fix->pids[started] > 0;)
+        started++;
+
+    /* Every child that is not dead must be at the start line */
+    result = 0;
+    ready = gone = 0;
+    deadline = timeout_now() + FIXTURE_READY / 1000.0;
+    pfd.fd = fix->ready[0];
+    pfd.events = POLLIN;
+
+    while (ready + gone < started && timeout_now() < deadline) {
+        if (poll(&pfd, 1, FIXTURE_POLL) > 0) {
+            retval = read(fix->ready[0], value, sizeof(value));
+            if (retval > 0)
+                ready += retval;
+        }
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            fixture_reap(fix, pid, status, &result);
+            gone++;
+        }
+    }
+    close(fix->ready[0]);
+
+    if (started < fix->count || ready + gone < started || !ready) {
+        bfdev_log_err("\t%u of %u ports ready, no reset\n", ready, fix->count);
+        if (!result)
+            result = -BFDEV_ETIMEDOUT;
+    } else {
+        retval = gpio_pulse(&fix->gpio, &width);
+        if (retval) {
+            bfdev_log_err("\tReset pulse failed\n");
+            result = retval;
+        } else {
+            memset(value, 'G', sizeof(value));
+            retval = write(fix->go[1], value, ready);
+            bfdev_log_info("\tReset %u sockets, pulse %.3fms\n",
+                           __builtin_popcountll(fix->gpio.reset),
+                           width * 1000);
+        }
+    }
+
+    /* Whoever did not get a go byte reads end of file and stops */
+    close(fix->go[1]);
+
+    if (!result) {
+        hold.tv_sec = GPIO_BOOT_HOLD / 1000;
+        hold.tv_nsec = (GPIO_BOOT_HOLD % 1000) * 1000000L;
+        nanosleep(&hold, NULL);
+    }
+    gpio_release(&fix->gpio);
+    gpio_close(&fix->gpio);
+
+    for (index = 0; index < fix->count; ++index) {
+        if (fix->pids[index] <= 0)
+            continue;
+
+        pid = fix->pids[index];
+        if (waitpid(pid, &status, 0) == pid)
+            fixture_reap(fix, pid, status, &result);
+    }
+
+    return result;
+}
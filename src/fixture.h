@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _FIXTURE_H_
+#define _FIXTURE_H_
+
+#include <config.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <bfdev.h>
+#include <gpio.h>
+
+/*
+ * One process per socket. Each child opens its port and waits at the
+ * start line, the parent pulses every reset line at once and lets all
+ * of them into the secboot handshake together.
+ */
+struct fixture {
+    struct gpio_lines gpio;
+    const char *ports[FIXTURE_MAX_PORTS];
+    pid_t pids[FIXTURE_MAX_PORTS];
+    unsigned int count;
+    int ready[2];
+    int go[2];
+};
+
+extern int
+fixture_open(struct fixture *fix, const char *spec);
+
+extern int
+fixture_add(struct fixture *fix, const char *port);
+
+extern int
+fixture_fork(struct fixture *fix, const char **port);
+
+extern int
+fixture_ready(struct fixture *fix);
+
+extern int
+fixture_run(struct fixture *fix);
+
+#endif /* _FIXTURE_H_ */
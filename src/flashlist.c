@@ -0,0 +1,683 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <flashlist.h>
+#include <realtime.h>
+#include <w80xprog.h>
+#include <journal.h>
+#include <image.h>
+#include <timeout.h>
+#include <stream.h>
+#include <stub.h>
+
+static int
+flashlist_push(struct flash_list *list, const char *path)
+{
+    struct flash_item *item;
+
+    if (list->count == FLASHLIST_MAX_ITEMS)
+        return -BFDEV_EFBIG;
+
+    item = &list->items[list->count];
+    memset(item, 0, sizeof(*item));
+
+    item->path = strdup(path);
+    if (!item->path)
+        return -BFDEV_ENOMEM;
+
+    list->count++;
+    return -BFDEV_ENOERR;
+}
+
+static int
+name_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int
+flashlist_directory(struct flash_list *list, const char *path)
+{
+    char *names[FLASHLIST_MAX_ITEMS], buff[PATH_MAX];
+    unsigned int count, index;
+    struct dirent *dirent;
+    struct stat stat;
+    DIR *dir;
+    int retval;
+
+    dir = opendir(path);
+    if (!dir)
+        return -BFDEV_ENOENT;
+
+    /* Every regular file in the directory, in name order */
+    retval = -BFDEV_ENOERR;
+    for (count = 0; (dirent = readdir(dir));) {
+        if (dirent->d_name[0] == '.')
+            continue;
+
+        snprintf(buff, sizeof(buff), "%s/%s", path, dirent->d_name);
+        if (lstat(buff, &stat) || !S_ISREG(stat.st_mode))
+            continue;
+
+        if (count == FLASHLIST_MAX_ITEMS) {
+            retval = -BFDEV_EFBIG;
+            break;
+        }
+
+        names[count] = strdup(buff);
+        if (!names[count]) {
+            retval = -BFDEV_ENOMEM;
+            break;
+        }
+
+        count++;
+    }
+
+    closedir(dir);
+    qsort(names, count, sizeof(*names), name_compare);
+
+    for (index = 0; index < count; ++index) {
+        if (!retval)
+            retval = flashlist_push(list, names[index]);
+        free(names[index]);
+    }
+
+    return retval;
+}
+
+static int
+flashlist_manifest(struct flash_list *list, const char *path)
+{
+    char line[PATH_MAX], buff[PATH_MAX * 2], dir[PATH_MAX], *walk;
+    FILE *file;
+    int retval;
+
+    file = fopen(path, "r");
+    if (!file)
+        return -BFDEV_ENOENT;
+
+    /* One image per line, relative to the manifest itself */
+    snprintf(dir, sizeof(dir), "%s", path);
+    dirname(dir);
+
+    retval = -BFDEV_ENOERR;
+    while (!retval && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n#")] = '\0';
+        for (walk = line; *walk == ' ' || *walk == '\t'; ++walk);
+
+        if (!*walk)
+            continue;
+
+        if (*walk == '/')
+            snprintf(buff, sizeof(buff), "%s", walk);
+        else
+            snprintf(buff, sizeof(buff), "%s/%s", dir, walk);
+
+        retval = flashlist_push(list, buff);
+    }
+
+    fclose(file);
+    return retval;
+}
+
+int
+flashlist_add(struct flash_list *list, const char *path)
+{
+    struct stat stat;
+
+    if (*path == '@')
+        return flashlist_manifest(list, path + 1);
+
+    if (!lstat(path, &stat) && S_ISDIR(stat.st_mode))
+        return flashlist_directory(list, path);
+
+    return flashlist_push(list, path);
+}
+
+static bool
+flashlist_compressed(int fd)
+{
+    uint8_t magic[STREAM_SNIFF];
+    ssize_t len;
+
+    len = pread(fd, magic, sizeof(magic), 0);
+    if (len <= 0)
+        return false;
+
+    return stream_sniff(magic, len) != STREAM_PLAIN;
+}
+
+int
+flashlist_load(struct flash_list *list)
+{
+    struct flash_item *item;
+    struct stat stat;
+    unsigned int index;
+    int fd, retval;
+
+    memset(list->digest, 0, sizeof(list->digest));
+    list->mac[0] = '\0';
+    list->hashed = 0;
+
+    bfdev_log_info("Image check:\n");
+    for (index = 0; index < list->count; ++index) {
+        item = &list->items[index];
+
+        if (!strcmp(item->path, "-"))
+            fd = dup(STDIN_FILENO);
+        else
+            fd = open(item->path, O_RDONLY);
+
+        if (fd < 0) {
+            bfdev_log_err("\tFailed to open %s\n", item->path);
+            return -BFDEV_ENOENT;
+        }
+
+        retval = fstat(fd, &stat);
+        if (retval) {
+            bfdev_log_err("\tFailed to fstat %s\n", item->path);
+            close(fd);
+            return -BFDEV_EIO;
+        }
+
+        /*
+         * Pipes and compressed files are decoded on the fly into a
+         * small ring and checked as they pass, with bounded memory.
+         * Under a memory budget plain files are read the same way.
+         */
+        if (!S_ISREG(stat.st_mode) || list->bounded ||
+            flashlist_compressed(fd)) {
+            bfdev_log_info("\t[%u] %s (streamed)\n", index, item->path);
+            retval = stream_open(&item->stream, fd);
+            if (retval) {
+                close(fd);
+                return retval;
+            }
+
+            item->size = SIZE_MAX;
+            list->streams++;
+            continue;
+        }
+
+        if (!stat.st_size) {
+            bfdev_log_err("\tEmpty file %s\n", item->path);
+            close(fd);
+            return -BFDEV_ENODATA;
+        }
+
+        item->msize = stat.st_size;
+        item->map = mmap(NULL, item->msize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (item->map == MAP_FAILED) {
+            bfdev_log_err("\tFailed to mmap %s\n", item->path);
+            item->map = NULL;
+            return -BFDEV_ENOMEM;
+        }
+
+        /* Reject bad images before touching the device */
+        bfdev_log_info("\t[%u] %s\n", index, item->path);
+        madvise(item->map, item->msize, MADV_SEQUENTIAL);
+        retval = image_validate(item->map, item->msize);
+        if (retval)
+            return retval;
+
+        item->data = item->map;
+        item->size = item->msize;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+int
+flashlist_fits(struct flash_list *list, size_t capacity)
+{
+    unsigned int index;
+    int retval;
+
+    list->capacity = capacity;
+    for (index = 0; index < list->count; ++index) {
+        /* Streamed headers are measured as they are decoded */
+        if (list->items[index].stream) {
+            list->items[index].stream->check.flash = capacity;
+            continue;
+        }
+
+        retval = image_fits(list->items[index].map,
+                            list->items[index].msize, capacity);
+        if (retval)
+            return retval;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+int
+flashlist_compress(struct flash_list *list, unsigned int jobs)
+{
+    struct flash_item *item;
+    unsigned int index;
+    int retval;
+
+    if (list->streams) {
+        bfdev_log_err("\tStreamed input cannot be recompressed\n");
+        return -BFDEV_ENOTSUPP;
+    }
+
+    for (index = 0; index < list->count; ++index) {
+        item = &list->items[index];
+        retval = compress_stream(item->map, item->msize, jobs,
+                                 &item->data, &item->size, &item->cstat);
+        if (retval)
+            return retval;
+
+        item->zipped = true;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static unsigned int
+flashlist_images(struct flash_list *list, struct image_info *images)
+{
+    struct flash_item *item;
+    struct image_info *info;
+    unsigned int index, count;
+    size_t offset;
+
+    /* Image offsets are taken across all files, as they go out */
+    list->total = 0;
+    for (index = count = 0; index < list->count; ++index) {
+        item = &list->items[index];
+        item->offset = list->total;
+
+        for (offset = 0; count < FLASHLIST_MAX_IMAGES; offset += info->size) {
+            info = &images[count];
+            if (image_parse(item->data, item->size, offset, info))
+                break;
+            info->offset += item->offset;
+            count++;
+        }
+
+        list->total += item->size;
+    }
+
+    return count;
+}
+
+static uint32_t
+flashlist_spare(struct flash_list *list, const struct image_info *images,
+                unsigned int count)
+{
+    unsigned int index;
+    size_t end, header;
+
+    /*
+     * The header of a resumed tail must not land on anything the file
+     * owns, it goes to the first sector past all of its images.
+     */
+    for (end = index = 0; index < count; ++index) {
+        header = bfdev_le32_to_cpu(images[index].head->header);
+        end = bfdev_max(end, (size_t)images[index].addr + images[index].length);
+        end = bfdev_max(end, header + sizeof(struct image_header));
+    }
+
+    end = BFDEV_ALIGN(end, SPINOR_SECTOR_SIZE);
+    if (!count || !list->capacity || end < SPINOR_BASE ||
+        end - SPINOR_BASE + SPINOR_SECTOR_SIZE > list->capacity)
+        return 0;
+
+    return end;
+}
+
+static void
+flashlist_subimage(struct flash_list *list, const struct image_info *info,
+                   uint32_t skip, uint32_t spare)
+{
+    struct image_header *head;
+    uint32_t crc;
+
+    /* The part already in flash stays, only the tail is checked anew */
+    crc = image_crc(info->payload + skip, info->length - skip, IMAGE_CRC_INIT);
+
+    head = &list->head;
+    memcpy(head, info->head, sizeof(*head));
+    head->addr = bfdev_cpu_to_le32(info->addr + skip);
+    head->length = bfdev_cpu_to_le32(info->length - skip);
+    head->header = bfdev_cpu_to_le32(spare);
+    head->checksum = bfdev_cpu_to_le32(crc);
+    head->next = bfdev_cpu_to_le32(0);
+    head->hcrc = bfdev_cpu_to_le32(image_hcrc(head));
+
+    list->hlen = sizeof(*head);
+}
+
+static int
+flashlist_read(struct spinor_source *source, void *buff, unsigned int len)
+{
+    struct flash_list *list;
+    struct flash_item *item;
+    unsigned int xfer;
+    int retval;
+
+    list = bfdev_container_of(source, struct flash_list, source);
+
+    /* A resumed tail goes out behind a header of its own */
+    if (list->hpos < list->hlen) {
+        xfer = bfdev_min(len, list->hlen - list->hpos);
+        memcpy(buff, (uint8_t *)&list->head + list->hpos, xfer);
+        list->hpos += xfer;
+        return xfer;
+    }
+
+    while (list->ritem < list->count) {
+        item = &list->items[list->ritem];
+
+        if (item->stream) {
+            retval = stream_read(item->stream, buff, len);
+            if (retval > 0) {
+                sha256_update(&list->sha, buff, retval);
+                list->hashed += retval;
+            }
+            if (retval)
+                return retval;
+
+            /* Stream lengths are only known at their end */
+            item->size = item->stream->total;
+        } else if (list->rpos < item->size) {
+            xfer = bfdev_min(len, item->size - list->rpos);
+            memcpy(buff, item->data + list->rpos, xfer);
+            if (list->streams) {
+                sha256_update(&list->sha, buff, xfer);
+                list->hashed += xfer;
+            }
+            list->rpos += xfer;
+            return xfer;
+        }
+
+        if (++list->ritem < list->count)
+            list->items[list->ritem].offset = item->offset + item->size;
+        list->rpos = 0;
+    }
+
+    return 0;
+}
+
+static void
+flashlist_ack(size_t done, void *pdata)
+{
+    struct flash_list *list;
+    struct flash_item *item;
+    double now;
+
+    list = pdata;
+
+    /* Offsets on the wire count the sub-image header, the file does not */
+    done = done > list->hlen ? done - list->hlen : 0;
+    journal_ack(list->journal, done);
+
+    done += list->resume;
+    now = timeout_now();
+
+    /* Time each file from its first to its last acknowledged byte */
+    while (list->acked < list->count) {
+        item = &list->items[list->acked];
+        if (item->size == SIZE_MAX || item->offset + item->size > done)
+            break;
+
+        item->finish = now;
+        if (++list->acked < list->count)
+            list->items[list->acked].start = now;
+    }
+}
+
+static void
+flashlist_report(struct flash_list *list)
+{
+    struct flash_item *item;
+    unsigned int index;
+    double elapsed;
+
+    bfdev_log_info("Flash summary:\n");
+    for (index = 0; index < list->count; ++index) {
+        item = &list->items[index];
+        if (item->offset + item->size <= list->resume) {
+            bfdev_log_info("\t[%u] %s: %zu bytes, skipped\n",
+                           index, item->path, item->size);
+            continue;
+        }
+
+        elapsed = item->finish - item->start;
+        bfdev_log_info("\t[%u] %s: %zu bytes, %.3fs, %.3f KB/s\n",
+                       index, item->path, item->size, elapsed,
+                       item->size / bfdev_max(elapsed, 1e-6) / 1024);
+
+        if (item->zipped)
+            compress_report(&item->cstat, elapsed);
+    }
+
+    for (list->total = index = 0; index < list->count; ++index)
+        list->total += list->items[index].size;
+
+    elapsed = timeout_now() - list->start;
+    bfdev_log_info("\tTotal: %u files, %zu bytes, %.3fs, %.3f KB/s\n",
+                   list->count, list->total - list->resume, elapsed,
+                   (list->total - list->resume) /
+                   bfdev_max(elapsed, 1e-6) / 1024);
+}
+
+static int
+flashlist_journal(struct flash_list *list, struct journal *jnl)
+{
+    struct image_info images[FLASHLIST_MAX_IMAGES];
+    struct sha256_ctx sha;
+    unsigned int index, count;
+    const char *errname;
+    uint32_t spare;
+    int retval;
+
+    jnl->record = NULL;
+    jnl->resume = 0;
+    jnl->skip = 0;
+    list->hlen = 0;
+
+    /* Every session names its board in the audit log */
+    retval = chip_wmac(list->mac);
+    if (retval)
+        return retval;
+
+    /* A stream can not be hashed before it is sent */
+    if (list->streams)
+        return -BFDEV_ENOERR;
+
+    count = flashlist_images(list, images);
+    spare = flashlist_spare(list, images, count);
+
+    sha256_init(&sha);
+    for (index = 0; index < list->count; ++index)
+        sha256_update(&sha, list->items[index].data, list->items[index].size);
+    sha256_final(&sha, list->digest);
+
+    retval = journal_open(jnl, list->mac, list->digest, images, count,
+                          list->total, !!spare);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_warn("Resume journal unavailable: %s\n", errname);
+    } else if (jnl->skip)
+        flashlist_subimage(list, &images[jnl->image], jnl->skip, spare);
+
+    return -BFDEV_ENOERR;
+}
+
+int
+flashlist_flash(struct flash_list *list)
+{
+    struct flash_item *item;
+    struct journal jnl;
+    unsigned int index;
+    char status;
+    int retval;
+
+    retval = flashlist_journal(list, &jnl);
+    if (retval)
+        return retval;
+
+    /* All files go out back to back as a single XMODEM stream */
+    list->journal = &jnl;
+    list->resume = jnl.resume;
+    list->acked = 0;
+    list->ritem = 0;
+    list->rpos = 0;
+    list->hpos = 0;
+
+    while (list->ritem < list->count) {
+        item = &list->items[list->ritem];
+        if (item->stream || item->offset + item->size > list->resume)
+            break;
+        list->ritem++;
+    }
+
+    list->acked = list->ritem;
+    if (list->ritem < list->count)
+        list->rpos = list->resume - list->items[list->ritem].offset;
+
+    /* Page faults on the producer thread starve the link */
+    for (index = 0; index < list->count; ++index) {
+        if (!list->items[index].stream)
+            rt_lock(list->items[index].data, list->items[index].size);
+    }
+
+    /*
+     * With a stream in the list nothing was hashed up front, so the
+     * producer hashes as it reads for the wire. Otherwise the journal
+     * digest already covers every byte.
+     */
+    sha256_init(&list->sha);
+    list->hashed = 0;
+    list->source.read = flashlist_read;
+    list->source.size = list->streams ? 0 :
+                        list->total - list->resume + list->hlen;
+
+    list->start = timeout_now();
+    if (list->acked < list->count)
+        list->items[list->acked].start = list->start;
+
+    retval = spinor_flash(&list->source, flashlist_ack, list);
+    if (retval) {
+        journal_close(&jnl);
+        return retval;
+    }
+
+    if (list->streams)
+        sha256_final(&list->sha, list->digest);
+    else
+        list->hashed = list->total;
+
+    /* Ask the chip how its image checks went before trusting the journal */
+    status = RETURN_NOMAL;
+    if (jnl.record) {
+        retval = chip_error(&status);
+        if (retval) {
+            journal_close(&jnl);
+            return retval;
+        }
+    }
+
+    retval = journal_finish(&jnl, status);
+    journal_close(&jnl);
+    if (retval)
+        return retval;
+
+    flashlist_report(list);
+    return -BFDEV_ENOERR;
+}
+
+int
+flashlist_stub(struct flash_list *list)
+{
+    struct stub_region *regions;
+    struct stub_stat stat;
+    struct image_info info;
+    struct flash_item *item;
+    unsigned int index, count;
+    size_t offset;
+    int retval;
+
+    if (list->streams) {
+        bfdev_log_err("\tStreamed input cannot go through the stub\n");
+        return -BFDEV_ENOTSUPP;
+    }
+
+    regions = malloc(sizeof(*regions) * FLASHLIST_MAX_IMAGES * 2);
+    if (!regions)
+        return -BFDEV_ENOMEM;
+
+    /* Place headers and payloads where secboot itself would put them */
+    sha256_init(&list->sha);
+    list->hashed = 0;
+    for (index = count = 0; index < list->count; ++index) {
+        item = &list->items[index];
+        sha256_update(&list->sha, item->map, item->msize);
+        list->hashed += item->msize;
+        for (offset = 0; !image_parse(item->map, item->msize, offset, &info);
+             offset += info.size) {
+            if (info.attr & IMAGE_ATTR_ZIP) {
+                bfdev_log_err("\t%s: compressed images need secboot\n",
+                              item->path);
+                free(regions);
+                return -BFDEV_ENOTSUPP;
+            }
+
+            if (count == FLASHLIST_MAX_IMAGES * 2) {
+                free(regions);
+                return -BFDEV_EFBIG;
+            }
+
+            regions[count].addr = bfdev_le32_to_cpu(info.head->header);
+            regions[count].len = sizeof(*info.head);
+            regions[count++].data = (const uint8_t *)info.head;
+
+            regions[count].addr = info.addr;
+            regions[count].len = info.size - sizeof(*info.head);
+            regions[count++].data = info.payload;
+        }
+    }
+
+    sha256_final(&list->sha, list->digest);
+    retval = stub_program(regions, count, &stat);
+    free(regions);
+
+    return retval;
+}
+
+void
+flashlist_release(struct flash_list *list)
+{
+    struct flash_item *item;
+    unsigned int index;
+
+    for (index = 0; index < list->count; ++index) {
+        item = &list->items[index];
+        if (item->stream)
+            stream_close(item->stream);
+        if (item->zipped)
+            free(item->data);
+        if (item->map)
+            munmap(item->map, item->msize);
+        free(item->path);
+    }
+
+    list->count = 0;
+    list->streams = 0;
+}
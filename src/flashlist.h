@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _FLASHLIST_H_
+#define _FLASHLIST_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <bfdev.h>
+#include <compress.h>
+#include <sha256.h>
+#include <w80xprog.h>
+#include <w80xhw.h>
+
+#define FLASHLIST_MAX_ITEMS 16
+#define FLASHLIST_MAX_IMAGES 64
+
+struct stream;
+
+struct flash_item {
+    char *path;
+    void *map;
+    size_t msize;
+    struct stream *stream;
+
+    uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool zipped;
+    struct compress_stat cstat;
+
+    double start;
+    double finish;
+};
+
+struct journal;
+
+struct flash_list {
+    struct flash_item items[FLASHLIST_MAX_ITEMS];
+    struct spinor_source source;
+    struct journal *journal;
+    unsigned int count;
+    unsigned int acked;
+    unsigned int streams;
+    bool bounded;
+    size_t total;
+    size_t resume;
+    size_t capacity;
+    double start;
+
+    /* Header sent ahead of a resumed image tail */
+    struct image_header head;
+    unsigned int hlen;
+    unsigned int hpos;
+
+    /* What went onto the device, for the audit log */
+    struct sha256_ctx sha;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    size_t hashed;
+    char mac[ETH_STR_ALEN];
+
+    /* Read cursor of the source */
+    unsigned int ritem;
+    size_t rpos;
+};
+
+extern int
+flashlist_add(struct flash_list *list, const char *path);
+
+extern int
+flashlist_load(struct flash_list *list);
+
+extern int
+flashlist_fits(struct flash_list *list, size_t capacity);
+
+extern int
+flashlist_compress(struct flash_list *list, unsigned int jobs);
+
+extern int
+flashlist_flash(struct flash_list *list);
+
+extern int
+flashlist_stub(struct flash_list *list);
+
+extern void
+flashlist_release(struct flash_list *list);
+
+#endif /* _FLASHLIST_H_ */
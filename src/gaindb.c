@@ -0,0 +1,459 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gaindb.h>
+#include <timeout.h>
+
+static const struct option
+options[] = {
+    {"help",    no_argument,        0,  'h'},
+    {"output",  required_argument,  0,  'o'},
+    {"query",   required_argument,  0,  'q'},
+    { }, /* NULL */
+};
+
+static __bfdev_noreturn void
+usage(void)
+{
+    bfdev_log_err("Usage: w80xprog gain-db [options] -o <store> <csv>...\n");
+    bfdev_log_err("       w80xprog gain-db [options] -q <key> <store>\n");
+    bfdev_log_err("\t-h, --help                display this message\n");
+    bfdev_log_err("\t-o, --output <file>       build a store from key,gain lines\n");
+    bfdev_log_err("\t-q, --query <key>         print the gain stored for key\n");
+    exit(1);
+}
+
+static uint32_t
+gaindb_hash(const char *key)
+{
+    uint32_t hash;
+
+    /* FNV-1a */
+    for (hash = 2166136261U; *key; ++key)
+        hash = (hash ^ (uint8_t)*key) * 16777619U;
+
+    return hash;
+}
+
+static int
+gaindb_key(char *buff, const char *key)
+{
+    unsigned int count, index;
+    size_t len;
+
+    len = strlen(key);
+    if (!len)
+        return -BFDEV_EINVAL;
+
+    /* MACs match in any case and with ':', '-' or no separators */
+    if (len == 12 || len == 17) {
+        for (count = index = 0; key[index]; ++index) {
+            if (isxdigit(key[index]) && count < 12) {
+                buff[count / 2 * 3 + count % 2] = tolower(key[index]);
+                count++;
+            } else if (len != 17 || index % 3 != 2 ||
+                       (key[index] != ':' && key[index] != '-'))
+                break;
+        }
+
+        if (!key[index] && count == 12) {
+            for (index = 2; index < 17; index += 3)
+                buff[index] = ':';
+            buff[17] = '\0';
+            return -BFDEV_ENOERR;
+        }
+    }
+
+    /* Anything else is a board serial, taken as is */
+    if (len >= GAINDB_KEY_LEN)
+        return -BFDEV_ENAMETOOLONG;
+
+    memcpy(buff, key, len + 1);
+    return -BFDEV_ENOERR;
+}
+
+static uint16_t
+gaindb_crc(const struct gaindb_entry *entry)
+{
+    return bfdev_crc_itut(entry, offsetof(struct gaindb_entry, crc), 0xffff);
+}
+
+int
+gaindb_open(struct gaindb *db, const char *path)
+{
+    const struct gaindb_head *head;
+    struct stat stat;
+    size_t size;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -BFDEV_ENOENT;
+
+    if (fstat(fd, &stat) || (size_t)stat.st_size < sizeof(*head)) {
+        close(fd);
+        return -BFDEV_EBADMSG;
+    }
+
+    map = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -BFDEV_ENOMEM;
+
+    /* One lookup per board, only the probed pages are ever read in */
+    madvise(map, stat.st_size, MADV_RANDOM);
+
+    head = map;
+    size = sizeof(*head) + (size_t)head->buckets * sizeof(*db->table) +
+           (size_t)head->count * sizeof(*db->entries);
+    if (head->magic != GAINDB_MAGIC || head->version != GAINDB_VERSION ||
+        head->entry != sizeof(struct gaindb_entry) || !head->buckets ||
+        (head->buckets & (head->buckets - 1)) || head->count >= head->buckets ||
+        size != (size_t)stat.st_size) {
+        munmap(map, stat.st_size);
+        return -BFDEV_EBADMSG;
+    }
+
+    db->head = head;
+    db->table = map + sizeof(*head);
+    db->entries = (void *)(db->table + head->buckets);
+    db->size = stat.st_size;
+
+    return -BFDEV_ENOERR;
+}
+
+int
+gaindb_lookup(struct gaindb *db, const char *key, const uint8_t **gain)
+{
+    const struct gaindb_bucket *bucket;
+    const struct gaindb_entry *entry;
+    char name[GAINDB_KEY_LEN];
+    uint32_t hash, mask, pos;
+    int retval;
+
+    retval = gaindb_key(name, key);
+    if (retval)
+        return retval;
+
+    hash = gaindb_hash(name);
+    mask = db->head->buckets - 1;
+
+    for (pos = hash & mask;; pos = (pos + 1) & mask) {
+        bucket = &db->table[pos];
+        if (!bucket->index)
+            return -BFDEV_ENOENT;
+
+        if (bucket->hash != hash || bucket->index > db->head->count)
+            continue;
+
+        entry = &db->entries[bucket->index - 1];
+        if (strncmp(entry->key, name, sizeof(entry->key)))
+            continue;
+
+        if (entry->crc != gaindb_crc(entry))
+            return -BFDEV_EBADMSG;
+
+        *gain = entry->gain;
+        return -BFDEV_ENOERR;
+    }
+}
+
+void
+gaindb_close(struct gaindb *db)
+{
+    if (db->head)
+        munmap((void *)db->head, db->size);
+    db->head = NULL;
+}
+
+static int
+gaindb_hex(const char *src, uint8_t *gain)
+{
+    unsigned int index;
+    char byte[3];
+
+    if (strlen(src) != GAINDB_GAIN_LEN * 2)
+        return -BFDEV_EINVAL;
+
+    for (index = 0; index < GAINDB_GAIN_LEN * 2; ++index) {
+        if (!isxdigit(src[index]))
+            return -BFDEV_EINVAL;
+    }
+
+    byte[2] = '\0';
+    for (index = 0; index < GAINDB_GAIN_LEN; ++index) {
+        memcpy(byte, src + index * 2, 2);
+        gain[index] = strtoul(byte, NULL, 16);
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static char *
+gaindb_trim(char *str)
+{
+    char *end;
+
+    while (isspace(*str))
+        str++;
+
+    end = str + strlen(str);
+    while (end > str && isspace(end[-1]))
+        *--end = '\0';
+
+    return str;
+}
+
+static int
+gaindb_parse(const char *path, struct gaindb_entry **entries,
+             unsigned int *count, unsigned int *capacity)
+{
+    struct gaindb_entry *entry, *grow;
+    char *line, *key, *gain;
+    unsigned int lineno;
+    size_t size;
+    int retval;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file)
+        return -BFDEV_ENOENT;
+
+    line = NULL;
+    size = 0;
+    retval = -BFDEV_ENOERR;
+
+    for (lineno = 1; getline(&line, &size, file) > 0; ++lineno) {
+        key = gaindb_trim(line);
+        if (!*key || *key == '#')
+            continue;
+
+        gain = strchr(key, ',');
+        if (gain)
+            *gain++ = '\0';
+
+        if (*count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 1024;
+            grow = realloc(*entries, *capacity * sizeof(*grow));
+            if (!grow) {
+                retval = -BFDEV_ENOMEM;
+                break;
+            }
+            *entries = grow;
+        }
+
+        entry = &(*entries)[*count];
+        memset(entry, 0, sizeof(*entry));
+        if (!gain || gaindb_key(entry->key, gaindb_trim(key)) ||
+            gaindb_hex(gaindb_trim(gain), entry->gain)) {
+            /* A first line that does not parse is the column header */
+            if (lineno == 1)
+                continue;
+
+            bfdev_log_err("\t%s:%u: expected <mac|serial>,<168 hex digits>\n",
+                          path, lineno);
+            retval = -BFDEV_EINVAL;
+            break;
+        }
+
+        entry->crc = gaindb_crc(entry);
+        (*count)++;
+    }
+
+    free(line);
+    fclose(file);
+    return retval;
+}
+
+static int
+gaindb_write(int fd, const void *data, size_t size)
+{
+    ssize_t retval;
+
+    while (size) {
+        retval = write(fd, data, size);
+        if (retval < 0)
+            return -BFDEV_EIO;
+
+        data += retval;
+        size -= retval;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+gaindb_build(const char *output, char *const *inputs, unsigned int ninput)
+{
+    struct gaindb_entry *entries;
+    struct gaindb_bucket *table;
+    struct gaindb_head head;
+    char temp[PATH_MAX];
+    unsigned int count, capacity, buckets, index;
+    uint32_t hash, pos;
+    double start;
+    int retval, fd;
+
+    entries = NULL;
+    table = NULL;
+    count = capacity = 0;
+    start = timeout_now();
+
+    bfdev_log_info("Gain store build:\n");
+    for (index = 0; index < ninput; ++index) {
+        retval = gaindb_parse(inputs[index], &entries, &count, &capacity);
+        if (retval)
+            goto failed;
+    }
+
+    /* At most half full, probes stay short */
+    for (buckets = 16; buckets < count * 2; buckets <<= 1)
+        ;
+
+    table = calloc(buckets, sizeof(*table));
+    if (!table) {
+        retval = -BFDEV_ENOMEM;
+        goto failed;
+    }
+
+    for (index = 0; index < count; ++index) {
+        hash = gaindb_hash(entries[index].key);
+        for (pos = hash & (buckets - 1); table[pos].index;
+             pos = (pos + 1) & (buckets - 1)) {
+            if (table[pos].hash == hash && !strcmp(entries[index].key,
+                entries[table[pos].index - 1].key)) {
+                bfdev_log_err("\tDuplicate key %s\n", entries[index].key);
+                retval = -BFDEV_EEXIST;
+                goto failed;
+            }
+        }
+
+        table[pos].hash = hash;
+        table[pos].index = index + 1;
+    }
+
+    memset(&head, 0, sizeof(head));
+    head.magic = GAINDB_MAGIC;
+    head.version = GAINDB_VERSION;
+    head.entry = sizeof(struct gaindb_entry);
+    head.count = count;
+    head.buckets = buckets;
+
+    /* Stations may have the old store mapped, replace it, never rewrite */
+    if (snprintf(temp, sizeof(temp), "%s.%d", output, getpid()) >= sizeof(temp)) {
+        retval = -BFDEV_ENAMETOOLONG;
+        goto failed;
+    }
+
+    fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        retval = -BFDEV_EPERM;
+        goto failed;
+    }
+
+    retval = gaindb_write(fd, &head, sizeof(head));
+    if (!retval)
+        retval = gaindb_write(fd, table, buckets * sizeof(*table));
+    if (!retval)
+        retval = gaindb_write(fd, entries, count * sizeof(*entries));
+    close(fd);
+
+    if (!retval && rename(temp, output))
+        retval = -BFDEV_EPERM;
+    if (retval) {
+        unlink(temp);
+        goto failed;
+    }
+
+    bfdev_log_info("\t%u boards, %u buckets, %zu bytes in %.3fms\n", count,
+                   buckets, sizeof(head) + buckets * sizeof(*table) +
+                   count * sizeof(*entries), (timeout_now() - start) * 1000);
+
+failed:
+    free(table);
+    free(entries);
+    return retval;
+}
+
+static int
+gaindb_query(const char *path, const char *key)
+{
+    const uint8_t *gain;
+    struct gaindb db;
+    unsigned int index;
+    int retval;
+
+    retval = gaindb_open(&db, path);
+    if (retval)
+        return retval;
+
+    retval = gaindb_lookup(&db, key, &gain);
+    if (!retval) {
+        for (index = 0; index < GAINDB_GAIN_LEN; ++index)
+            printf("%02x", gain[index]);
+        printf("\n");
+    }
+
+    gaindb_close(&db);
+    return retval;
+}
+
+int
+gaindb_main(int argc, char *const argv[])
+{
+    const char *output, *query, *errname;
+    int optidx, retval;
+    char arg;
+
+    output = NULL;
+    query = NULL;
+
+    for (;;) {
+        arg = getopt_long(argc, argv, "o:q:h", options, &optidx);
+        if (arg == -1)
+            break;
+
+        switch (arg) {
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'q':
+                query = optarg;
+                break;
+
+            case 'h': default:
+                usage();
+        }
+    }
+
+    if (!output == !query || optind == argc)
+        usage();
+
+    if (query) {
+        if (argc - optind != 1)
+            usage();
+        retval = gaindb_query(argv[optind], query);
+    } else
+        retval = gaindb_build(output, argv + optind, argc - optind);
+
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_err("Gain store failed: %s\n", errname);
+    }
+
+    return retval;
+}
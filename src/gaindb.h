@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _GAINDB_H_
+#define _GAINDB_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define GAINDB_MAGIC 0x44473857 /* "W8GD" */
+#define GAINDB_VERSION 1
+#define GAINDB_KEY_LEN 32
+#define GAINDB_GAIN_LEN 84
+
+/*
+ * A calibration store is a header, a power of two table of buckets
+ * and the entries in CSV order. Buckets are probed linearly from the
+ * key hash, an index of zero ends the probe.
+ */
+struct gaindb_entry {
+    char key[GAINDB_KEY_LEN];
+    uint8_t gain[GAINDB_GAIN_LEN];
+    uint16_t crc;
+    uint16_t reserved;
+};
+
+struct gaindb_bucket {
+    uint32_t hash;
+    uint32_t index;
+};
+
+struct gaindb_head {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t count;
+    uint32_t buckets;
+    uint8_t reserved[44];
+};
+
+struct gaindb {
+    const struct gaindb_head *head;
+    const struct gaindb_bucket *table;
+    const struct gaindb_entry *entries;
+    size_t size;
+};
+
+extern int
+gaindb_open(struct gaindb *db, const char *path);
+
+extern int
+gaindb_lookup(struct gaindb *db, const char *key, const uint8_t **gain);
+
+extern void
+gaindb_close(struct gaindb *db);
+
+extern int
+gaindb_main(int argc, char *const argv[]);
+
+#endif /* _GAINDB_H_ */
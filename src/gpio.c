@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <gpio.h>
+
+#ifdef HAVE_LINUX_GPIO
+# include <linux/gpio.h>
+#endif
+
+static int
+gpio_parse_lines(struct gpio_lines *gpio, const char *list, uint64_t *mask)
+{
+    unsigned long offset;
+    unsigned int index;
+    char *endp;
+
+    for (;;) {
+        offset = strtoul(list, &endp, 0);
+        if (endp == list || gpio->count == GPIO_MAX_LINES)
+            return -BFDEV_EINVAL;
+
+        /* A line can only be one thing */
+        for (index = 0; index < gpio->count; ++index) {
+            if (gpio->offsets[index] == offset)
+                return -BFDEV_EINVAL;
+        }
+
+        *mask |= 1ULL << gpio->count;
+        gpio->offsets[gpio->count++] = offset;
+
+        if (*endp != ',')
+            break;
+        list = endp + 1;
+    }
+
+    return *endp && *endp != ':' ? -BFDEV_EINVAL : -BFDEV_ENOERR;
+}
+
+int
+gpio_parse(struct gpio_lines *gpio, const char *spec)
+{
+    const char *walk;
+    int retval;
+
+    memset(gpio, 0, sizeof(*gpio));
+    gpio->fd = -1;
+
+    /* <chip>:<reset>[,<reset>...][:<boot>[,<boot>...]] */
+    walk = strchr(spec, ':');
+    if (!walk || walk == spec)
+        return -BFDEV_EINVAL;
+
+    if (snprintf(gpio->chip, sizeof(gpio->chip), "%s%.*s",
+                 *spec == '/' ? "" : "/dev/", (int)(walk - spec),
+                 spec) >= sizeof(gpio->chip))
+        return -BFDEV_ENAMETOOLONG;
+
+    retval = gpio_parse_lines(gpio, walk + 1, &gpio->reset);
+    if (retval)
+        return retval;
+
+    walk = strchr(walk + 1, ':');
+    if (walk)
+        retval = gpio_parse_lines(gpio, walk + 1, &gpio->boot);
+
+    return retval;
+}
+
+#if defined(HAVE_LINUX_GPIO) && defined(GPIO_V2_GET_LINE_IOCTL)
+
+static int
+gpio_set(struct gpio_lines *gpio, uint64_t bits)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = gpio->reset | gpio->boot;
+    values.bits = bits;
+
+    if (ioctl(gpio->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values))
+        return -BFDEV_EIO;
+
+    return -BFDEV_ENOERR;
+}
+
+int
+gpio_open(struct gpio_lines *gpio)
+{
+    struct gpio_v2_line_request request;
+    unsigned int index;
+    int chip;
+
+    chip = open(gpio->chip, O_RDWR | O_CLOEXEC);
+    if (chip < 0) {
+        bfdev_log_err("\tFailed to open %s\n", gpio->chip);
+        return -BFDEV_ENOENT;
+    }
+
+    memset(&request, 0, sizeof(request));
+    for (index = 0; index < gpio->count; ++index)
+        request.offsets[index] = gpio->offsets[index];
+    request.num_lines = gpio->count;
+    snprintf(request.consumer, sizeof(request.consumer), "w80xprog");
+
+    /* Every line starts released, nothing moves until the pulse */
+    request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    request.config.num_attrs = 2;
+    request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+    request.config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT |
+                                         GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+    request.config.attrs[0].mask = gpio->reset;
+    request.config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    request.config.attrs[1].attr.values = 0;
+    request.config.attrs[1].mask = gpio->reset | gpio->boot;
+
+    if (ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &request)) {
+        bfdev_log_err("\tLines on %s are busy or do not exist\n", gpio->chip);
+        close(chip);
+        return -BFDEV_EBUSY;
+    }
+
+    close(chip);
+    gpio->fd = request.fd;
+
+    bfdev_log_info("\t%s: %u reset, %u boot lines\n", gpio->chip,
+                   __builtin_popcountll(gpio->reset),
+                   __builtin_popcountll(gpio->boot));
+    return -BFDEV_ENOERR;
+}
+
+int
+gpio_pulse(struct gpio_lines *gpio, double *width)
+{
+    struct timespec start, until, end;
+    int retval;
+
+    /* Boot mode is latched on the rising reset edge, set it first */
+    retval = gpio_set(gpio, gpio->boot | gpio->reset);
+    if (retval)
+        return retval;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    until = start;
+    until.tv_nsec += GPIO_RESET_PULSE * 1000000L;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+
+    retval = gpio_set(gpio, gpio->boot);
+    if (retval)
+        return retval;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *width = (end.tv_sec - start.tv_sec) +
+             (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return -BFDEV_ENOERR;
+}
+
+int
+gpio_release(struct gpio_lines *gpio)
+{
+    return gpio_set(gpio, 0);
+}
+
+#else
+
+int
+gpio_open(struct gpio_lines *gpio)
+{
+    bfdev_log_err("\tGPIO character device support not built in\n");
+    return -BFDEV_ENOTSUPP;
+}
+
+int
+gpio_pulse(struct gpio_lines *gpio, double *width)
+{
+    return -BFDEV_ENOTSUPP;
+}
+
+int
+gpio_release(struct gpio_lines *gpio)
+{
+    return -BFDEV_ENOTSUPP;
+}
+
+#endif
+
+void
+gpio_close(struct gpio_lines *gpio)
+{
+    if (gpio->fd >= 0)
+        close(gpio->fd);
+    gpio->fd = -1;
+}
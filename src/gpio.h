@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define GPIO_MAX_LINES 64
+
+/*
+ * Reset and boot-mode lines of a fixture, all on one gpiochip and held
+ * in a single line request, so one ioctl moves every socket at once.
+ * Reset lines are active low, boot lines active high.
+ */
+struct gpio_lines {
+    char chip[64];
+    unsigned int offsets[GPIO_MAX_LINES];
+    unsigned int count;
+    uint64_t reset;
+    uint64_t boot;
+    int fd;
+};
+
+extern int
+gpio_parse(struct gpio_lines *gpio, const char *spec);
+
+extern int
+gpio_open(struct gpio_lines *gpio);
+
+extern int
+gpio_pulse(struct gpio_lines *gpio, double *width);
+
+extern int
+gpio_release(struct gpio_lines *gpio);
+
+extern void
+gpio_close(struct gpio_lines *gpio);
+
+#endif /* _GPIO_H_ */
@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <hub.h>
+#include <state.h>
+#include <timeout.h>
+
+static bool
+hub_usbdev(const char *name)
+{
+    /* Root hubs are "usbN", devices "B-P.P..", interfaces add ":C.I" */
+    if (!strncmp(name, "usb", 3) && isdigit(name[3]))
+        return true;
+
+    return isdigit(name[0]) && strchr(name, '-') && !strchr(name, ':');
+}
+
+static int
+hub_topology(const char *port, char *name, size_t size)
+{
+    char path[PATH_MAX], real[PATH_MAX], *walk;
+    const char *sysfs;
+
+    if (!realpath(port, real))
+        return -BFDEV_ENOENT;
+
+    /* $W80XPROG_SYSFS points at a mock tree for testing */
+    sysfs = getenv("W80XPROG_SYSFS") ?: "/sys";
+    if (snprintf(path, sizeof(path), "%s/class/tty/%s/device",
+                 sysfs, basename(real)) >= sizeof(path))
+        return -BFDEV_ENAMETOOLONG;
+
+    if (!realpath(path, real))
+        return -BFDEV_ENODEV;
+
+    /* Climb from the tty to its USB device, the parent of that is the hub */
+    for (;;) {
+        walk = strrchr(real, '/');
+        if (!walk || walk == real)
+            return -BFDEV_ENODEV;
+
+        if (hub_usbdev(walk + 1) && strncmp(walk + 1, "usb", 3))
+            break;
+        *walk = '\0';
+    }
+
+    *walk = '\0';
+    walk = strrchr(real, '/');
+    if (!walk || !hub_usbdev(walk + 1))
+        return -BFDEV_ENODEV;
+
+    if (snprintf(name, size, "%s", walk + 1) >= size)
+        return -BFDEV_ENAMETOOLONG;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+hub_file(struct hub_sched *hub, const char *suffix)
+{
+    char path[PATH_MAX];
+
+    if (state_path(path, sizeof(path), "hub-%s.%s", hub->name, suffix))
+        return -1;
+
+    return open(path, O_RDWR | O_CREAT, 0644);
+}
+
+int
+hub_open(struct hub_sched *hub, const char *port, unsigned int fixed)
+{
+    int retval;
+
+    hub->fixed = bfdev_min(fixed, HUB_MAX_SLOTS);
+    hub->slot = -1;
+    hub->fd = -1;
+
+    retval = hub_topology(port, hub->name, sizeof(hub->name));
+    if (retval)
+        return retval;
+
+    /* One byte range lock per transfer slot, dropped by the kernel on exit */
+    hub->fd = hub_file(hub, "slots");
+    if (hub->fd < 0)
+        return -BFDEV_EPERM;
+
+    bfdev_log_info("\tHub: %s\n", hub->name);
+    return -BFDEV_ENOERR;
+}
+
+int
+hub_stagger(struct hub_sched *hub)
+{
+    double last, now;
+    int fd;
+
+    fd = hub_file(hub, "entry");
+    if (fd < 0)
+        return -BFDEV_EPERM;
+
+    /*
+     * Reset pulses on one hub go out at least HUB_STAGGER apart. The
+     * lock is only held while waiting for our turn, not for the whole
+     * handshake.
+     */
+    flock(fd, LOCK_EX);
+    now = timeout_now();
+    if (pread(fd, &last, sizeof(last), 0) == sizeof(last) &&
+        last <= now && now < last + HUB_STAGGER / 1000.0) {
+        bfdev_log_debug("\thub: %s entry delayed %.1fms\n", hub->name,
+                        (last + HUB_STAGGER / 1000.0 - now) * 1000);
+        usleep((last + HUB_STAGGER / 1000.0 - now) * 1000000);
+        now = timeout_now();
+    }
+
+    pwrite(fd, &now, sizeof(now), 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+hub_lock(struct hub_sched *hub, unsigned int slot, int cmd, short type)
+{
+    struct flock lock = {
+        .l_type = type,
+        .l_whence = SEEK_SET,
+        .l_start = slot,
+        .l_len = 1,
+    };
+
+    if (fcntl(hub->fd, cmd, &lock))
+        return -BFDEV_EAGAIN;
+
+    /* STATE_GETLK reports F_UNLCK when nobody else holds it */
+    if (cmd == STATE_GETLK && lock.l_type != F_UNLCK)
+        return -BFDEV_EBUSY;
+
+    return -BFDEV_ENOERR;
+}
+
+static unsigned int
+hub_busy(struct hub_sched *hub)
+{
+    unsigned int slot, busy;
+
+    for (slot = busy = 0; slot < HUB_MAX_SLOTS; ++slot) {
+        if (slot != hub->slot && hub_lock(hub, slot, STATE_GETLK, F_WRLCK))
+            busy++;
+    }
+
+    return busy;
+}
+
+static void
+hub_stat_load(int fd, struct hub_stat *stat)
+{
+    if (pread(fd, stat, sizeof(*stat), 0) != sizeof(*stat) ||
+        stat->magic != HUB_MAGIC) {
+        memset(stat, 0, sizeof(*stat));
+        stat->magic = HUB_MAGIC;
+    }
+}
+
+static unsigned int
+hub_capacity(struct hub_sched *hub)
+{
+    struct hub_stat stat;
+    unsigned int level, best;
+    double aggregate, most;
+    int fd;
+
+    if (hub->fixed)
+        return hub->fixed;
+
+    fd = hub_file(hub, "stat");
+    if (fd < 0)
+        return HUB_DEFAULT_SLOTS;
+
+    flock(fd, LOCK_SH);
+    hub_stat_load(fd, &stat);
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    /* Pick the level with the best total throughput over the hub */
+    for (best = most = level = 0; level < HUB_MAX_SLOTS; ++level) {
+        aggregate = stat.rate[level] * (level + 1);
+        if (stat.samples[level] && aggregate > most) {
+            most = aggregate;
+            best = level + 1;
+        }
+    }
+
+    if (!best)
+        return HUB_DEFAULT_SLOTS;
+
+    /* Keep probing one level up until it has enough samples */
+    if (best < HUB_MAX_SLOTS && stat.samples[best] < HUB_EXPLORE)
+        best++;
+
+    return best;
+}
+
+int
+hub_acquire(struct hub_sched *hub)
+{
+    unsigned int slot;
+    bool waited;
+
+    hub->cap = hub_capacity(hub);
+    for (waited = false;; waited = true) {
+        for (slot = 0; slot < hub->cap; ++slot) {
+            if (!hub_lock(hub, slot, STATE_SETLK, F_WRLCK))
+                goto locked;
+        }
+
+        if (!waited)
+            bfdev_log_info("\tHub %s: all %u slots busy, waiting\n",
+                           hub->name, hub->cap);
+        usleep(HUB_POLL * 1000);
+    }
+
+locked:
+    hub->slot = slot;
+    hub->level = hub_busy(hub) + 1;
+    hub->start = timeout_now();
+
+    bfdev_log_info("\tHub %s: slot %u of %u, %u transfers running\n",
+                   hub->name, slot, hub->cap, hub->level);
+    return -BFDEV_ENOERR;
+}
+
+void
+hub_release(struct hub_sched *hub, size_t bytes)
+{
+    struct hub_stat stat;
+    unsigned int level;
+    double rate;
+    int fd;
+
+    if (hub->slot < 0)
+        return;
+
+    /* Count the busiest moment, transfers may have joined since */
+    level = bfdev_max(hub->level, hub_busy(hub) + 1);
+    level = bfdev_min(level, HUB_MAX_SLOTS);
+    hub_lock(hub, hub->slot, STATE_SETLK, F_UNLCK);
+    hub->slot = -1;
+
+    if (!bytes)
+        return;
+
+    rate = bytes / bfdev_max(timeout_now() - hub->start, 1e-6);
+    bfdev_log_info("\tHub %s: %u concurrent, %.3f KB/s per port\n",
+                   hub->name, level, rate / 1024);
+
+    fd = hub_file(hub, "stat");
+    if (fd < 0)
+        return;
+
+    flock(fd, LOCK_EX);
+    hub_stat_load(fd, &stat);
+    if (!stat.samples[level - 1]++)
+        stat.rate[level - 1] = rate;
+    else
+        stat.rate[level - 1] = 0.75 * stat.rate[level - 1] + 0.25 * rate;
+    pwrite(fd, &stat, sizeof(stat), 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+void
+hub_close(struct hub_sched *hub)
+{
+    hub_release(hub, 0);
+    if (hub->fd >= 0)
+        close(hub->fd);
+    hub->fd = -1;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _HUB_H_
+#define _HUB_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define HUB_MAGIC 0x42483857 /* "W8HB" */
+#define HUB_NAME_LEN 64
+
+/*
+ * Aggregate throughput seen at each concurrency level of one hub,
+ * shared by every w80xprog process on the station.
+ */
+struct hub_stat {
+    uint32_t magic;
+    uint32_t samples[HUB_MAX_SLOTS];
+    double rate[HUB_MAX_SLOTS];
+};
+
+struct hub_sched {
+    char name[HUB_NAME_LEN];
+    unsigned int fixed;
+    unsigned int cap;
+    unsigned int level;
+    int slot;
+    int fd;
+    double start;
+};
+
+extern int
+hub_open(struct hub_sched *hub, const char *port, unsigned int fixed);
+
+extern int
+hub_stagger(struct hub_sched *hub);
+
+extern int
+hub_acquire(struct hub_sched *hub);
+
+extern void
+hub_release(struct hub_sched *hub, size_t bytes);
+
+extern void
+hub_close(struct hub_sched *hub);
+
+#endif /* _HUB_H_ */
@@ -0,0 +1,288 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <string.h>
+#include <image.h>
+#include <w80xprog.h>
+
+int
+image_parse(const void *src, size_t size, size_t offset,
+            struct image_info *info)
+{
+    const struct image_header *head;
+    size_t total;
+
+    if (offset >= size)
+        return -BFDEV_ENODATA;
+
+    if (size - offset < sizeof(*head))
+        return -BFDEV_EOVERFLOW;
+
+    head = src + offset;
+    if (bfdev_le32_to_cpu(head->magic) != IMAGE_MAGIC)
+        return -BFDEV_EBADMSG;
+
+    info->head = head;
+    info->payload = (const uint8_t *)(head + 1);
+    info->offset = offset;
+    info->attr = bfdev_le32_to_cpu(head->attr);
+    info->addr = bfdev_le32_to_cpu(head->addr);
+    info->length = bfdev_le32_to_cpu(head->length);
+
+    /* Signed images carry the signature after the payload */
+    total = sizeof(*head) + info->length;
+    if (info->attr & IMAGE_ATTR_SIGN)
+        total += IMAGE_SIGN_SIZE;
+
+    if (total > size - offset)
+        return -BFDEV_EOVERFLOW;
+
+    info->size = total;
+    return -BFDEV_ENOERR;
+}
+
+static uint32_t
+image_payload_crc(const struct image_info *info)
+{
+    const uint8_t *walk;
+    size_t remain, xfer;
+    uint32_t crc;
+
+    /* Sum the mapping chunk by chunk so it streams through the cache */
+    crc = IMAGE_CRC_INIT;
+    walk = info->payload;
+
+    for (remain = info->length; remain; remain -= xfer) {
+        xfer = bfdev_min(remain, IMAGE_CRC_CHUNK);
+        crc = image_crc(walk, xfer, crc);
+        walk += xfer;
+    }
+
+    return crc;
+}
+
+static int
+image_reject(unsigned int index, char code)
+{
+    bfdev_log_err("\tImage %u: [%#04x]: %s\n", index, code, status_info(code));
+    return -BFDEV_EBADMSG;
+}
+
+static int
+image_overlap(struct image_range *ranges, unsigned int count,
+              uint32_t start, uint32_t end)
+{
+    unsigned int index;
+
+    for (index = 0; index < count; ++index) {
+        if (start < ranges[index].end && ranges[index].start < end)
+            return -BFDEV_EEXIST;
+    }
+
+    ranges[count].start = start;
+    ranges[count].end = end;
+
+    return -BFDEV_ENOERR;
+}
+
+int
+image_place(const struct image_header *head, unsigned int index,
+            struct image_range *ranges)
+{
+    uint32_t addr, length, header;
+
+    if (index == IMAGE_MAX_RANGES) {
+        bfdev_log_err("\tImage %u: too many images\n", index);
+        return -BFDEV_EFBIG;
+    }
+
+    addr = bfdev_le32_to_cpu(head->addr);
+    length = bfdev_le32_to_cpu(head->length);
+    header = bfdev_le32_to_cpu(head->header);
+
+    if (addr % SPINOR_PAGE_SIZE || header % SPINOR_PAGE_SIZE)
+        return image_reject(index, RETURN_EALIGN);
+
+    if (addr < SPINOR_BASE || header < SPINOR_BASE ||
+        header > UINT32_MAX - sizeof(*head))
+        return image_reject(index, RETURN_EADDR);
+
+    if (length > UINT32_MAX - addr)
+        return image_reject(index, RETURN_ESIZE);
+
+    if (image_overlap(ranges, index * 2, header, header + sizeof(*head)) ||
+        image_overlap(ranges, index * 2 + 1, addr, addr + length))
+        return image_reject(index, RETURN_EADDR);
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+image_capacity(const struct image_header *head, unsigned int index,
+               size_t flash)
+{
+    size_t end;
+
+    end = bfdev_max((size_t)bfdev_le32_to_cpu(head->addr) +
+                    bfdev_le32_to_cpu(head->length),
+                    (size_t)bfdev_le32_to_cpu(head->header) + sizeof(*head));
+
+    if (end - SPINOR_BASE > flash) {
+        bfdev_log_err("\tImage %u: ends at %#zx beyond %zu KiB flash\n",
+                      index, end, flash / 1024);
+        return image_reject(index, RETURN_ESIZE);
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+int
+image_validate(const void *src, size_t size)
+{
+    struct image_range ranges[IMAGE_MAX_RANGES * 2];
+    struct image_info info;
+    unsigned int index;
+    size_t offset;
+    int retval;
+
+    /*
+     * Run the same checks as the ROM does after the transfer, so a
+     * bad image fails before the first packet goes on the wire.
+     */
+    for (index = offset = 0; offset < size; offset += info.size, ++index) {
+        retval = image_parse(src, size, offset, &info);
+        if (retval == -BFDEV_EOVERFLOW)
+            return image_reject(index, RETURN_EDATA);
+        else if (retval)
+            return image_reject(index, RETURN_EHCRC);
+
+        if (bfdev_le32_to_cpu(info.head->hcrc) != image_hcrc(info.head))
+            return image_reject(index, RETURN_EHCRC);
+
+        retval = image_place(info.head, index, ranges);
+        if (retval)
+            return retval;
+
+        if (bfdev_le32_to_cpu(info.head->checksum) != image_payload_crc(&info))
+            return image_reject(index, RETURN_EDCRC);
+
+        bfdev_log_debug("\tImage %u: type %u, %u bytes at %#010x\n", index,
+                        IMAGE_ATTR_TYPE(info.attr), info.length, info.addr);
+    }
+
+    if (!index)
+        return image_reject(0, RETURN_EDATA);
+
+    return -BFDEV_ENOERR;
+}
+
+int
+image_fits(const void *src, size_t size, size_t flash)
+{
+    struct image_info info;
+    unsigned int index;
+    size_t offset;
+    int retval;
+
+    for (index = offset = 0; !image_parse(src, size, offset, &info);
+         offset += info.size, ++index) {
+        retval = image_capacity(info.head, index, flash);
+        if (retval)
+            return retval;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+void
+image_check_init(struct image_check *check)
+{
+    check->state = IMAGE_CHECK_HEAD;
+    check->index = 0;
+    check->fill = 0;
+    check->flash = 0;
+}
+
+int
+image_check_feed(struct image_check *check, const void *data, size_t len)
+{
+    const uint8_t *walk;
+    uint32_t attr;
+    size_t xfer;
+    int retval;
+
+    /*
+     * Same checks as image_validate() for data that is only seen once,
+     * e.g. a decompressed pipe: headers fail as soon as they arrive.
+     */
+    for (walk = data;; walk += xfer, len -= xfer) {
+        switch (check->state) {
+            case IMAGE_CHECK_HEAD:
+                xfer = bfdev_min(len, sizeof(check->head) - check->fill);
+                memcpy((uint8_t *)&check->head + check->fill, walk, xfer);
+                check->fill += xfer;
+
+                if (check->fill < sizeof(check->head))
+                    return -BFDEV_ENOERR;
+
+                if (bfdev_le32_to_cpu(check->head.magic) != IMAGE_MAGIC ||
+                    bfdev_le32_to_cpu(check->head.hcrc) != image_hcrc(&check->head))
+                    return image_reject(check->index, RETURN_EHCRC);
+
+                /* Placed before the chunk holding it goes to the wire */
+                retval = image_place(&check->head, check->index, check->ranges);
+                if (!retval && check->flash)
+                    retval = image_capacity(&check->head, check->index,
+                                            check->flash);
+                if (retval)
+                    return retval;
+
+                check->crc = IMAGE_CRC_INIT;
+                check->remain = bfdev_le32_to_cpu(check->head.length);
+                check->state = IMAGE_CHECK_PAYLOAD;
+                break;
+
+            case IMAGE_CHECK_PAYLOAD:
+                xfer = bfdev_min(len, check->remain);
+                check->crc = image_crc(walk, xfer, check->crc);
+                check->remain -= xfer;
+
+                if (check->remain)
+                    return -BFDEV_ENOERR;
+
+                if (bfdev_le32_to_cpu(check->head.checksum) != check->crc)
+                    return image_reject(check->index, RETURN_EDCRC);
+
+                attr = bfdev_le32_to_cpu(check->head.attr);
+                check->remain = attr & IMAGE_ATTR_SIGN ? IMAGE_SIGN_SIZE : 0;
+                check->state = IMAGE_CHECK_SIGN;
+                break;
+
+            case IMAGE_CHECK_SIGN: default:
+                xfer = bfdev_min(len, check->remain);
+                check->remain -= xfer;
+
+                if (check->remain)
+                    return -BFDEV_ENOERR;
+
+                check->fill = 0;
+                check->index++;
+                check->state = IMAGE_CHECK_HEAD;
+
+                if (len == xfer)
+                    return -BFDEV_ENOERR;
+                break;
+        }
+    }
+}
+
+int
+image_check_end(struct image_check *check)
+{
+    if (check->state != IMAGE_CHECK_HEAD || check->fill || !check->index)
+        return image_reject(check->index, RETURN_EDATA);
+
+    return -BFDEV_ENOERR;
+}
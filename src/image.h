@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+#include <w80xhw.h>
+
+#define IMAGE_CRC_CHUNK (64 * 1024)
+#define IMAGE_MAX_RANGES 32
+
+struct image_info {
+    const struct image_header *head;
+    const uint8_t *payload;
+    size_t offset;
+    size_t size;
+    uint32_t attr;
+    uint32_t addr;
+    uint32_t length;
+};
+
+/* Reflected CRC-32 seeded with all ones and no final inversion */
+#define IMAGE_CRC_INIT 0xffffffff
+
+static inline uint32_t
+image_crc(const void *src, size_t len, uint32_t crc)
+{
+    return bfdev_crc32(src, len, crc);
+}
+
+static inline uint32_t
+image_hcrc(const struct image_header *head)
+{
+    return image_crc(head, offsetof(struct image_header, hcrc),
+                     IMAGE_CRC_INIT);
+}
+
+struct image_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+enum image_check_state {
+    IMAGE_CHECK_HEAD = 0,
+    IMAGE_CHECK_PAYLOAD,
+    IMAGE_CHECK_SIGN,
+};
+
+struct image_check {
+    struct image_header head;
+    enum image_check_state state;
+    unsigned int index;
+    unsigned int fill;
+    uint32_t remain;
+    uint32_t crc;
+
+    /* Flash size once the chip is known, zero skips the check */
+    size_t flash;
+    struct image_range ranges[IMAGE_MAX_RANGES * 2];
+};
+
+extern void
+image_check_init(struct image_check *check);
+
+extern int
+image_check_feed(struct image_check *check, const void *data, size_t len);
+
+extern int
+image_check_end(struct image_check *check);
+
+extern int
+image_place(const struct image_header *head, unsigned int index,
+            struct image_range *ranges);
+
+extern int
+image_parse(const void *src, size_t size, size_t offset,
+            struct image_info *info);
+
+extern int
+image_validate(const void *src, size_t size);
+
+extern int
+image_fits(const void *src, size_t size, size_t flash);
+
+#endif /* _IMAGE_H_ */
@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <journal.h>
+#include <state.h>
+#include <w80xprog.h>
+
+static void
+journal_resume(struct journal *jnl, const struct image_info *images,
+               unsigned int count, size_t acked, bool partial)
+{
+    const struct image_info *info;
+    size_t payload, done;
+    uint32_t start;
+    unsigned int index;
+
+    /* The last image is never skipped, its EOT may have been lost */
+    for (index = 0; index + 1 < count; ++index) {
+        if (images[index + 1].offset > acked)
+            break;
+    }
+
+    info = &images[index];
+    jnl->resume = info->offset;
+    jnl->image = index;
+    jnl->skip = 0;
+
+    /*
+     * Signed and compressed images are only checked as a whole. Inside
+     * a plain one, resend from the sector below the acked offset as a
+     * sub-image of its own, and always at least its last sector so the
+     * chip runs a CRC over the tail.
+     */
+    if (!partial || info->attr & (IMAGE_ATTR_SIGN | IMAGE_ATTR_ZIP))
+        return;
+
+    payload = info->offset + sizeof(*info->head);
+    if (acked <= payload)
+        return;
+
+    done = bfdev_min(acked - payload, (size_t)info->length - 1);
+    start = BFDEV_ALIGN_LOW(info->addr + done, SPINOR_SECTOR_SIZE);
+    if (start <= info->addr)
+        return;
+
+    jnl->skip = start - info->addr;
+    jnl->resume = payload + jnl->skip;
+}
+
+int
+journal_open(struct journal *jnl, const char *mac, const uint8_t *hash,
+             const struct image_info *images, unsigned int count,
+             size_t size, bool partial)
+{
+    struct journal_record *record;
+    char name[32], *walk;
+    int retval;
+
+    jnl->record = NULL;
+    jnl->resume = 0;
+    jnl->skip = 0;
+
+    /* One journal per device, named after its mac address */
+    for (walk = name; *mac && walk < name + sizeof(name) - 1; ++mac) {
+        if (*mac != ':')
+            *walk++ = *mac;
+    }
+    *walk = '\0';
+
+    retval = state_path(jnl->path, sizeof(jnl->path), "resume-%s.jnl", name);
+    if (retval)
+        return retval;
+
+    jnl->fd = open(jnl->path, O_RDWR | O_CREAT, 0644);
+    if (jnl->fd < 0)
+        return -BFDEV_EPERM;
+
+    if (ftruncate(jnl->fd, sizeof(*record))) {
+        close(jnl->fd);
+        return -BFDEV_EPERM;
+    }
+
+    record = mmap(NULL, sizeof(*record), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, jnl->fd, 0);
+    if (record == MAP_FAILED) {
+        close(jnl->fd);
+        return -BFDEV_ENOMEM;
+    }
+
+    jnl->record = record;
+    if (record->magic == JOURNAL_MAGIC && record->size == size &&
+        !memcmp(record->hash, hash, SHA256_DIGEST_SIZE) &&
+        !strcmp(record->mac, name) && record->acked) {
+        journal_resume(jnl, images, count, record->acked, partial);
+        if (jnl->skip)
+            bfdev_log_info("\tResume: %llu/%zu bytes acknowledged, "
+                           "image %u from %#010x (%zu bytes left)\n",
+                           (unsigned long long)record->acked, size,
+                           jnl->image, images[jnl->image].addr + jnl->skip,
+                           size - jnl->resume);
+        else if (jnl->resume)
+            bfdev_log_info("\tResume: %llu/%zu bytes acknowledged, "
+                           "skipping %u images (%zu bytes)\n",
+                           (unsigned long long)record->acked, size,
+                           jnl->image, jnl->resume);
+        else
+            bfdev_log_info("\tResume: %llu/%zu bytes acknowledged, "
+                           "inside the first image, starting over\n",
+                           (unsigned long long)record->acked, size);
+        record->acked = jnl->resume;
+        return -BFDEV_ENOERR;
+    }
+
+    memset(record, 0, sizeof(*record));
+    memcpy(record->hash, hash, SHA256_DIGEST_SIZE);
+    strcpy(record->mac, name);
+    record->size = size;
+    record->images = count;
+    record->magic = JOURNAL_MAGIC;
+
+    return -BFDEV_ENOERR;
+}
+
+void
+journal_ack(struct journal *jnl, size_t done)
+{
+    if (jnl->record)
+        jnl->record->acked = jnl->resume + done;
+}
+
+int
+journal_finish(struct journal *jnl, char status)
+{
+    struct journal_record *record;
+
+    record = jnl->record;
+    if (!record)
+        return -BFDEV_ENOERR;
+
+    /*
+     * Packet ACKs only say the bytes crossed the link. The chip checks
+     * the CRC of every image, or sub-image, it took in this run, a
+     * failure there voids what earlier runs left behind as well.
+     */
+    if (status != RETURN_NOMAL) {
+        bfdev_log_err("\tIntegrity: [%#04x]: %s, next run starts over\n",
+                      status, status_info(status));
+        memset(record, 0, sizeof(*record));
+        return -BFDEV_EIO;
+    }
+
+    if (record->acked != record->size) {
+        bfdev_log_err("\tIntegrity: %llu/%llu bytes acknowledged\n",
+                      (unsigned long long)record->acked,
+                      (unsigned long long)record->size);
+        return -BFDEV_EIO;
+    }
+
+    bfdev_log_info("\tIntegrity: %u images, %llu bytes in place, "
+                   "checked by the chip (resumed at %zu)\n", record->images,
+                   (unsigned long long)record->size, jnl->resume);
+
+    munmap(record, sizeof(*record));
+    jnl->record = NULL;
+    close(jnl->fd);
+    unlink(jnl->path);
+
+    return -BFDEV_ENOERR;
+}
+
+void
+journal_close(struct journal *jnl)
+{
+    if (!jnl->record)
+        return;
+
+    msync(jnl->record, sizeof(*jnl->record), MS_SYNC);
+    munmap(jnl->record, sizeof(*jnl->record));
+    jnl->record = NULL;
+    close(jnl->fd);
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <config.h>
+#include <limits.h>
+#include <bfdev.h>
+#include <sha256.h>
+#include <image.h>
+
+#define JOURNAL_MAGIC 0x4a523857 /* "W8RJ" */
+
+struct journal_record {
+    uint32_t magic;
+    uint32_t images;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    char mac[20];
+    uint64_t size;
+    uint64_t acked;
+};
+
+struct journal {
+    struct journal_record *record;
+    char path[PATH_MAX];
+    size_t resume;
+    int fd;
+
+    /* Image resumed inside, and its payload bytes already in flash */
+    unsigned int image;
+    uint32_t skip;
+};
+
+extern int
+journal_open(struct journal *jnl, const char *mac, const uint8_t *hash,
+             const struct image_info *images, unsigned int count,
+             size_t size, bool partial);
+
+extern void
+journal_ack(struct journal *jnl, size_t done);
+
+extern int
+journal_finish(struct journal *jnl, char status);
+
+extern void
+journal_close(struct journal *jnl);
+
+#endif /* _JOURNAL_H_ */
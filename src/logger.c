@@ -0,0 +1,320 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <logger.h>
+
+struct logger_record {
+    uint16_t length;
+    uint8_t level;
+    uint8_t reserved;
+};
+
+static struct logger_session logger_sessions[LOGGER_SESSIONS];
+static _Atomic unsigned int logger_count;
+static __thread struct logger_session *logger_current;
+static __thread bool logger_hotpath;
+
+/* Serialises the output itself, never taken on the hot path */
+static pthread_mutex_t logger_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t logger_thread;
+static atomic_bool logger_running;
+
+static void
+ring_copy_in(struct logger_session *sess, size_t pos, const void *src, size_t len)
+{
+    size_t offset, first;
+
+    offset = pos & (LOGGER_RING - 1);
+    first = bfdev_min(len, LOGGER_RING - offset);
+    memcpy(sess->ring + offset, src, first);
+    memcpy(sess->ring, src + first, len - first);
+}
+
+static void
+ring_copy_out(struct logger_session *sess, size_t pos, void *dest, size_t len)
+{
+    size_t offset, first;
+
+    offset = pos & (LOGGER_RING - 1);
+    first = bfdev_min(len, LOGGER_RING - offset);
+    memcpy(dest, sess->ring + offset, first);
+    memcpy(dest + first, sess->ring, len - first);
+}
+
+static void
+logger_emit(struct logger_session *sess, const char *text, size_t len)
+{
+    const char *walk, *end;
+
+    if (!sess || !*sess->prefix) {
+        fwrite(text, 1, len, stdout);
+        return;
+    }
+
+    /* The prefix goes in front of every line, not every record */
+    for (end = text + len; text < end; text = walk) {
+        if (sess->newline)
+            fputs(sess->prefix, stdout);
+
+        walk = memchr(text, '\n', end - text);
+        walk = walk ? walk + 1 : end;
+        fwrite(text, 1, walk - text, stdout);
+        sess->newline = walk[-1] == '\n';
+    }
+}
+
+static void
+logger_drain(struct logger_session *sess)
+{
+    struct logger_record record;
+    char text[LOGGER_LINE];
+    unsigned long dropped;
+    size_t head, tail;
+    uint32_t seq;
+    int len;
+
+    head = atomic_load_explicit(&sess->head, memory_order_acquire);
+    tail = atomic_load_explicit(&sess->tail, memory_order_relaxed);
+
+    while (tail != head) {
+        ring_copy_out(sess, tail, &record, sizeof(record));
+        ring_copy_out(sess, tail + sizeof(record), text, record.length);
+        tail += sizeof(record) + record.length;
+        logger_emit(sess, text, record.length);
+    }
+
+    atomic_store_explicit(&sess->tail, tail, memory_order_release);
+
+    /* Only the latest status line is worth showing */
+    seq = atomic_load_explicit(&sess->status_seq, memory_order_acquire);
+    if (!(seq & 1) && seq != sess->status_shown) {
+        memcpy(text, sess->status, sizeof(text));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&sess->status_seq, memory_order_relaxed) == seq) {
+            text[sizeof(text) - 1] = '\0';
+            fputs("\r", stdout);
+            if (*sess->prefix)
+                fputs(sess->prefix, stdout);
+            fputs(text, stdout);
+            fputs("\r", stdout);
+            sess->status_shown = seq;
+        }
+    }
+
+    dropped = atomic_load_explicit(&sess->dropped, memory_order_relaxed);
+    if (dropped != sess->reported) {
+        len = snprintf(text, sizeof(text), "\n\tlog: %lu messages dropped\n",
+                       dropped - sess->reported);
+        logger_emit(sess, text, len);
+        sess->reported = dropped;
+    }
+}
+
+void
+logger_flush(void)
+{
+    unsigned int index, count;
+
+    pthread_mutex_lock(&logger_lock);
+    count = atomic_load(&logger_count);
+    for (index = 0; index < count; ++index)
+        logger_drain(&logger_sessions[index]);
+    fflush(stdout);
+    pthread_mutex_unlock(&logger_lock);
+}
+
+static void *
+logger_worker(void *pdata)
+{
+    struct timespec period;
+
+    period.tv_sec = 0;
+    period.tv_nsec = LOGGER_PERIOD * 1000000L;
+
+    while (atomic_load(&logger_running)) {
+        nanosleep(&period, NULL);
+        logger_flush();
+    }
+
+    return NULL;
+}
+
+int
+logger_start(void)
+{
+    sigset_t mask, saved;
+    int retval;
+
+    /* Cancel signals belong to the link thread */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+
+    atomic_store(&logger_running, true);
+    pthread_sigmask(SIG_BLOCK, &mask, &saved);
+    retval = pthread_create(&logger_thread, NULL, logger_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (retval) {
+        atomic_store(&logger_running, false);
+        return -BFDEV_ENOMEM;
+    }
+
+    atexit(logger_stop);
+    return -BFDEV_ENOERR;
+}
+
+void
+logger_stop(void)
+{
+    if (!atomic_exchange(&logger_running, false))
+        return;
+
+    pthread_join(logger_thread, NULL);
+    logger_flush();
+}
+
+int
+logger_session(const char *prefix)
+{
+    struct logger_session *sess;
+    unsigned int index;
+
+    index = atomic_load(&logger_count);
+    if (index == LOGGER_SESSIONS)
+        return -BFDEV_ENOSPC;
+
+    sess = &logger_sessions[index];
+    sess->ring = malloc(LOGGER_RING);
+    if (!sess->ring)
+        return -BFDEV_ENOMEM;
+
+    snprintf(sess->prefix, sizeof(sess->prefix), "%s", prefix ?: "");
+    sess->newline = true;
+
+    /* Published last, the writer only walks complete sessions */
+    pthread_mutex_lock(&logger_lock);
+    atomic_store(&logger_count, index + 1);
+    pthread_mutex_unlock(&logger_lock);
+
+    logger_current = sess;
+    return -BFDEV_ENOERR;
+}
+
+void
+logger_hot(bool enable)
+{
+    logger_hotpath = enable && atomic_load(&logger_running);
+    if (!enable)
+        logger_flush();
+}
+
+static bool
+logger_push(struct logger_session *sess, unsigned int level,
+            const char *text, size_t len)
+{
+    struct logger_record record;
+    size_t head, tail, limit;
+
+    head = atomic_load_explicit(&sess->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&sess->tail, memory_order_acquire);
+
+    /* Chatter gives way first, the last quarter is kept for errors */
+    limit = level <= LOGGER_WARN ? LOGGER_RING : LOGGER_RING / 4 * 3;
+    if (head - tail + sizeof(record) + len > limit) {
+        atomic_fetch_add_explicit(&sess->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    record.length = len;
+    record.level = level;
+    record.reserved = 0;
+
+    ring_copy_in(sess, head, &record, sizeof(record));
+    ring_copy_in(sess, head + sizeof(record), text, len);
+    atomic_store_explicit(&sess->head, head + sizeof(record) + len,
+                          memory_order_release);
+
+    return true;
+}
+
+void
+logger_printf(enum logger_level level, const char *fmt, ...)
+{
+    char text[LOGGER_LINE];
+    va_list args;
+    int len;
+
+    if (level >= LOGGER_DEBUG &&
+        bfdev_log_default.record_level < BFDEV_LEVEL_DEBUG)
+        return;
+
+    va_start(args, fmt);
+    len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        return;
+    len = bfdev_min(len, (int)sizeof(text) - 1);
+
+    if (logger_hotpath && logger_current) {
+        logger_push(logger_current, level, text, len);
+        return;
+    }
+
+    /* Off the hot path print in place, after anything still queued */
+    pthread_mutex_lock(&logger_lock);
+    if (logger_current)
+        logger_drain(logger_current);
+    logger_emit(logger_current, text, len);
+    fflush(stdout);
+    pthread_mutex_unlock(&logger_lock);
+}
+
+void
+logger_status(const char *fmt, ...)
+{
+    struct logger_session *sess;
+    char text[LOGGER_LINE];
+    va_list args;
+    uint32_t seq;
+
+    sess = logger_current;
+    if (!logger_hotpath || !sess) {
+        va_start(args, fmt);
+        vsnprintf(text, sizeof(text), fmt, args);
+        va_end(args);
+
+        /* Drawn in place like logger_printf(), behind the same prefix */
+        pthread_mutex_lock(&logger_lock);
+        if (sess)
+            logger_drain(sess);
+        fputs("\r", stdout);
+        if (sess && *sess->prefix)
+            fputs(sess->prefix, stdout);
+        fputs(text, stdout);
+        fputs("\r", stdout);
+        fflush(stdout);
+        pthread_mutex_unlock(&logger_lock);
+        return;
+    }
+
+    seq = atomic_load_explicit(&sess->status_seq, memory_order_relaxed);
+    atomic_store_explicit(&sess->status_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    va_start(args, fmt);
+    vsnprintf(sess->status, sizeof(sess->status), fmt, args);
+    va_end(args);
+
+    atomic_store_explicit(&sess->status_seq, seq + 2, memory_order_release);
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <bfdev.h>
+
+/* Same numbering as the bfdev record level */
+enum logger_level {
+    LOGGER_ERR = 3,
+    LOGGER_WARN = 4,
+    LOGGER_INFO = 6,
+    LOGGER_DEBUG = 7,
+};
+
+/*
+ * One session per thread that talks to a device. Its ring has a single
+ * producer, the session thread, and a single consumer, the writer, so
+ * neither side takes a lock. The progress line is not queued, the
+ * writer shows whatever the latest one is.
+ */
+struct logger_session {
+    char prefix[LOGGER_PREFIX];
+    uint8_t *ring;
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    _Atomic unsigned long dropped;
+    unsigned long reported;
+    bool newline;
+
+    _Atomic uint32_t status_seq;
+    uint32_t status_shown;
+    char status[LOGGER_LINE];
+};
+
+extern int
+logger_start(void);
+
+extern void
+logger_stop(void);
+
+extern int
+logger_session(const char *prefix);
+
+extern void
+logger_hot(bool enable);
+
+extern void
+logger_flush(void);
+
+extern void
+logger_printf(enum logger_level level, const char *fmt, ...);
+
+extern void
+logger_status(const char *fmt, ...);
+
+#endif /* _LOGGER_H_ */
@@ -8,6 +8,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <signal.h>
 #include <err.h>
 #include <getopt.h>
 #include <sys/mman.h>
@@ -15,6 +17,24 @@
 
 #include <w80xprog.h>
 #include <term.h>
+#include <timeout.h>
+#include <flashlist.h>
+#include <builder.h>
+#include <stub.h>
+#include <stubemu.h>
+#include <secbootemu.h>
+#include <audit.h>
+#include <boot.h>
+#include <plan.h>
+#include <hub.h>
+#include <realtime.h>
+#include <session.h>
+#include <board.h>
+#include <gaindb.h>
+#include <profile.h>
+#include <logger.h>
+#include <budget.h>
+#include <fixture.h>
 
 #define DEFAULTS_PORT "/dev/ttyUSB0"
 #define DEFAULTS_SPEED 115200
@@ -23,10 +43,28 @@ enum {
     __FLAG_SECBOOT = 0,
     __FLAG_RESET,
     __FLAG_INFO,
+    __FLAG_COMPRESS,
+    __FLAG_STUB,
+    __FLAG_HUB,
+    __FLAG_REALTIME,
+    __FLAG_GAINDB,
+    __FLAG_PROFILE,
+    __FLAG_AUTOSPEED,
+    __FLAG_BUDGET,
+    __FLAG_FIXTURE,
 
     FLAG_SECBOOT = 1UL << __FLAG_SECBOOT,
     FLAG_RESET = 1UL << __FLAG_RESET,
     FLAG_INFO = 1UL << __FLAG_INFO,
+    FLAG_COMPRESS = 1UL << __FLAG_COMPRESS,
+    FLAG_STUB = 1UL << __FLAG_STUB,
+    FLAG_HUB = 1UL << __FLAG_HUB,
+    FLAG_REALTIME = 1UL << __FLAG_REALTIME,
+    FLAG_GAINDB = 1UL << __FLAG_GAINDB,
+    FLAG_PROFILE = 1UL << __FLAG_PROFILE,
+    FLAG_AUTOSPEED = 1UL << __FLAG_AUTOSPEED,
+    FLAG_BUDGET = 1UL << __FLAG_BUDGET,
+    FLAG_FIXTURE = 1UL << __FLAG_FIXTURE,
 };
 
 static const struct option
@@ -42,7 +80,23 @@ options[] = {
     {"bt",      required_argument,  0,  'b'},
     {"wifi",    required_argument,  0,  'w'},
     {"gain",    required_argument,  0,  'g'},
+    {"gain-db", required_argument,  0,  'G'},
+    {"gain-key", required_argument, 0,  'K'},
     {"reset",   no_argument,        0,  'r'},
+    {"compress", no_argument,       0,  'z'},
+    {"ahead",   required_argument,  0,  'a'},
+    {"stub",    required_argument,  0,  'S'},
+    {"boot",    required_argument,  0,  'B'},
+    {"crash",   required_argument,  0,  'C'},
+    {"boot-timeout", required_argument, 0, 'T'},
+    {"app-speed", required_argument, 0, 'U'},
+    {"plan",    required_argument,  0,  'P'},
+    {"hub",     required_argument,  0,  'H'},
+    {"realtime", required_argument, 0,  'R'},
+    {"gpio-reset", required_argument, 0, 'X'},
+    {"mem-budget", required_argument, 0, 'M'},
+    {"log-prefix", required_argument, 0, 'L'},
+    {"verbose", no_argument,        0,  'v'},
     { }, /* NULL */
 };
 
@@ -50,18 +104,44 @@ static __bfdev_noreturn void
 usage(void)
 {
     bfdev_log_err("Usage: w80xprog [options]...\n");
+    bfdev_log_err("       w80xprog build [options] <type>:<addr>:<file>...\n");
+    bfdev_log_err("       w80xprog stub-emu [options] <flash-file>\n");
+    bfdev_log_err("       w80xprog secboot-emu [options] <stream-file>\n");
+    bfdev_log_err("       w80xprog audit [options]\n");
+    bfdev_log_err("       w80xprog board [options]\n");
+    bfdev_log_err("       w80xprog gain-db [options] <file>...\n");
+    bfdev_log_err("       w80xprog profile [options]\n");
     bfdev_log_err("\t-h, --help                display this message\n");
-    bfdev_log_err("\t-p, --port <device>       set device path\n");
+    bfdev_log_err("\t-p, --port <device>       set device path, repeat with -X\n");
     bfdev_log_err("\t-s, --speed <freq>        set link baudrate\n");
-    bfdev_log_err("\t-n, --nspeed <freq>       set new baudrate\n");
+    bfdev_log_err("\t-n, --nspeed <freq>       set new baudrate, auto from the flash profile\n");
     bfdev_log_err("\t-o, --secboot             entry secboot mode\n");
     bfdev_log_err("\t-i, --info                read the chip info\n");
     bfdev_log_err("\t-f, --flash <file>        flash chip with data from filename\n");
+    bfdev_log_err("\t                          repeat, or give a directory or @manifest\n");
+    bfdev_log_err("\t                          an interrupted run resumes where it stopped\n");
     bfdev_log_err("\t-e, --erase <offset:size> erase the specific flash\n");
     bfdev_log_err("\t-b, --bt <mac>            set bluetooth mac address\n");
     bfdev_log_err("\t-w, --wifi <mac>          set wifi mac address\n");
     bfdev_log_err("\t-g, --gain <gain>         set power amplifier gain\n");
+    bfdev_log_err("\t-G, --gain-db <file>      set the gain stored for this board\n");
+    bfdev_log_err("\t-K, --gain-key <key>      store key, default wifi mac\n");
     bfdev_log_err("\t-r, --reset               reset chip after operate\n");
+    bfdev_log_err("\t-z, --compress            compress images before transfer\n");
+    bfdev_log_err("\t-a, --ahead <packets>     send-ahead window (1 is stop-and-wait)\n");
+    bfdev_log_err("\t-S, --stub <file>         flash through a RAM flasher stub\n");
+    bfdev_log_err("\t-B, --boot <regex>        wait for the app banner after reset\n");
+    bfdev_log_err("\t-C, --crash <regex>       app output that means it crashed\n");
+    bfdev_log_err("\t-T, --boot-timeout <ms>   deadline for the banner\n");
+    bfdev_log_err("\t-U, --app-speed <freq>    app baudrate for the boot check\n");
+    bfdev_log_err("\t-P, --plan <freq,...>     predict the cycle time, touch no device\n");
+    bfdev_log_err("\t-H, --hub <slots>         share the USB hub, 0 learns the slot count\n");
+    bfdev_log_err("\t-R, --realtime <cpu>      pin the link to a cpu with low jitter\n");
+    bfdev_log_err("\t-X, --gpio-reset <lines>  reset all ports through gpio, then flash in parallel\n");
+    bfdev_log_err("\t                          <chip>:<reset,...>[:<boot,...>]\n");
+    bfdev_log_err("\t-M, --mem-budget <KiB>    bounded memory, fail above this peak RSS\n");
+    bfdev_log_err("\t-L, --log-prefix <text>   start every output line with text\n");
+    bfdev_log_err("\t-v, --verbose             print timeout decisions\n");
     exit(1);
 }
 
@@ -74,42 +154,250 @@ check_mac(const char *str)
         usage();
 }
 
+static void
+audit_session(const char *port, const struct flash_list *flist,
+              const char *wmac, const char *bmac, const char *gain,
+              double start, int status)
+{
+    struct audit_record record;
+    struct timespec now;
+    const char *errname;
+    int retval;
+
+    memset(&record, 0, sizeof(record));
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.time = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    record.size = flist->hashed;
+    record.pid = getpid();
+    record.status = status;
+    record.elapsed = (timeout_now() - start) * 1000;
+    memcpy(record.hash, flist->digest, sizeof(record.hash));
+
+    snprintf(record.wmac, sizeof(record.wmac), "%s", wmac ?: flist->mac);
+    snprintf(record.bmac, sizeof(record.bmac), "%s", bmac ?: "");
+    snprintf(record.port, sizeof(record.port), "%s", port);
+    snprintf(record.gain, sizeof(record.gain), "%s", gain ?: "");
+
+    retval = audit_append(&record);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_warn("Audit log unavailable: %s\n", errname);
+    }
+}
+
+static void
+plan_session(struct flash_list *flist, unsigned int speed, unsigned int flags,
+             unsigned int ahead, size_t esize, const char *bmac,
+             const char *wmac, const char *gain, const unsigned int *rates,
+             unsigned int count)
+{
+    struct plan_session session;
+    const char *errname;
+    int retval;
+
+    session.speed = speed;
+    session.window = ahead;
+    session.erase = esize;
+    session.secboot = !!(flags & FLAG_SECBOOT);
+    session.bmac = !!bmac;
+    session.wmac = !!wmac;
+    session.gain = gain || (flags & FLAG_GAINDB);
+    session.reset = !!(flags & FLAG_RESET);
+
+    if (flist->count && (flags & FLAG_COMPRESS)) {
+        retval = flashlist_compress(flist, sysconf(_SC_NPROCESSORS_ONLN));
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Failed to compress image: %s\n", errname);
+            exit(retval);
+        }
+    }
+
+    retval = plan_predict(flist, &session, rates, count);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_err("Failed to plan: %s\n", errname);
+    }
+
+    exit(retval);
+}
+
+static int
+gain_lookup(struct gaindb *db, const char *key, char *hex,
+            const uint8_t **gain)
+{
+    unsigned int index;
+    int retval;
+
+    retval = gaindb_lookup(db, key, gain);
+    if (retval)
+        return retval;
+
+    /* The audit log keeps gains the way -g takes them */
+    for (index = 0; index < GAINDB_GAIN_LEN; ++index)
+        sprintf(hex + index * 2, "%02x", (*gain)[index]);
+
+    bfdev_log_info("Gain store: %s\n", key);
+    return -BFDEV_ENOERR;
+}
+
+static void
+profile_session(const struct profile_record *record, unsigned int flags,
+                int status, double rate)
+{
+    struct profile_sample sample;
+    const char *errname;
+    int retval;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.speed = term_getspeed();
+    sample.rate = rate;
+
+    /* The stub erases and programs its own way, only secboot runs count */
+    if (!(flags & FLAG_STUB)) {
+        sample.erased = !timeout_srtt(TIMEOUT_ERASE, &sample.erase);
+        sample.flashed = rate && !status;
+        sample.failed = status && status != -BFDEV_ECANCELED;
+    }
+
+    retval = profile_learn(record, &sample);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_warn("Flash profile unavailable: %s\n", errname);
+    }
+}
+
+static void
+cancel_handler(int signum)
+{
+    term_cancel();
+}
+
+static void
+cancel_setup(void)
+{
+    struct sigaction action;
+
+    /* A second signal is not caught, it kills a stuck cancellation */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = cancel_handler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+}
+
+static void
+plan_sample(struct plan_cal *sample, enum plan_term term, double value)
+{
+    sample->samples[term] = 1;
+    sample->value[term] = value;
+}
+
 int main(int argc, char *const argv[])
 {
-    unsigned int speed, nspeed, flags, eidx, esize;
-    const char *bmac, *wmac, *gain;
-    const char *file, *port, *errname;
-    int optidx, retval;
+    unsigned int rates[PLAN_MAX_RATES], nrates, ahead, slots, cpu, budget;
+    unsigned int nports, index;
+    unsigned int speed, nspeed, flags, eidx, esize, bspeed, btimeout;
+    const char *bmac, *wmac, *gain, *stub, *banner, *crash;
+    const char *port, *errname, *gkey, *lprefix, *gspec;
+    const char *ports[FIXTURE_MAX_PORTS];
+    char fprefix[LOGGER_PREFIX];
+    char gainhex[GAINDB_GAIN_LEN * 2 + 1], mac[ETH_STR_ALEN];
+    const uint8_t *graw;
+    struct profile_record prof;
+    struct flash_list flist;
+    struct gaindb gdb;
+    struct boot_check boot;
+    struct plan_cal sample;
+    struct hub_sched hub;
+    struct session sess;
+    struct batch batch;
+    struct fixture fix;
+    double start, rstart, mark, srtt, rate;
+    size_t capacity;
+    unsigned int fid;
+    bool audit, reattached;
+    int optidx, retval, result;
     char *endp;
     char arg;
 
     port = DEFAULTS_PORT;
-    file = NULL;
+    memset(&flist, 0, sizeof(flist));
+    sess.fd = -1;
+    reattached = false;
 
     bmac = NULL;
     wmac = NULL;
     gain = NULL;
+    stub = NULL;
+    banner = NULL;
+    crash = NULL;
+    gkey = NULL;
+    lprefix = NULL;
+    gspec = NULL;
+    nports = 0;
+    graw = NULL;
+    gdb.head = NULL;
 
     speed = DEFAULTS_SPEED;
     nspeed = 0;
     flags = 0;
 
+    bspeed = 0;
+    btimeout = TIMEOUT_BOOT;
+    budget = BUDGET_DEFAULT;
+    result = BOOT_BOOTED;
+
     eidx = 0;
     esize = 0;
+    ahead = 1;
+    nrates = 0;
+    slots = 0;
+    cpu = 0;
+    memset(&sample, 0, sizeof(sample));
+    rate = 0;
 
     bfdev_log_clr_level(&bfdev_log_default);
+
+    /* Keep the csv on stdout free of the banner */
+    if (argc > 1 && !strcmp(argv[1], "audit"))
+        return audit_main(argc - 1, argv + 1);
+
+    if (argc > 1 && !strcmp(argv[1], "board"))
+        return board_main(argc - 1, argv + 1);
+
+    if (argc > 1 && !strcmp(argv[1], "profile"))
+        return profile_main(argc - 1, argv + 1);
+
     bfdev_log_notice("w80xprog v" __bfdev_stringify(PROJECT_VERSION) "\n");
     bfdev_log_notice("Copyright(c) 2021-2024 John Sanpe <sanpeqf@gmail.com>\n");
     bfdev_log_notice("License GPLv2+: GNU GPL version 2 or later.\n\n");
 
+    if (argc > 1 && !strcmp(argv[1], "build"))
+        return builder_main(argc - 1, argv + 1);
+
+    if (argc > 1 && !strcmp(argv[1], "gain-db"))
+        return gaindb_main(argc - 1, argv + 1);
+
+    if (argc > 1 && !strcmp(argv[1], "stub-emu"))
+        return stubemu_main(argc - 1, argv + 1);
+
+    if (argc > 1 && !strcmp(argv[1], "secboot-emu"))
+        return secbootemu_main(argc - 1, argv + 1);
+
     for (;;) {
-        arg = getopt_long(argc, argv, "p:ois:n:f:e:b:w:g:rh", options, &optidx);
+        arg = getopt_long(argc, argv, "p:ois:n:f:e:b:w:g:G:K:rza:S:B:C:T:U:P:H:R:X:M:L:vh", options, &optidx);
         if (arg == -1)
             break;
 
         switch (arg) {
             case 'p':
-                port = optarg;
+                if (nports == FIXTURE_MAX_PORTS)
+                    usage();
+                port = ports[nports++] = optarg;
                 break;
 
             case 'o':
@@ -125,11 +413,19 @@ int main(int argc, char *const argv[])
                 break;
 
             case 'n':
-                nspeed = strtoul(optarg, NULL, 0);
+                if (!strcmp(optarg, "auto"))
+                    flags |= FLAG_AUTOSPEED;
+                else
+                    nspeed = strtoul(optarg, NULL, 0);
                 break;
 
             case 'f':
-                file = optarg;
+                retval = flashlist_add(&flist, optarg);
+                if (retval) {
+                    bfdev_errname(retval, &errname);
+                    bfdev_log_err("Failed to add %s: %s\n", optarg, errname);
+                    return retval;
+                }
                 break;
 
             case 'e':
@@ -156,17 +452,182 @@ int main(int argc, char *const argv[])
                 gain = optarg;
                 break;
 
+            case 'G':
+                if (flags & FLAG_GAINDB)
+                    usage();
+
+                retval = gaindb_open(&gdb, optarg);
+                if (retval) {
+                    bfdev_errname(retval, &errname);
+                    bfdev_log_err("Failed to open %s: %s\n", optarg, errname);
+                    return retval;
+                }
+                flags |= FLAG_GAINDB;
+                break;
+
+            case 'K':
+                gkey = optarg;
+                break;
+
             case 'r':
                 flags |= FLAG_RESET;
                 break;
 
+            case 'z':
+                flags |= FLAG_COMPRESS;
+                break;
+
+            case 'a':
+                ahead = strtoul(optarg, NULL, 0);
+                if (spinor_window(ahead))
+                    usage();
+                break;
+
+            case 'S':
+                stub = optarg;
+                break;
+
+            case 'B':
+                banner = optarg;
+                break;
+
+            case 'C':
+                crash = optarg;
+                break;
+
+            case 'T':
+                btimeout = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'U':
+                bspeed = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'P':
+                if (plan_rates(optarg, rates, &nrates))
+                    usage();
+                break;
+
+            case 'H':
+                flags |= FLAG_HUB;
+                slots = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'R':
+                flags |= FLAG_REALTIME;
+                cpu = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'X':
+                flags |= FLAG_FIXTURE;
+                gspec = optarg;
+                break;
+
+            case 'M':
+                budget = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'L':
+                lprefix = optarg;
+                break;
+
+            case 'v':
+                bfdev_log_default.record_level = BFDEV_LEVEL_DEBUG;
+                break;
+
             case 'h': default:
                 usage();
         }
     }
 
-    if (argc < 2)
+    if (budget)
+        flags |= FLAG_BUDGET;
+
+    /* A recompressed copy is a second image in memory */
+    if (argc < 2 || (gain && (flags & FLAG_GAINDB)) ||
+        ((flags & FLAG_BUDGET) && (flags & FLAG_COMPRESS)))
+        usage();
+
+    /* Several ports only go together behind a fixture reset */
+    if ((nports > 1 && !(flags & FLAG_FIXTURE)) ||
+        ((flags & FLAG_FIXTURE) && !(flags & FLAG_SECBOOT)))
+        usage();
+
+    /* One child per port, each carries on below as a session of its own */
+    if (flags & FLAG_FIXTURE) {
+        retval = fixture_open(&fix, gspec);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Failed to open fixture: %s\n", errname);
+            return retval;
+        }
+
+        if (!nports)
+            ports[nports++] = port;
+        for (index = 0; index < nports; ++index)
+            fixture_add(&fix, ports[index]);
+
+        retval = fixture_fork(&fix, &port);
+        if (retval < 0) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Failed to start fixture: %s\n", errname);
+            return retval;
+        } else if (retval)
+            return fixture_run(&fix);
+
+        if (!lprefix) {
+            snprintf(fprefix, sizeof(fprefix), "[%s] ", basename(port));
+            lprefix = fprefix;
+        }
+    }
+
+    /* Log output is written out by its own thread while transferring */
+    retval = logger_start();
+    if (!retval)
+        retval = logger_session(lprefix);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_err("Failed to start logging: %s\n", errname);
+        return retval;
+    }
+
+    /* With the key known up front, a missing board fails before the port */
+    if ((flags & FLAG_GAINDB) && (gkey ?: wmac)) {
+        retval = gain_lookup(&gdb, gkey ?: wmac, gainhex, &graw);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("No gain for %s: %s\n", gkey ?: wmac, errname);
+            return retval;
+        }
+        gain = gainhex;
+    }
+
+    if (banner && boot_init(&boot, banner, crash, bspeed ?: speed, btimeout)) {
+        bfdev_log_err("Invalid boot pattern\n");
         usage();
+    }
+
+    if (flags & FLAG_BUDGET) {
+        budget_start((size_t)budget * 1024);
+        flist.bounded = true;
+    }
+
+    if (flist.count) {
+        retval = flashlist_load(&flist);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Invalid image: %s\n", errname);
+            return retval;
+        }
+    }
+
+    if (nrates)
+        plan_session(&flist, speed, flags, ahead, esize, bmac, wmac, gain,
+                     rates, nrates);
+
+    /* Everything a run needs is held by now */
+    if (flags & FLAG_BUDGET)
+        budget_seal();
 
     retval = term_open(port);
     if (retval) {
@@ -182,18 +643,93 @@ int main(int argc, char *const argv[])
         return retval;
     }
 
+    timeout_init();
     term_reset(false);
+    board_open(port);
+    cancel_setup();
+
+    if (flags & FLAG_REALTIME) {
+        retval = rt_enter(cpu);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Failed to enter real-time mode: %s\n", errname);
+            return retval;
+        }
+    }
+
+    if (flags & FLAG_HUB) {
+        bfdev_log_info("Station scheduler:\n");
+        retval = hub_open(&hub, port, slots);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_warn("\tNot on a USB hub, running alone: %s\n", errname);
+            hub_close(&hub);
+            flags &= ~FLAG_HUB;
+        }
+    }
+
+    /* Every session that writes to the board leaves an audit record */
+    audit = flist.count || bmac || wmac || gain || (flags & FLAG_GAINDB);
+    start = timeout_now();
 
     if (flags & FLAG_SECBOOT) {
-        retval = entry_secboot();
+        retval = session_open(&sess, port);
+        if (retval == -BFDEV_EBUSY) {
+            bfdev_log_err("Port is used by another session\n");
+            return retval;
+        } else if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_warn("Session state unavailable: %s\n", errname);
+        } else if (!(flags & FLAG_FIXTURE))
+            reattached = !session_reattach(&sess, speed);
+    }
+
+    if ((flags & FLAG_SECBOOT) && !reattached) {
+        if ((flags & FLAG_HUB) && !(flags & FLAG_FIXTURE))
+            hub_stagger(&hub);
+
+        board_phase(BOARD_ENTRY);
+        retval = -BFDEV_ENOERR;
+        if (flags & FLAG_FIXTURE)
+            retval = fixture_ready(&fix);
+
+        mark = timeout_now();
+        if (!retval)
+            retval = entry_secboot(!(flags & FLAG_FIXTURE));
         if (retval) {
             bfdev_errname(retval, &errname);
             bfdev_log_err("Failed to entry secboot: %s\n", errname);
             return retval;
         }
+        plan_sample(&sample, PLAN_ENTRY, timeout_now() - mark);
+    }
+
+    /*
+     * The flash part picks the erase budget, baudrate and capacity. A
+     * stub reports the part itself, and one already running leaves no
+     * secboot to ask.
+     */
+    if ((flist.count && !stub) || esize || (flags & FLAG_AUTOSPEED)) {
+        retval = chip_spinor(&fid, &capacity);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Failed to read flash id: %s\n", errname);
+            return retval;
+        }
+
+        profile_load(&prof, fid, capacity);
+        if (prof.erases)
+            timeout_seed(TIMEOUT_ERASE, prof.erase);
+        if (flags & FLAG_AUTOSPEED) {
+            nspeed = profile_speed(&prof);
+            bfdev_log_info("\tBaudrate %u\n", nspeed);
+        }
+        flags |= FLAG_PROFILE;
     }
 
-    if (nspeed) {
+    if (nspeed && nspeed != term_getspeed()) {
+        board_phase(BOARD_SPEED);
+        mark = timeout_now();
         retval = serial_speed(nspeed);
         if (retval) {
             bfdev_errname(retval, &errname);
@@ -207,6 +743,7 @@ int main(int argc, char *const argv[])
             bfdev_log_err("Failed to set host speed: %s\n", errname);
             return retval;
         }
+        plan_sample(&sample, PLAN_SPEED, timeout_now() - mark);
     }
 
     if (flags & FLAG_INFO) {
@@ -218,78 +755,125 @@ int main(int argc, char *const argv[])
         }
     }
 
-    if (esize) {
-        retval = spinor_erase(eidx, esize);
+    if ((flags & FLAG_GAINDB) && !graw) {
+        retval = chip_wmac(mac);
         if (retval) {
             bfdev_errname(retval, &errname);
-            bfdev_log_err("Failed to erase chip: %s\n", errname);
+            bfdev_log_err("Failed to read mac: %s\n", errname);
             return retval;
         }
-    }
 
-    if (bmac) {
-        retval = flash_bmac(bmac);
+        retval = gain_lookup(&gdb, mac, gainhex, &graw);
         if (retval) {
             bfdev_errname(retval, &errname);
-            bfdev_log_err("Failed to flash bt mac: %s\n", errname);
+            bfdev_log_err("No gain for %s: %s\n", mac, errname);
             return retval;
         }
+        gain = gainhex;
     }
 
-    if (wmac) {
-        retval = flash_wmac(wmac);
+    /* Erase and identity go out back to back as one batch */
+    board_phase(BOARD_COMMAND);
+    batch_init(&batch);
+    retval = -BFDEV_ENOERR;
+    if (esize)
+        retval = batch_erase(&batch, eidx, esize);
+    if (!retval && bmac)
+        retval = batch_bmac(&batch, bmac);
+    if (!retval && wmac)
+        retval = batch_wmac(&batch, wmac);
+    if (!retval && graw)
+        retval = batch_gain_raw(&batch, graw);
+    else if (!retval && gain)
+        retval = batch_gain(&batch, gain);
+    if (!retval)
+        retval = batch_run(&batch);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_err("Failed to run commands: %s\n", errname);
+        return retval;
+    }
+
+    if (flist.count && stub) {
+        retval = stub_attach(stub, &fid, &capacity, flist.mac);
         if (retval) {
             bfdev_errname(retval, &errname);
-            bfdev_log_err("Failed to flash wifi mac: %s\n", errname);
+            bfdev_log_err("Failed to attach stub: %s\n", errname);
             return retval;
         }
-    }
 
-    if (gain) {
-        retval = flash_gain(gain);
+        profile_load(&prof, fid, capacity);
+        flags |= FLAG_STUB | FLAG_PROFILE;
+        retval = flashlist_fits(&flist, capacity);
         if (retval) {
             bfdev_errname(retval, &errname);
-            bfdev_log_err("Failed to flash rf gain: %s\n", errname);
+            bfdev_log_err("Image does not fit flash: %s\n", errname);
             return retval;
         }
-    }
 
-    if (file) {
-        struct stat stat;
-        void *map;
-        int fd;
+        board_phase(BOARD_FLASH);
+        if (flags & FLAG_HUB)
+            hub_acquire(&hub);
 
-        fd = open(file, O_RDONLY);
-        if (fd < 0) {
-            bfdev_log_err("Failed to open file\n");
-            return fd;
+        retval = flashlist_stub(&flist);
+        if (flags & FLAG_HUB)
+            hub_release(&hub, retval ? 0 : flist.hashed);
+        if (retval) {
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Failed to flash chip: %s\n", errname);
+            audit_session(port, &flist, wmac, bmac, gain, start, retval);
+            return retval;
         }
 
-        retval = fstat(fd, &stat);
+        flashlist_release(&flist);
+    } else if (flist.count) {
+        retval = flashlist_fits(&flist, prof.capacity);
         if (retval) {
-            bfdev_log_err("Failed to fstat file\n");
+            bfdev_errname(retval, &errname);
+            bfdev_log_err("Image does not fit flash: %s\n", errname);
             return retval;
         }
 
-        map = mmap(NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
-        if (map == MAP_FAILED) {
-            bfdev_log_err("Failed to mmap file\n");
-            return -BFDEV_ENOMEM;
+        if (flags & FLAG_COMPRESS) {
+            retval = flashlist_compress(&flist, sysconf(_SC_NPROCESSORS_ONLN));
+            if (retval) {
+                bfdev_errname(retval, &errname);
+                bfdev_log_err("Failed to compress image: %s\n", errname);
+                return retval;
+            }
         }
 
-        retval = spinor_flash(map, stat.st_size);
+        board_phase(BOARD_FLASH);
+        if (flags & FLAG_HUB)
+            hub_acquire(&hub);
+
+        mark = timeout_now();
+        retval = flashlist_flash(&flist);
+        if (flags & FLAG_HUB)
+            hub_release(&hub, retval ? 0 : flist.hashed);
         if (retval) {
             bfdev_errname(retval, &errname);
             bfdev_log_err("Failed to flash chip: %s\n", errname);
+            audit_session(port, &flist, wmac, bmac, gain, start, retval);
+            profile_session(&prof, flags, retval, 0);
+
+            /* A cancelled transfer leaves the chip at the prompt */
+            if (retval == -BFDEV_ECANCELED && sess.fd >= 0)
+                session_save(&sess, true);
             return retval;
         }
 
-        munmap(map, stat.st_size);
-        close(fd);
+        rate = flist.hashed / bfdev_max(timeout_now() - mark, 1e-6);
+        flashlist_release(&flist);
     }
 
+    rstart = timeout_now();
     if (flags & FLAG_RESET) {
-        retval = chip_reset();
+        board_phase(BOARD_RESET);
+        if (flags & FLAG_STUB)
+            retval = stub_reset();
+        else
+            retval = chip_reset();
         if (retval) {
             bfdev_errname(retval, &errname);
             bfdev_log_err("Failed to reset chip: %s\n", errname);
@@ -297,7 +881,55 @@ int main(int argc, char *const argv[])
         }
     }
 
+    if (banner) {
+        board_phase(BOARD_BOOT);
+        result = boot_confirm(&boot, rstart);
+        boot_release(&boot);
+        if (result < 0) {
+            bfdev_errname(result, &errname);
+            bfdev_log_err("Failed to confirm boot: %s\n", errname);
+            return result;
+        }
+    }
+
+    if (audit)
+        audit_session(port, &flist, wmac, bmac, gain, start, result);
+
+    /* The stub speaks its own protocol, only secboot timings calibrate */
+    if (!(flags & FLAG_STUB)) {
+        if (!timeout_srtt(TIMEOUT_LINK, &srtt))
+            plan_sample(&sample, PLAN_LINK, srtt);
+        if (!timeout_srtt(TIMEOUT_ERASE, &srtt))
+            plan_sample(&sample, PLAN_ERASE, srtt);
+    }
+
+    if (flags & FLAG_PROFILE)
+        profile_session(&prof, flags, 0, rate);
+
+    retval = plan_learn(&sample);
+    if (retval) {
+        bfdev_errname(retval, &errname);
+        bfdev_log_warn("Flash plan calibration unavailable: %s\n", errname);
+    }
+
+    /* Leave a record for the next run, a rebooted chip can not be reused */
+    if (sess.fd >= 0) {
+        session_save(&sess, !(flags & (FLAG_RESET | FLAG_STUB)));
+        session_close(&sess);
+    }
+
+    if (flags & FLAG_HUB)
+        hub_close(&hub);
+    gaindb_close(&gdb);
     term_close();
+    board_phase(BOARD_DONE);
+
+    if (flags & FLAG_BUDGET) {
+        budget_report();
+        retval = budget_check("by the run");
+        if (retval)
+            return retval;
+    }
 
-    return 0;
+    return result;
 }
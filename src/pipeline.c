@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <string.h>
+#include <signal.h>
+#include <pipeline.h>
+#include <realtime.h>
+#include <logger.h>
+
+static struct xmodem_packet pipeline_slots[PIPELINE_DEPTH];
+static unsigned int pipeline_lens[PIPELINE_DEPTH];
+
+static int
+pipeline_fill(struct spinor_source *source, uint8_t *buff, unsigned int len)
+{
+    unsigned int done;
+    int retval;
+
+    /* Packets may straddle the boundary between two images */
+    for (done = 0; done < len; done += retval) {
+        retval = source->read(source, buff + done, len - done);
+        if (retval < 0)
+            return retval;
+
+        if (!retval)
+            break;
+    }
+
+    return done;
+}
+
+static void *
+pipeline_worker(void *pdata)
+{
+    struct pipeline *pipe = pdata;
+    struct xmodem_packet *packet;
+    uint16_t cksum;
+    uint8_t count;
+    int xfer;
+
+    rt_worker();
+    for (count = 1;; count++) {
+        /* A full ring means the link, not the host, is the bottleneck */
+        if (ring_depth(&pipe->ring) == pipe->ring.count)
+            pipe->stalled++;
+
+        packet = ring_produce_begin(&pipe->ring);
+        if (!packet || atomic_load(&pipe->ring.closed)) {
+            xfer = -BFDEV_ECANCELED;
+            break;
+        }
+
+        xfer = pipeline_fill(pipe->source, packet->payload, PAYLOAD_SIZE);
+        if (xfer <= 0)
+            break;
+
+        if (xfer < PAYLOAD_SIZE)
+            memset(packet->payload + xfer, 0x1a, PAYLOAD_SIZE - xfer);
+
+        cksum = bfdev_crc_itut(packet->payload, PAYLOAD_SIZE, 0);
+        packet->types = XMODEM_SOH;
+        packet->count = count;
+        packet->verify = ~count;
+        packet->checksum = bfdev_cpu_to_be16(cksum);
+
+        ring_produce_end(&pipe->ring, xfer);
+    }
+
+    ring_close(&pipe->ring, xfer);
+    return NULL;
+}
+
+int
+pipeline_start(struct pipeline *pipe, struct spinor_source *source)
+{
+    sigset_t mask, saved;
+    int retval;
+
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->source = source;
+    pipe->depth_min = PIPELINE_DEPTH;
+
+    /* One transfer at a time, the slots are never taken from the heap */
+    retval = ring_setup(&pipe->ring, pipeline_slots, pipeline_lens,
+                        PIPELINE_DEPTH, sizeof(*pipeline_slots));
+    if (retval)
+        return retval;
+
+    /* Touched on every packet, keep them resident in real-time mode */
+    rt_lock(pipe->ring.slots, pipe->ring.count * pipe->ring.size);
+    rt_lock(pipe->ring.lens, pipe->ring.count * sizeof(*pipe->ring.lens));
+
+    /* Cancel signals must reach the link thread, it is the one in poll */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, &saved);
+    retval = pthread_create(&pipe->thread, NULL, pipeline_worker, pipe);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (retval)
+        return -BFDEV_ENOMEM;
+
+    return -BFDEV_ENOERR;
+}
+
+struct xmodem_packet *
+pipeline_next(struct pipeline *pipe, unsigned int *len)
+{
+    struct xmodem_packet *packet;
+    unsigned int depth;
+
+    /* Packets already on the wire stay in the ring until acked */
+    depth = ring_depth(&pipe->ring) - pipe->sent;
+    packet = ring_peek(&pipe->ring, pipe->sent, len);
+    if (!packet)
+        return NULL;
+
+    pipe->sent++;
+
+    /* Depth seen by the link each time it wants the next packet */
+    pipe->packets++;
+    pipe->depth_sum += depth;
+    pipe->depth_min = bfdev_min(pipe->depth_min, depth);
+    if (!depth)
+        pipe->starved++;
+
+    return packet;
+}
+
+void
+pipeline_done(struct pipeline *pipe)
+{
+    ring_consume_end(&pipe->ring);
+    pipe->sent--;
+}
+
+void
+pipeline_rewind(struct pipeline *pipe)
+{
+    /* Go back to the oldest unacknowledged packet */
+    pipe->sent = 0;
+}
+
+int
+pipeline_stop(struct pipeline *pipe)
+{
+    /* Wakes a producer blocked on a full ring */
+    ring_close(&pipe->ring, 0);
+    pthread_join(pipe->thread, NULL);
+
+    return atomic_load(&pipe->ring.error);
+}
+
+void
+pipeline_report(struct pipeline *pipe)
+{
+    if (!pipe->packets)
+        return;
+
+    logger_printf(LOGGER_INFO, "\tPipeline: depth avg %.1f min %u of %u, "
+                  "link starved %lu, producer stalled %lu\n",
+                  (double)pipe->depth_sum / pipe->packets,
+                  pipe->depth_min, PIPELINE_DEPTH,
+                  pipe->starved, pipe->stalled);
+}
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <bfdev.h>
+#include <ring.h>
+#include <w80xhw.h>
+#include <w80xprog.h>
+
+#define PIPELINE_DEPTH 32
+
+/*
+ * Ready-to-send XMODEM packets, built ahead of the link by a producer
+ * thread, so the link side only writes them and waits for the ACK.
+ */
+struct pipeline {
+    struct ring ring;
+    struct spinor_source *source;
+    pthread_t thread;
+
+    /* Producer side */
+    unsigned long stalled;
+
+    /* Consumer side */
+    unsigned int sent;
+    unsigned long packets;
+    unsigned long starved;
+    unsigned long depth_sum;
+    unsigned int depth_min;
+};
+
+extern int
+pipeline_start(struct pipeline *pipe, struct spinor_source *source);
+
+extern struct xmodem_packet *
+pipeline_next(struct pipeline *pipe, unsigned int *len);
+
+extern void
+pipeline_done(struct pipeline *pipe);
+
+extern void
+pipeline_rewind(struct pipeline *pipe);
+
+extern int
+pipeline_stop(struct pipeline *pipe);
+
+extern void
+pipeline_report(struct pipeline *pipe);
+
+#endif /* _PIPELINE_H_ */
@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <plan.h>
+#include <state.h>
+#include <image.h>
+#include <stream.h>
+#include <flashlist.h>
+#include <w80xhw.h>
+
+static const char *
+term_name[PLAN_NR_TERM] = {
+    [PLAN_ENTRY] = "entry",
+    [PLAN_SPEED] = "switch",
+    [PLAN_LINK] = "link",
+    [PLAN_ERASE] = "erase",
+};
+
+static const unsigned int
+term_initial[PLAN_NR_TERM] = {
+    [PLAN_ENTRY] = PLAN_DEFAULT_ENTRY,
+    [PLAN_SPEED] = PLAN_DEFAULT_SPEED,
+    [PLAN_LINK] = PLAN_DEFAULT_LINK,
+    [PLAN_ERASE] = PLAN_DEFAULT_ERASE,
+};
+
+int
+plan_rates(const char *str, unsigned int *rates, unsigned int *count)
+{
+    unsigned long rate;
+    char *endp;
+
+    for (*count = 0; *count < PLAN_MAX_RATES;) {
+        rate = strtoul(str, &endp, 0);
+        if (endp == str || !rate || rate > UINT_MAX)
+            return -BFDEV_EINVAL;
+
+        rates[(*count)++] = rate;
+        if (!*endp)
+            return -BFDEV_ENOERR;
+
+        if (*endp != ',')
+            return -BFDEV_EINVAL;
+        str = endp + 1;
+    }
+
+    return -BFDEV_EINVAL;
+}
+
+void
+plan_load(struct plan_cal *cal)
+{
+    char path[PATH_MAX];
+    unsigned int term;
+    ssize_t len;
+    int fd;
+
+    if (!state_path(path, sizeof(path), "plan.cal")) {
+        fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            len = read(fd, cal, sizeof(*cal));
+            close(fd);
+            if (len == sizeof(*cal) && cal->magic == PLAN_MAGIC)
+                return;
+        }
+    }
+
+    /* Nothing measured yet, start from typical figures */
+    memset(cal, 0, sizeof(*cal));
+    cal->magic = PLAN_MAGIC;
+    for (term = 0; term < PLAN_NR_TERM; ++term)
+        cal->value[term] = term_initial[term] / 1000.0;
+}
+
+int
+plan_learn(const struct plan_cal *sample)
+{
+    char path[PATH_MAX], temp[PATH_MAX];
+    struct plan_cal cal;
+    unsigned int term;
+    int fd, retval;
+
+    for (term = 0; term < PLAN_NR_TERM; ++term) {
+        if (sample->samples[term])
+            break;
+    }
+
+    if (term == PLAN_NR_TERM)
+        return -BFDEV_ENOERR;
+
+    plan_load(&cal);
+
+    /* Smoothed like the timeout engine, the first sample replaces the default */
+    for (term = 0; term < PLAN_NR_TERM; ++term) {
+        if (!sample->samples[term])
+            continue;
+
+        if (!cal.samples[term]++)
+            cal.value[term] = sample->value[term];
+        else
+            cal.value[term] = 0.75 * cal.value[term] + 0.25 * sample->value[term];
+    }
+
+    retval = state_path(path, sizeof(path), "plan.cal");
+    if (retval)
+        return retval;
+
+    /* Concurrent sessions race on rename, the last one wins */
+    if (snprintf(temp, sizeof(temp), "%s.%d", path, getpid()) >= sizeof(temp))
+        return -BFDEV_ENAMETOOLONG;
+
+    fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -BFDEV_EPERM;
+
+    if (write(fd, &cal, sizeof(cal)) != sizeof(cal)) {
+        close(fd);
+        unlink(temp);
+        return -BFDEV_EIO;
+    }
+
+    close(fd);
+    if (rename(temp, path)) {
+        unlink(temp);
+        return -BFDEV_EPERM;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static double
+plan_wire(size_t bytes, unsigned int speed)
+{
+    /* One start bit, eight data bits and one stop bit */
+    return (double)bytes * 10 / speed;
+}
+
+static double
+plan_opcode(const struct plan_cal *cal, unsigned int opcode,
+            size_t reply, unsigned int speed)
+{
+    size_t bytes;
+
+    bytes = sizeof(struct opcode_head) + OPCODE_LEN(opcode) + reply;
+    return plan_wire(bytes, speed) + cal->value[PLAN_LINK];
+}
+
+static int
+plan_stream(struct stream *stream)
+{
+    uint8_t buff[PAYLOAD_SIZE * 16];
+    int retval;
+
+    /* Decoded only to learn its length, a dry run never sends it */
+    do
+        retval = stream_read(stream, buff, sizeof(buff));
+    while (retval > 0);
+
+    return retval;
+}
+
+static size_t
+plan_erase(uint32_t header, uint32_t addr, size_t size)
+{
+    uint32_t first, last;
+    size_t sectors;
+
+    /* Secboot erases the sectors under the header and the payload */
+    first = BFDEV_ALIGN_LOW(addr, SPINOR_SECTOR_SIZE);
+    last = BFDEV_ALIGN(addr + size, SPINOR_SECTOR_SIZE);
+    sectors = (last - first) / SPINOR_SECTOR_SIZE +
+              (header < first || header >= last);
+
+    bfdev_log_info("\t    header %#010x, erase %#010x-%#010x "
+                   "(%zu sectors)\n", header, first, last, sectors);
+    return sectors;
+}
+
+static int
+plan_images(struct flash_list *list, size_t *total, size_t *sectors)
+{
+    struct flash_item *item;
+    struct image_info info;
+    struct image_range *ranges;
+    unsigned int index, count;
+    size_t offset;
+    int retval;
+
+    *total = *sectors = 0;
+    for (index = 0; index < list->count; ++index) {
+        item = &list->items[index];
+        if (item->stream) {
+            retval = plan_stream(item->stream);
+            if (retval)
+                return retval;
+
+            item->size = item->stream->total;
+            bfdev_log_info("\t[%u] %s: %zu bytes (streamed)\n",
+                           index, item->path, item->size);
+            *total += item->size;
+
+            /* The header checks kept where each decoded image goes */
+            ranges = item->stream->check.ranges;
+            for (count = 0; count < item->stream->check.index; ++count)
+                *sectors += plan_erase(ranges[count * 2].start,
+                                       ranges[count * 2 + 1].start,
+                                       ranges[count * 2 + 1].end -
+                                       ranges[count * 2 + 1].start);
+            continue;
+        }
+
+        bfdev_log_info("\t[%u] %s: %zu bytes%s\n", index, item->path,
+                       item->size, item->zipped ? " (compressed)" : "");
+        *total += item->size;
+
+        for (offset = 0; !image_parse(item->data, item->size, offset, &info);
+             offset += info.size)
+            *sectors += plan_erase(bfdev_le32_to_cpu(info.head->header),
+                                   info.addr, info.size - sizeof(*info.head));
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+int
+plan_predict(struct flash_list *list, const struct plan_session *session,
+             const unsigned int *rates, unsigned int count)
+{
+    struct plan_cal cal;
+    double entry, change, erase, xfer, other, packet;
+    unsigned int index, term, speed;
+    size_t total, packets, sectors;
+    int retval;
+
+    bfdev_log_info("Flash plan:\n");
+    retval = plan_images(list, &total, &sectors);
+    if (retval)
+        return retval;
+
+    /* Same framing as xmodem_transfer(), padding included */
+    packets = BFDEV_DIV_ROUND_UP(total, PAYLOAD_SIZE);
+    bfdev_log_info("\tWire: %zu packets, %zu bytes, %zu erase waits\n",
+                   packets, packets * sizeof(struct xmodem_packet) + 1, sectors);
+
+    plan_load(&cal);
+    for (term = 0; term < PLAN_NR_TERM; ++term)
+        bfdev_log_info("\tCalibration: %s %.2fms, %u samples\n",
+                       term_name[term], cal.value[term] * 1000,
+                       cal.samples[term]);
+
+    bfdev_log_info("\t%10s %9s %9s %9s %9s %9s\n", "baud", "entry",
+                   "switch", "erase", "transfer", "total");
+
+    for (index = 0; index < count; ++index) {
+        speed = rates[index];
+        entry = session->secboot ? cal.value[PLAN_ENTRY] : 0;
+        change = speed != session->speed ? cal.value[PLAN_SPEED] : 0;
+
+        /* Commands that go out at the new speed around the transfer */
+        other = 0;
+        if (list->count) {
+            other += plan_opcode(&cal, OPCODE_GET_SPINOR, REPLY_FLASH_LEN, speed);
+            other += plan_opcode(&cal, OPCODE_GET_NET_MAC, REPLY_MAC_LEN, speed);
+        }
+        if (session->bmac)
+            other += plan_opcode(&cal, OPCODE_SET_BT_MAC, 1, speed);
+        if (session->wmac)
+            other += plan_opcode(&cal, OPCODE_SET_NET_MAC, 1, speed);
+        if (session->gain)
+            other += plan_opcode(&cal, OPCODE_SET_GAIN, 1, speed);
+        if (session->reset)
+            other += plan_opcode(&cal, OPCODE_REBOOT, 0, speed);
+
+        erase = sectors * cal.value[PLAN_ERASE];
+        if (session->erase) {
+            erase += plan_opcode(&cal, OPCODE_ERASE_SPINOR, 1, speed);
+            erase += BFDEV_DIV_ROUND_UP(session->erase, SPINOR_SECTOR_SIZE) *
+                     cal.value[PLAN_ERASE];
+        }
+
+        /* A send-ahead window hides the turnaround behind the wire */
+        packet = plan_wire(sizeof(struct xmodem_packet), speed);
+        packet = bfdev_max(packet, (packet + cal.value[PLAN_LINK]) /
+                           session->window);
+        xfer = packets * packet;
+        if (packets)
+            xfer += plan_wire(2, speed) + cal.value[PLAN_LINK];
+
+        bfdev_log_info("\t%10u %8.3fs %8.3fs %8.3fs %8.3fs %8.3fs\n",
+                       speed, entry, change, erase, xfer,
+                       entry + change + erase + xfer + other);
+    }
+
+    return -BFDEV_ENOERR;
+}
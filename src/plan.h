@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _PLAN_H_
+#define _PLAN_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define PLAN_MAGIC 0x43503857 /* "W8PC" */
+#define PLAN_MAX_RATES 16
+
+enum plan_term {
+    PLAN_ENTRY = 0,     /* Secboot entry, settle delay included */
+    PLAN_SPEED,         /* Baudrate switch handshake */
+    PLAN_LINK,          /* Turnaround of one reply */
+    PLAN_ERASE,         /* Erase of one flash sector */
+    PLAN_NR_TERM,
+};
+
+/* Calibration constants, in seconds, learned from real sessions */
+struct plan_cal {
+    uint32_t magic;
+    uint32_t samples[PLAN_NR_TERM];
+    double value[PLAN_NR_TERM];
+};
+
+struct plan_session {
+    unsigned int speed;
+    unsigned int window;
+    size_t erase;
+    bool secboot;
+    bool bmac;
+    bool wmac;
+    bool gain;
+    bool reset;
+};
+
+struct flash_list;
+
+extern int
+plan_rates(const char *str, unsigned int *rates, unsigned int *count);
+
+extern void
+plan_load(struct plan_cal *cal);
+
+extern int
+plan_learn(const struct plan_cal *sample);
+
+extern int
+plan_predict(struct flash_list *list, const struct plan_session *session,
+             const unsigned int *rates, unsigned int count);
+
+#endif /* _PLAN_H_ */
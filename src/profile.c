@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/file.h>
+#include <profile.h>
+#include <state.h>
+
+static const unsigned int
+profile_speeds[PROFILE_NR_SPEED] = {
+    115200, 230400, 460800, 921600, 1000000, 2000000,
+};
+
+static const struct option
+options[] = {
+    {"help",    no_argument,        0,  'h'},
+    { }, /* NULL */
+};
+
+static __bfdev_noreturn void
+usage(void)
+{
+    bfdev_log_err("Usage: w80xprog profile [options]\n");
+    bfdev_log_err("\t-h, --help                display this message\n");
+    exit(1);
+}
+
+static int
+profile_open(int flags)
+{
+    char path[PATH_MAX];
+
+    if (state_path(path, sizeof(path), "profile.db"))
+        return -1;
+
+    return open(path, flags, 0644);
+}
+
+static void
+profile_read(int fd, struct profile_db *db)
+{
+    if (pread(fd, db, sizeof(*db), 0) != sizeof(*db) ||
+        db->magic != PROFILE_MAGIC || db->count > PROFILE_MAX) {
+        memset(db, 0, sizeof(*db));
+        db->magic = PROFILE_MAGIC;
+    }
+}
+
+static struct profile_record *
+profile_find(struct profile_db *db, unsigned int fid)
+{
+    unsigned int index;
+
+    for (index = 0; index < db->count; ++index) {
+        if (db->records[index].fid == fid)
+            return &db->records[index];
+    }
+
+    return NULL;
+}
+
+void
+profile_load(struct profile_record *record, unsigned int fid, size_t capacity)
+{
+    struct profile_record *found;
+    struct profile_db db;
+    char erase[32];
+    int fd;
+
+    memset(record, 0, sizeof(*record));
+    record->fid = fid;
+    record->capacity = capacity;
+
+    fd = profile_open(O_RDONLY);
+    if (fd >= 0) {
+        flock(fd, LOCK_SH);
+        profile_read(fd, &db);
+        flock(fd, LOCK_UN);
+        close(fd);
+
+        found = profile_find(&db, fid);
+        if (found)
+            *record = *found;
+    }
+
+    erase[0] = '\0';
+    if (record->erases)
+        snprintf(erase, sizeof(erase), ", erase %.1fms/sector",
+                 record->erase * 1000);
+
+    bfdev_log_info("Flash profile:\n");
+    bfdev_log_info("\tFID %02x,%02x, %llu bytes, %u runs%s\n", fid >> 8,
+                   fid & 0xff, (unsigned long long)record->capacity,
+                   record->runs, erase);
+}
+
+unsigned int
+profile_speed(const struct profile_record *record)
+{
+    unsigned int index, best;
+    double most;
+
+    for (best = most = index = 0; index < PROFILE_NR_SPEED; ++index) {
+        if (record->samples[index] && record->rate[index] > most) {
+            most = record->rate[index];
+            best = index + 1;
+        }
+    }
+
+    if (!best)
+        return PROFILE_DEFAULT_SPEED;
+
+    /* Keep probing one speed up until it has enough samples or fails */
+    if (best < PROFILE_NR_SPEED && record->samples[best] < PROFILE_EXPLORE &&
+        (!record->samples[best] || record->rate[best]))
+        best++;
+
+    return profile_speeds[best - 1];
+}
+
+int
+profile_learn(const struct profile_record *record,
+              const struct profile_sample *sample)
+{
+    struct profile_record *update;
+    struct profile_db db;
+    unsigned int index, victim;
+    int fd;
+
+    fd = profile_open(O_RDWR | O_CREAT);
+    if (fd < 0)
+        return -BFDEV_EPERM;
+
+    /* Read-modify-write under the lock, stations share the file */
+    flock(fd, LOCK_EX);
+    profile_read(fd, &db);
+
+    update = profile_find(&db, record->fid);
+    if (!update) {
+        if (db.count < PROFILE_MAX)
+            victim = db.count++;
+        else {
+            /* Full, drop the part seen least */
+            for (victim = index = 0; index < PROFILE_MAX; ++index) {
+                if (db.records[index].runs < db.records[victim].runs)
+                    victim = index;
+            }
+        }
+
+        update = &db.records[victim];
+        memset(update, 0, sizeof(*update));
+        update->fid = record->fid;
+    }
+
+    update->runs++;
+    update->capacity = record->capacity;
+
+    if (sample->erased) {
+        if (!update->erases++)
+            update->erase = sample->erase;
+        else
+            update->erase = 0.75 * update->erase + 0.25 * sample->erase;
+    }
+
+    for (index = 0; index < PROFILE_NR_SPEED; ++index) {
+        if (profile_speeds[index] == sample->speed)
+            break;
+    }
+
+    if (index < PROFILE_NR_SPEED && (sample->flashed || sample->failed)) {
+        update->samples[index]++;
+        if (sample->failed)
+            update->rate[index] = 0;
+        else if (!update->rate[index])
+            update->rate[index] = sample->rate;
+        else
+            update->rate[index] = 0.75 * update->rate[index] + 0.25 * sample->rate;
+    }
+
+    if (pwrite(fd, &db, sizeof(db), 0) != sizeof(db)) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return -BFDEV_EIO;
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+    return -BFDEV_ENOERR;
+}
+
+int
+profile_main(int argc, char *const argv[])
+{
+    struct profile_record *record;
+    struct profile_db db;
+    unsigned int index, speed;
+    int optidx, fd;
+    char arg;
+
+    for (;;) {
+        arg = getopt_long(argc, argv, "h", options, &optidx);
+        if (arg == -1)
+            break;
+
+        switch (arg) {
+            case 'h': default:
+                usage();
+        }
+    }
+
+    fd = profile_open(O_RDONLY);
+    if (fd < 0) {
+        bfdev_log_err("No flash profiles yet\n");
+        return -BFDEV_ENOENT;
+    }
+
+    flock(fd, LOCK_SH);
+    profile_read(fd, &db);
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    printf("fid,runs,capacity,erase_ms");
+    for (speed = 0; speed < PROFILE_NR_SPEED; ++speed)
+        printf(",kbs_%u", profile_speeds[speed]);
+    printf("\n");
+
+    for (index = 0; index < db.count; ++index) {
+        record = &db.records[index];
+        printf("%02x:%02x,%u,%llu,%.2f", record->fid >> 8, record->fid & 0xff,
+               record->runs, (unsigned long long)record->capacity,
+               record->erase * 1000);
+
+        /* Untried speeds are empty, failed ones read zero */
+        for (speed = 0; speed < PROFILE_NR_SPEED; ++speed) {
+            if (record->samples[speed])
+                printf(",%.1f", record->rate[speed] / 1024);
+            else
+                printf(",");
+        }
+        printf("\n");
+    }
+
+    return -BFDEV_ENOERR;
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define PROFILE_MAGIC 0x50463857 /* "W8FP" */
+#define PROFILE_NR_SPEED 6
+
+/*
+ * What is known about one flash part, keyed by the "FID:vv,dd" reply.
+ * A rate of zero with samples means the last transfer at that speed
+ * failed, the speed is not picked again until it succeeds.
+ */
+struct profile_record {
+    uint32_t fid;
+    uint32_t runs;
+    uint64_t capacity;
+    uint32_t erases;
+    uint32_t reserved;
+    double erase;
+    uint32_t samples[PROFILE_NR_SPEED];
+    double rate[PROFILE_NR_SPEED];
+};
+
+struct profile_db {
+    uint32_t magic;
+    uint32_t count;
+    struct profile_record records[PROFILE_MAX];
+};
+
+/* What one session measured */
+struct profile_sample {
+    unsigned int speed;
+    double erase;
+    double rate;
+    bool erased;
+    bool flashed;
+    bool failed;
+};
+
+extern void
+profile_load(struct profile_record *record, unsigned int fid, size_t capacity);
+
+extern unsigned int
+profile_speed(const struct profile_record *record);
+
+extern int
+profile_learn(const struct profile_record *record,
+              const struct profile_sample *sample);
+
+extern int
+profile_main(int argc, char *const argv[]);
+
+#endif /* _PROFILE_H_ */
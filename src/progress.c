@@ -4,8 +4,11 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
 #include <progress.h>
+#include <logger.h>
+#include <board.h>
 
 static double
 gettime(void)
@@ -51,35 +54,39 @@ size_unit(char *buff, double size)
 void
 progress_update(struct progress *prog, size_t bytes)
 {
-    char buff1[32], buff2[32];
+    char buff1[32], buff2[32], bar[49];
     double ratio, speed, eta;
-    int index, pos;
+    int pos;
 
     prog->done += bytes;
-    ratio = (double)prog->done / prog->total;
     speed = (double)prog->done / (gettime() - prog->start);
+    board_progress(prog->done, prog->total, speed);
+
+    /* Streamed input has no known total */
+    if (!prog->total) {
+        logger_status("%s, %s/s", size_unit(buff1, prog->done),
+                      size_unit(buff2, speed));
+        return;
+    }
+
+    ratio = (double)prog->done / prog->total;
     pos = 48 * ratio;
 
     eta = 0;
     if (speed)
         eta = (prog->total - prog->done) / speed;
 
-    printf("\r%3.0f%% [", ratio * 100);
-    for (index = 0; index < pos; index++)
-        putchar('=');
-
-    for (index = pos; index < 48; index++)
-        putchar(' ');
+    memset(bar, '=', pos);
+    memset(bar + pos, ' ', 48 - pos);
+    bar[48] = '\0';
 
     if (prog->done < prog->total) {
-        printf("] %s/s, ETA %s\r",
-               size_unit(buff1, speed), format_eta(buff2, eta));
+        logger_status("%3.0f%% [%s] %s/s, ETA %s", ratio * 100, bar,
+                      size_unit(buff1, speed), format_eta(buff2, eta));
     } else {
-        printf("] %s, %s/s\r",
-               size_unit(buff1, prog->done), size_unit(buff2, speed));
+        logger_status("%3.0f%% [%s] %s, %s/s", ratio * 100, bar,
+                      size_unit(buff1, prog->done), size_unit(buff2, speed));
     }
-
-    fflush(stdout);
 }
 
 void
@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <realtime.h>
+#include <logger.h>
+
+static bool rt_active;
+static size_t rt_locked;
+static size_t rt_faulted;
+
+bool
+rt_enabled(void)
+{
+    return rt_active;
+}
+
+#ifdef __linux__
+
+static cpu_set_t rt_others;
+
+static void
+rt_prefault_stack(void)
+{
+    volatile uint8_t stack[RT_STACK_PREFAULT];
+
+    /* Fault in the stack the link loop will run on */
+    memset((void *)stack, 0, sizeof(stack));
+}
+
+int
+rt_enter(unsigned int cpu)
+{
+    struct sched_param param;
+    cpu_set_t mask;
+    int retval;
+
+    bfdev_log_info("Real-time mode:\n");
+    if (cpu >= CPU_SETSIZE)
+        return -BFDEV_EINVAL;
+
+    retval = pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask);
+    if (retval || !CPU_ISSET(cpu, &mask)) {
+        bfdev_log_err("\tCPU %u is not available\n", cpu);
+        return -BFDEV_EINVAL;
+    }
+
+    /* Helper threads keep the other cpus, when there are any */
+    rt_others = mask;
+    if (CPU_COUNT(&mask) > 1)
+        CPU_CLR(cpu, &rt_others);
+
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    retval = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    if (retval)
+        return -BFDEV_EPERM;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = RT_PRIORITY;
+    retval = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (retval)
+        bfdev_log_warn("\tSCHED_FIFO not permitted, normal priority\n");
+
+    rt_prefault_stack();
+    rt_active = true;
+
+    bfdev_log_info("\tLink thread on cpu %u, %s\n", cpu,
+                   retval ? "SCHED_OTHER" : "SCHED_FIFO");
+    return -BFDEV_ENOERR;
+}
+
+void
+rt_worker(void)
+{
+    struct sched_param param;
+
+    if (!rt_active)
+        return;
+
+    /* Threads inherit the link's pinning and policy, hand them back */
+    memset(&param, 0, sizeof(param));
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    pthread_setaffinity_np(pthread_self(), sizeof(rt_others), &rt_others);
+}
+
+#else
+
+int
+rt_enter(unsigned int cpu)
+{
+    bfdev_log_info("Real-time mode:\n");
+    bfdev_log_err("\tCPU pinning is unsupported on this platform\n");
+    return -BFDEV_ENOTSUPP;
+}
+
+void
+rt_worker(void)
+{
+}
+
+#endif
+
+void
+rt_lock(const void *addr, size_t len)
+{
+    const volatile uint8_t *walk;
+    size_t page, offset;
+
+    if (!rt_active || !len)
+        return;
+
+    if (!mlock(addr, len)) {
+        rt_locked += len;
+        bfdev_log_debug("\trealtime: locked %zu bytes, %zu total\n",
+                        len, rt_locked);
+        return;
+    }
+
+    /* Over RLIMIT_MEMLOCK, at least take the faults up front */
+    page = sysconf(_SC_PAGESIZE);
+    walk = addr;
+    for (offset = 0; offset < len; offset += page)
+        (void)walk[offset];
+    (void)walk[len - 1];
+
+    rt_faulted += len;
+    bfdev_log_debug("\trealtime: prefaulted %zu bytes, %zu total\n",
+                    len, rt_faulted);
+}
+
+void
+rt_hist_add(struct rt_hist *hist, double sample)
+{
+    unsigned long usecs;
+    unsigned int index;
+
+    usecs = sample * 1000000;
+    for (index = 0; index < RT_HIST_BUCKETS - 1; ++index) {
+        if (usecs < 2UL << index)
+            break;
+    }
+
+    hist->bucket[index]++;
+    hist->count++;
+    hist->sum += sample;
+    if (sample > hist->max)
+        hist->max = sample;
+}
+
+void
+rt_hist_report(const struct rt_hist *hist)
+{
+    unsigned long seen, p50, p99, bound;
+    unsigned int index;
+    bool last;
+
+    if (!hist->count)
+        return;
+
+    p50 = p99 = 0;
+    for (seen = index = 0; index < RT_HIST_BUCKETS; ++index) {
+        seen += hist->bucket[index];
+        if (!p50 && seen * 2 >= hist->count)
+            p50 = 2UL << index;
+        if (!p99 && seen * 100 >= hist->count * 99)
+            p99 = 2UL << index;
+    }
+
+    logger_printf(LOGGER_INFO, "\tHost latency: %lu gaps, avg %.1fus, "
+                  "p50 <%luus, p99 <%luus, max %.1fus\n", hist->count,
+                  hist->sum / hist->count * 1000000, p50, p99,
+                  hist->max * 1000000);
+
+    if (rt_active)
+        logger_printf(LOGGER_INFO, "\tMemory: %zu bytes locked, "
+                      "%zu prefaulted\n", rt_locked, rt_faulted);
+
+    for (index = 0; index < RT_HIST_BUCKETS; ++index) {
+        if (!hist->bucket[index])
+            continue;
+
+        /* The last bucket holds everything above the others */
+        last = index == RT_HIST_BUCKETS - 1;
+        bound = last ? 1UL << index : 2UL << index;
+        logger_printf(rt_active ? LOGGER_INFO : LOGGER_DEBUG,
+                      "\t    %s%7luus %lu\n", last ? ">=" : " <",
+                      bound, hist->bucket[index]);
+    }
+}
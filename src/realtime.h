@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+
+/* Bucket n counts gaps below 2^(n + 1) microseconds, the last one the rest */
+#define RT_HIST_BUCKETS 20
+
+struct rt_hist {
+    unsigned long bucket[RT_HIST_BUCKETS];
+    unsigned long count;
+    double sum;
+    double max;
+};
+
+extern bool
+rt_enabled(void);
+
+extern int
+rt_enter(unsigned int cpu);
+
+extern void
+rt_worker(void);
+
+extern void
+rt_lock(const void *addr, size_t len);
+
+extern void
+rt_hist_add(struct rt_hist *hist, double sample);
+
+extern void
+rt_hist_report(const struct rt_hist *hist);
+
+#endif /* _REALTIME_H_ */
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <ring.h>
+
+#define RING_SPIN 64
+#define RING_NAP 50000 /* ns */
+
+static void
+ring_backoff(unsigned int *spins)
+{
+    struct timespec ts;
+
+    /* Spin briefly, then yield the cpu in short naps */
+    if (++*spins < RING_SPIN) {
+        sched_yield();
+        return;
+    }
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = RING_NAP;
+    nanosleep(&ts, NULL);
+}
+
+int
+ring_setup(struct ring *ring, void *slots, unsigned int *lens,
+           unsigned int count, unsigned int size)
+{
+    /* Free running indices need a power of two slot count */
+    if (!count || (count & (count - 1)))
+        return -BFDEV_EINVAL;
+
+    ring->slots = slots;
+    ring->lens = lens;
+    ring->count = count;
+    ring->size = size;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->error, 0);
+    atomic_init(&ring->closed, false);
+
+    return -BFDEV_ENOERR;
+}
+
+int
+ring_init(struct ring *ring, unsigned int count, unsigned int size)
+{
+    void *slots;
+    unsigned int *lens;
+    int retval;
+
+    slots = malloc((size_t)count * size);
+    lens = calloc(count, sizeof(*lens));
+    if (!slots || !lens) {
+        free(slots);
+        free(lens);
+        return -BFDEV_ENOMEM;
+    }
+
+    retval = ring_setup(ring, slots, lens, count, size);
+    if (retval) {
+        free(slots);
+        free(lens);
+    }
+
+    return retval;
+}
+
+void
+ring_release(struct ring *ring)
+{
+    free(ring->slots);
+    free(ring->lens);
+    ring->slots = NULL;
+    ring->lens = NULL;
+}
+
+void *
+ring_produce_begin(struct ring *ring)
+{
+    unsigned int head, spins;
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (spins = 0; head - atomic_load_explicit(&ring->tail,
+         memory_order_acquire) == ring->count;) {
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire))
+            return NULL;
+        ring_backoff(&spins);
+    }
+
+    return ring->slots + (size_t)(head & (ring->count - 1)) * ring->size;
+}
+
+void
+ring_produce_end(struct ring *ring, unsigned int len)
+{
+    unsigned int head;
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->lens[head & (ring->count - 1)] = len;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void *
+ring_peek(struct ring *ring, unsigned int index, unsigned int *len)
+{
+    unsigned int tail, spins;
+
+    /* Slots stay owned by the consumer until ring_consume_end() */
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (spins = 0; atomic_load_explicit(&ring->head,
+         memory_order_acquire) - tail <= index;) {
+        /* Drained and closed by the producer: end of data or error */
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire) &&
+            atomic_load_explicit(&ring->head, memory_order_acquire) - tail <= index)
+            return NULL;
+        ring_backoff(&spins);
+    }
+
+    index = (tail + index) & (ring->count - 1);
+    *len = ring->lens[index];
+
+    return ring->slots + (size_t)index * ring->size;
+}
+
+void *
+ring_consume_begin(struct ring *ring, unsigned int *len)
+{
+    return ring_peek(ring, 0, len);
+}
+
+void
+ring_consume_end(struct ring *ring)
+{
+    unsigned int tail;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+void
+ring_close(struct ring *ring, int error)
+{
+    if (error)
+        atomic_store_explicit(&ring->error, error, memory_order_relaxed);
+    atomic_store_explicit(&ring->closed, true, memory_order_release);
+}
@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <bfdev.h>
+
+/*
+ * Single-producer/single-consumer ring of fixed size slots.
+ * The producer only moves head and the consumer only moves tail,
+ * so neither side ever takes a lock.
+ */
+struct ring {
+    uint8_t *slots;
+    unsigned int *lens;
+    unsigned int count;
+    unsigned int size;
+
+    _Atomic unsigned int head;
+    _Atomic unsigned int tail;
+    _Atomic int error;
+    atomic_bool closed;
+};
+
+extern int
+ring_setup(struct ring *ring, void *slots, unsigned int *lens,
+           unsigned int count, unsigned int size);
+
+extern int
+ring_init(struct ring *ring, unsigned int count, unsigned int size);
+
+extern void
+ring_release(struct ring *ring);
+
+extern void *
+ring_produce_begin(struct ring *ring);
+
+extern void
+ring_produce_end(struct ring *ring, unsigned int len);
+
+extern void *
+ring_peek(struct ring *ring, unsigned int index, unsigned int *len);
+
+extern void *
+ring_consume_begin(struct ring *ring, unsigned int *len);
+
+extern void
+ring_consume_end(struct ring *ring);
+
+extern void
+ring_close(struct ring *ring, int error);
+
+static inline unsigned int
+ring_depth(struct ring *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+#endif /* _RING_H_ */
@@ -0,0 +1,589 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <termios.h>
+
+#include <secbootemu.h>
+#include <timeout.h>
+#include <image.h>
+#include <w80xprog.h>
+#include <w80xhw.h>
+
+struct secbootemu {
+    int master;
+    int stream;
+    const char *mac;
+    unsigned int latency;
+    unsigned int nak;
+    unsigned long stall;
+    unsigned int stall_ms;
+    unsigned int period;
+    unsigned long cancel;
+    int refuse;
+    size_t queue;
+
+    bool secboot;
+    bool busy;
+    uint8_t expect;
+    double prompt;
+    double partial;
+    unsigned long packets;
+    unsigned long naks;
+    unsigned long drops;
+
+    /* Image checks run after the EOT, reported by GET_ERROR */
+    struct image_check check;
+    uint8_t held[PAYLOAD_SIZE];
+    bool holding;
+    char error;
+
+    size_t rxlen;
+    uint8_t rxbuf[SECBOOTEMU_BUFFER];
+};
+
+static const struct option
+options[] = {
+    {"help",    no_argument,       0, 'h'},
+    {"latency", required_argument, 0, 'l'},
+    {"queue",   required_argument, 0, 'q'},
+    {"nak",     required_argument, 0, 'n'},
+    {"stall",   required_argument, 0, 's'},
+    {"prompt",  required_argument, 0, 'p'},
+    {"refuse",  required_argument, 0, 'x'},
+    {"cancel",  required_argument, 0, 'c'},
+    {"mac",     required_argument, 0, 'm'},
+    {"verbose", no_argument,       0, 'v'},
+    { }, /* NULL */
+};
+
+static __bfdev_noreturn void
+usage(void)
+{
+    bfdev_log_err("Usage: w80xprog secboot-emu [options] <stream-file>\n");
+    bfdev_log_err("\t-h, --help                display this message\n");
+    bfdev_log_err("\t-l, --latency <us>        device time per packet\n");
+    bfdev_log_err("\t-q, --queue <bytes>       receive queue, a packet with\n");
+    bfdev_log_err("\t                          more than this behind it is lost\n");
+    bfdev_log_err("\t-n, --nak <count>         refuse every count-th packet\n");
+    bfdev_log_err("\t-s, --stall <packet:ms>   hold the answer to one packet\n");
+    bfdev_log_err("\t-p, --prompt <ms>         idle prompt period\n");
+    bfdev_log_err("\t-x, --refuse <opcode>     fail every command with opcode\n");
+    bfdev_log_err("\t-c, --cancel <packet>     cancel the transfer at one packet\n");
+    bfdev_log_err("\t-m, --mac <hex>           mac address to report\n");
+    bfdev_log_err("\t-v, --verbose             print every frame\n");
+    exit(1);
+}
+
+static int
+emu_write(struct secbootemu *emu, const void *buff, size_t len)
+{
+    if (write(emu->master, buff, len) != (ssize_t)len)
+        return -BFDEV_EIO;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+emu_fill(struct secbootemu *emu, int wait)
+{
+    struct pollfd pfd;
+    ssize_t retval;
+
+    pfd.fd = emu->master;
+    pfd.events = POLLIN;
+
+    while (emu->rxlen < sizeof(emu->rxbuf)) {
+        if (poll(&pfd, 1, wait) <= 0)
+            break;
+
+        retval = read(emu->master, emu->rxbuf + emu->rxlen,
+                      sizeof(emu->rxbuf) - emu->rxlen);
+        if (retval <= 0)
+            return -BFDEV_EIO;
+
+        emu->rxlen += retval;
+        wait = 0;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static void
+emu_consume(struct secbootemu *emu, size_t len)
+{
+    emu->rxlen -= len;
+    memmove(emu->rxbuf, emu->rxbuf + len, emu->rxlen);
+    emu->partial = 0;
+}
+
+static bool
+emu_need(struct secbootemu *emu, size_t len)
+{
+    if (emu->rxlen >= len)
+        return true;
+
+    /* The ROM gives up on a frame that stops halfway */
+    if (!emu->partial)
+        emu->partial = timeout_now();
+    else if (timeout_now() - emu->partial > SECBOOTEMU_GAP / 1000.0) {
+        bfdev_log_debug("\tincomplete frame of %zu bytes dropped\n",
+                        emu->rxlen);
+        emu_consume(emu, emu->rxlen);
+    }
+
+    return false;
+}
+
+static int
+emu_status(struct secbootemu *emu, char status)
+{
+    return emu_write(emu, &status, 1);
+}
+
+static int
+emu_command(struct secbootemu *emu, const struct opcode_content *content,
+            size_t length)
+{
+    const struct spinor_erase *erase;
+    char reply[REPLY_GAIN_LEN + 1];
+    uint16_t cksum;
+    uint8_t opcode;
+
+    cksum = bfdev_crc_itut(&content->opcode, length - 2, 0xffff);
+    if (cksum != bfdev_le16_to_cpu(content->checksum))
+        return emu_status(emu, RETURN_ECRC);
+
+    opcode = OPCODE_DATA(bfdev_le32_to_cpu(content->opcode));
+    bfdev_log_debug("\topcode %#04x, %zu bytes\n", opcode, length);
+
+    if (opcode == emu->refuse)
+        return emu_status(emu, RETURN_EINVAL);
+
+    switch (opcode) {
+        case OPCODE_DATA(OPCODE_SET_FREQ):
+            return emu_status(emu, XMODEM_ACK);
+
+        case OPCODE_DATA(OPCODE_ERASE_SPINOR):
+            if (length < sizeof(*content) + sizeof(*erase))
+                return emu_status(emu, RETURN_EINVAL);
+
+            /* A millisecond per sector, fast enough for tests */
+            erase = (const void *)content->param;
+            usleep(bfdev_le16_to_cpu(erase->count) * 1000);
+            return emu_status(emu, RETURN_NOMAL);
+
+        case OPCODE_DATA(OPCODE_SET_BT_MAC):
+        case OPCODE_DATA(OPCODE_SET_GAIN):
+        case OPCODE_DATA(OPCODE_SET_NET_MAC):
+            return emu_status(emu, RETURN_NOMAL);
+
+        case OPCODE_DATA(OPCODE_GET_BT_MAC):
+        case OPCODE_DATA(OPCODE_GET_NET_MAC):
+            snprintf(reply, sizeof(reply), "Mac:%s\r\n", emu->mac);
+            return emu_write(emu, reply, strlen(reply));
+
+        case OPCODE_DATA(OPCODE_GET_GAIN):
+            memset(reply, 'F', REPLY_GAIN_LEN);
+            memcpy(reply, "G:", 2);
+            reply[REPLY_GAIN_LEN] = '\n';
+            return emu_write(emu, reply, REPLY_GAIN_LEN + 1);
+
+        case OPCODE_DATA(OPCODE_GET_SPINOR):
+            return emu_write(emu, "FID:c8,15\n", 10);
+
+        case OPCODE_DATA(OPCODE_GET_VERSION):
+            return emu_write(emu, "R:8\n", 4);
+
+        case OPCODE_DATA(OPCODE_GET_ERROR):
+            snprintf(reply, sizeof(reply), "E:%c\n", emu->error);
+            return emu_write(emu, reply, REPLY_ERROR_LEN + 1);
+
+        case OPCODE_DATA(OPCODE_REBOOT):
+            bfdev_log_info("\tReboot\n");
+            emu->secboot = false;
+
+            /* The app prints its banner in pieces, as a slow console does */
+            if (emu_write(emu, "app bo", 6))
+                return -BFDEV_EIO;
+            usleep(50000);
+            return emu_write(emu, "ot\r\n", 4);
+
+        default:
+            return emu_status(emu, RETURN_EINVAL);
+    }
+}
+
+static void
+emu_check(struct secbootemu *emu, const uint8_t *data, size_t len)
+{
+    if (emu->error == RETURN_NOMAL && image_check_feed(&emu->check, data, len))
+        emu->error = RETURN_EDCRC;
+}
+
+static bool
+emu_padding(const uint8_t *data, size_t len)
+{
+    while (len--) {
+        if (*data++ != 0x1a)
+            return false;
+    }
+
+    return true;
+}
+
+static void
+emu_verify(struct secbootemu *emu)
+{
+    struct image_check *check;
+    const uint8_t *walk;
+    size_t len, xfer;
+
+    /*
+     * The last packet is padded, feed it one header or payload at a
+     * time and stop where only padding is left before the next header.
+     */
+    check = &emu->check;
+    len = emu->holding ? PAYLOAD_SIZE : 0;
+    for (walk = emu->held; len; walk += xfer, len -= xfer) {
+        if (check->state == IMAGE_CHECK_HEAD && !check->fill &&
+            emu_padding(walk, len))
+            break;
+
+        if (check->state == IMAGE_CHECK_HEAD)
+            xfer = sizeof(check->head) - check->fill;
+        else
+            xfer = check->remain;
+
+        xfer = bfdev_min(xfer, len);
+        emu_check(emu, walk, xfer);
+        if (emu->error != RETURN_NOMAL)
+            return;
+    }
+
+    if (emu->error == RETURN_NOMAL && image_check_end(check))
+        emu->error = RETURN_EDATA;
+}
+
+static int
+emu_packet(struct secbootemu *emu, const struct xmodem_packet *packet)
+{
+    uint16_t cksum;
+
+    emu->packets++;
+
+    /* The host ran ahead of the flash writes, the UART lost this one */
+    if (emu->queue && emu->rxlen - sizeof(*packet) > emu->queue) {
+        bfdev_log_debug("\tpacket %lu lost, %zu bytes queued\n",
+                        emu->packets, emu->rxlen - sizeof(*packet));
+        emu->drops++;
+        return -BFDEV_ENOERR;
+    }
+
+    if (emu->latency)
+        usleep(emu->latency);
+
+    if (emu->nak && !(emu->packets % emu->nak))
+        goto refuse;
+
+    cksum = bfdev_crc_itut(packet->payload, PAYLOAD_SIZE, 0);
+    if (cksum != bfdev_be16_to_cpu(packet->checksum) ||
+        (uint8_t)~packet->count != packet->verify)
+        goto refuse;
+
+    /* The answer to a repeat was lost, repeat it */
+    if (packet->count == (uint8_t)(emu->expect - 1))
+        return emu_status(emu, XMODEM_ACK);
+
+    if (packet->count != emu->expect)
+        goto refuse;
+
+    /* The link went away halfway, as far as the host can tell */
+    if (emu->packets == emu->cancel) {
+        bfdev_log_info("\tTransfer cancelled at packet %lu\n", emu->packets);
+        emu->busy = false;
+        emu->expect = 1;
+        emu->error = RETURN_CANCEL;
+        emu->prompt = timeout_now();
+        return emu_status(emu, XMODEM_CAN);
+    }
+
+    if (write(emu->stream, packet->payload, PAYLOAD_SIZE) != PAYLOAD_SIZE)
+        return -BFDEV_EIO;
+    emu->expect++;
+
+    if (emu->holding)
+        emu_check(emu, emu->held, PAYLOAD_SIZE);
+    memcpy(emu->held, packet->payload, PAYLOAD_SIZE);
+    emu->holding = true;
+
+    if (emu->packets == emu->stall) {
+        bfdev_log_debug("\tpacket %lu held for %ums\n",
+                        emu->packets, emu->stall_ms);
+        usleep(emu->stall_ms * 1000);
+    }
+
+    return emu_status(emu, XMODEM_ACK);
+
+refuse:
+    emu->naks++;
+    return emu_status(emu, XMODEM_NAK);
+}
+
+static int
+emu_step(struct secbootemu *emu)
+{
+    const struct opcode_head *head;
+    size_t length;
+    uint8_t value;
+    int retval;
+
+    value = emu->rxbuf[0];
+    if (!emu->secboot) {
+        emu_consume(emu, 1);
+        if (value != 0x1b)
+            return -BFDEV_ENOERR;
+
+        emu->secboot = true;
+        emu->prompt = timeout_now();
+        return emu_write(emu, "Secboot V0.6\r\n", 14);
+    }
+
+    if (emu->busy) {
+        switch (value) {
+            case XMODEM_SOH:
+                if (!emu_need(emu, sizeof(struct xmodem_packet)))
+                    return -BFDEV_EAGAIN;
+
+                /* Look at what arrived while the last packet was written */
+                retval = emu_fill(emu, 0);
+                if (!retval)
+                    retval = emu_packet(emu, (void *)emu->rxbuf);
+                emu_consume(emu, sizeof(struct xmodem_packet));
+                return retval;
+
+            case XMODEM_EOT:
+                emu_consume(emu, 1);
+                emu_verify(emu);
+                bfdev_log_info("\tTransfer done, %lu packets, %lu refused, "
+                               "%lu lost so far, [%#04x]: %s\n", emu->packets,
+                               emu->naks, emu->drops, emu->error,
+                               status_info(emu->error));
+                emu->busy = false;
+                emu->expect = 1;
+                emu->prompt = timeout_now();
+                return emu_status(emu, XMODEM_ACK);
+
+            case XMODEM_CAN:
+                emu_consume(emu, 1);
+                bfdev_log_info("\tTransfer cancelled\n");
+                emu->busy = false;
+                emu->expect = 1;
+                emu->error = RETURN_CANCEL;
+                emu->prompt = timeout_now();
+                return emu_status(emu, RETURN_CANCEL);
+
+            default:
+                emu_consume(emu, 1);
+                return -BFDEV_ENOERR;
+        }
+    }
+
+    switch (value) {
+        case 0x21:
+            if (!emu_need(emu, sizeof(*head)))
+                return -BFDEV_EAGAIN;
+
+            head = (void *)emu->rxbuf;
+            length = head->length;
+            if (length < sizeof(struct opcode_content)) {
+                emu_consume(emu, sizeof(*head));
+                return emu_status(emu, RETURN_ECRC);
+            }
+
+            if (!emu_need(emu, sizeof(*head) + length))
+                return -BFDEV_EAGAIN;
+
+            retval = emu_command(emu, (void *)(head + 1), length);
+            emu_consume(emu, sizeof(*head) + length);
+            return retval;
+
+        case XMODEM_SOH:
+            /* The first packet turns the prompt off for the transfer */
+            emu->busy = true;
+            emu->holding = false;
+            emu->error = RETURN_NOMAL;
+            image_check_init(&emu->check);
+            return -BFDEV_ENOERR;
+
+        default:
+            emu_consume(emu, 1);
+            return -BFDEV_ENOERR;
+    }
+}
+
+static int
+emu_serve(struct secbootemu *emu)
+{
+    double now;
+    int retval;
+
+    emu->expect = 1;
+    for (;;) {
+        retval = emu_fill(emu, bfdev_min(emu->period, 10));
+        if (retval)
+            return retval;
+
+        while (emu->rxlen) {
+            retval = emu_step(emu);
+            if (retval == -BFDEV_EAGAIN)
+                break;
+            if (retval)
+                return retval;
+        }
+
+        /* The ROM keeps asking for a transfer while idle */
+        now = timeout_now();
+        if (emu->secboot && !emu->busy &&
+            now - emu->prompt >= emu->period / 1000.0) {
+            retval = emu_status(emu, RETURN_NOMAL);
+            if (retval)
+                return retval;
+            emu->prompt = now;
+        }
+    }
+}
+
+static int
+emu_open(struct secbootemu *emu, int *slave)
+{
+    struct termios term;
+    const char *name;
+
+    emu->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (emu->master < 0)
+        return -BFDEV_ENODEV;
+
+    if (grantpt(emu->master) || unlockpt(emu->master))
+        return -BFDEV_ENODEV;
+
+    name = ptsname(emu->master);
+    if (!name)
+        return -BFDEV_ENODEV;
+
+    /* Holding the slave open keeps the master alive between sessions */
+    *slave = open(name, O_RDWR | O_NOCTTY);
+    if (*slave < 0)
+        return -BFDEV_ENODEV;
+
+    tcgetattr(*slave, &term);
+    cfmakeraw(&term);
+    tcsetattr(*slave, TCSANOW, &term);
+
+    bfdev_log_info("Secboot emulator on %s\n", name);
+    return -BFDEV_ENOERR;
+}
+
+int
+secbootemu_main(int argc, char *const argv[])
+{
+    struct secbootemu *emu;
+    const char *errname;
+    int optidx, retval, slave;
+    char arg, *walk;
+
+    emu = malloc(sizeof(*emu));
+    if (!emu)
+        return -BFDEV_ENOMEM;
+
+    memset(emu, 0, sizeof(*emu));
+    emu->stream = -1;
+    emu->mac = "0123456789AB";
+    emu->period = SECBOOTEMU_PROMPT;
+    emu->refuse = -1;
+    emu->error = RETURN_NOMAL;
+
+    /* Tests read the log while the emulator runs */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (;;) {
+        arg = getopt_long(argc, argv, "l:q:n:s:p:x:c:m:vh", options, &optidx);
+        if (arg == -1)
+            break;
+
+        switch (arg) {
+            case 'l':
+                emu->latency = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'q':
+                emu->queue = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'n':
+                emu->nak = strtoul(optarg, NULL, 0);
+                break;
+
+            case 's':
+                emu->stall = strtoul(optarg, &walk, 0);
+                if (*walk != ':')
+                    usage();
+                emu->stall_ms = strtoul(walk + 1, NULL, 0);
+                break;
+
+            case 'p':
+                emu->period = strtoul(optarg, NULL, 0);
+                if (!emu->period)
+                    usage();
+                break;
+
+            case 'x':
+                emu->refuse = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'c':
+                emu->cancel = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'm':
+                emu->mac = optarg;
+                break;
+
+            case 'v':
+                bfdev_log_default.record_level = BFDEV_LEVEL_DEBUG;
+                break;
+
+            case 'h': default:
+                usage();
+        }
+    }
+
+    if (argc - optind != 1)
+        usage();
+
+    emu->stream = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (emu->stream < 0)
+        retval = -BFDEV_ENOENT;
+    else
+        retval = emu_open(emu, &slave);
+
+    if (!retval)
+        retval = emu_serve(emu);
+
+    bfdev_errname(retval, &errname);
+    bfdev_log_err("Secboot emulator stopped: %s\n", errname);
+
+    if (emu->stream >= 0)
+        close(emu->stream);
+    free(emu);
+
+    return retval;
+}
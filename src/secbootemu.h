@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _SECBOOTEMU_H_
+#define _SECBOOTEMU_H_
+
+#include <config.h>
+#include <errno.h>
+#include <bfdev.h>
+
+/* Input buffer, enough for a full send-ahead window and then some */
+#define SECBOOTEMU_BUFFER (64 * 1024)
+
+/* Idle prompt period of the ROM, in milliseconds */
+#define SECBOOTEMU_PROMPT 100
+
+/* A frame not completed within this many milliseconds is dropped */
+#define SECBOOTEMU_GAP 1000
+
+extern int
+secbootemu_main(int argc, char *const argv[]);
+
+#endif /* _SECBOOTEMU_H_ */
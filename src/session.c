@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <session.h>
+#include <state.h>
+#include <term.h>
+#include <timeout.h>
+
+static void
+session_write(struct session *sess)
+{
+    if (pwrite(sess->fd, &sess->record, sizeof(sess->record), 0) !=
+        sizeof(sess->record))
+        bfdev_log_warn("\tFailed to write %s\n", sess->path);
+}
+
+int
+session_open(struct session *sess, const char *port)
+{
+    char name[64], *walk;
+    int retval;
+
+    sess->fd = -1;
+
+    /* One state file per port path, "/dev/ttyUSB0" is "dev_ttyUSB0" */
+    snprintf(name, sizeof(name), "%s", port + (*port == '/'));
+    for (walk = name; *walk; ++walk) {
+        if (*walk == '/')
+            *walk = '_';
+    }
+
+    retval = state_path(sess->path, sizeof(sess->path), "session-%s", name);
+    if (retval)
+        return retval;
+
+    sess->fd = open(sess->path, O_RDWR | O_CREAT, 0644);
+    if (sess->fd < 0)
+        return -BFDEV_EPERM;
+
+    /* Held until exit, a second process on the port would corrupt both */
+    if (flock(sess->fd, LOCK_EX | LOCK_NB)) {
+        close(sess->fd);
+        sess->fd = -1;
+        return -BFDEV_EBUSY;
+    }
+
+    if (pread(sess->fd, &sess->record, sizeof(sess->record), 0) !=
+        sizeof(sess->record) || sess->record.magic != SESSION_MAGIC)
+        memset(&sess->record, 0, sizeof(sess->record));
+
+    return -BFDEV_ENOERR;
+}
+
+int
+session_reattach(struct session *sess, unsigned int speed)
+{
+    struct session_record *record;
+    char mac[ETH_STR_ALEN];
+    double start;
+    int retval;
+
+    record = &sess->record;
+    if (!record->secboot || !record->speed)
+        return -BFDEV_ENOENT;
+
+    /* Until this run ends cleanly, the chip state is unknown */
+    record->secboot = false;
+    session_write(sess);
+
+    bfdev_log_info("Reattach session:\n");
+    start = timeout_now();
+
+    retval = term_setspeed(record->speed);
+    if (retval)
+        return retval;
+
+    retval = chip_probe(mac, SESSION_PROBE);
+    if (retval || strcmp(mac, record->mac)) {
+        if (!retval)
+            bfdev_log_info("\tFound %s instead of %s\n", mac, record->mac);
+        bfdev_log_info("\tNo session at %u baud after %.1fms, "
+                       "full entry\n", record->speed,
+                       (timeout_now() - start) * 1000);
+        term_setspeed(speed);
+        return retval ?: -BFDEV_ENODEV;
+    }
+
+    bfdev_log_info("\tSecboot at %u baud, MAC %s, reattached in %.1fms\n",
+                   record->speed, mac, (timeout_now() - start) * 1000);
+    return -BFDEV_ENOERR;
+}
+
+void
+session_save(struct session *sess, bool secboot)
+{
+    struct session_record *record;
+
+    record = &sess->record;
+    record->magic = SESSION_MAGIC;
+    record->pid = getpid();
+    record->speed = term_getspeed();
+    record->secboot = secboot;
+
+    /* The MAC tells a swapped board from the one we left behind */
+    if (secboot && chip_wmac(record->mac))
+        record->secboot = false;
+
+    session_write(sess);
+}
+
+void
+session_close(struct session *sess)
+{
+    if (sess->fd < 0)
+        return;
+
+    close(sess->fd);
+    sess->fd = -1;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <bfdev.h>
+#include <w80xprog.h>
+
+#define SESSION_MAGIC 0x53533857 /* "W8SS" */
+
+/*
+ * What the last run left on the port. Only a run that ends cleanly
+ * with the chip still in secboot marks the record as reusable.
+ */
+struct session_record {
+    uint32_t magic;
+    uint32_t speed;
+    uint32_t secboot;
+    uint32_t pid;
+    char mac[ETH_STR_ALEN];
+};
+
+struct session {
+    struct session_record record;
+    char path[PATH_MAX];
+    int fd;
+};
+
+extern int
+session_open(struct session *sess, const char *port);
+
+extern int
+session_reattach(struct session *sess, unsigned int speed);
+
+extern void
+session_save(struct session *sess, bool secboot);
+
+extern void
+session_close(struct session *sess);
+
+#endif /* _SESSION_H_ */
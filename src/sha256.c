@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sha256.h>
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SIG0(x) (ROR32(x, 2) ^ ROR32(x, 13) ^ ROR32(x, 22))
+#define SIG1(x) (ROR32(x, 6) ^ ROR32(x, 11) ^ ROR32(x, 25))
+#define GAM0(x) (ROR32(x, 7) ^ ROR32(x, 18) ^ ((x) >> 3))
+#define GAM1(x) (ROR32(x, 17) ^ ROR32(x, 19) ^ ((x) >> 10))
+
+static const uint32_t
+sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void
+sha256_transform(uint32_t *state, const uint8_t *block)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    unsigned int index;
+
+    for (index = 0; index < 16; ++index) {
+        w[index] = (uint32_t)block[index * 4] << 24 |
+                   (uint32_t)block[index * 4 + 1] << 16 |
+                   (uint32_t)block[index * 4 + 2] << 8 |
+                   (uint32_t)block[index * 4 + 3];
+    }
+
+    for (; index < 64; ++index)
+        w[index] = GAM1(w[index - 2]) + w[index - 7] +
+                   GAM0(w[index - 15]) + w[index - 16];
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for (index = 0; index < 64; ++index) {
+        t1 = h + SIG1(e) + CH(e, f, g) + sha256_k[index] + w[index];
+        t2 = SIG0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void
+sha256_init(struct sha256_ctx *ctx)
+{
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+void
+sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    unsigned int fill, part;
+
+    fill = ctx->count % SHA256_BLOCK_SIZE;
+    ctx->count += len;
+
+    if (fill) {
+        part = SHA256_BLOCK_SIZE - fill;
+        if (len < part) {
+            memcpy(ctx->buffer + fill, src, len);
+            return;
+        }
+
+        memcpy(ctx->buffer + fill, src, part);
+        sha256_transform(ctx->state, ctx->buffer);
+        src += part;
+        len -= part;
+    }
+
+    for (; len >= SHA256_BLOCK_SIZE; len -= SHA256_BLOCK_SIZE) {
+        sha256_transform(ctx->state, src);
+        src += SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->buffer, src, len);
+}
+
+void
+sha256_final(struct sha256_ctx *ctx, uint8_t *digest)
+{
+    uint8_t pad[SHA256_BLOCK_SIZE * 2];
+    unsigned int fill, plen, index;
+    uint64_t bits;
+
+    bits = ctx->count * 8;
+    fill = ctx->count % SHA256_BLOCK_SIZE;
+    plen = fill < 56 ? 56 - fill : 120 - fill;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (index = 0; index < 8; ++index)
+        pad[plen + index] = bits >> (56 - index * 8);
+
+    sha256_update(ctx, pad, plen + 8);
+    for (index = 0; index < 8; ++index) {
+        digest[index * 4] = ctx->state[index] >> 24;
+        digest[index * 4 + 1] = ctx->state[index] >> 16;
+        digest[index * 4 + 2] = ctx->state[index] >> 8;
+        digest[index * 4 + 3] = ctx->state[index];
+    }
+}
+
+char *
+sha256_hex(const uint8_t *digest, char *buff)
+{
+    unsigned int index;
+
+    for (index = 0; index < SHA256_DIGEST_SIZE; ++index)
+        sprintf(buff + index * 2, "%02x", digest[index]);
+
+    return buff;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t buffer[SHA256_BLOCK_SIZE];
+};
+
+extern void
+sha256_init(struct sha256_ctx *ctx);
+
+extern void
+sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+
+extern void
+sha256_final(struct sha256_ctx *ctx, uint8_t *digest);
+
+extern char *
+sha256_hex(const uint8_t *digest, char *buff);
+
+#endif /* _SHA256_H_ */
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <state.h>
+
+static int
+state_mkdir(char *path)
+{
+    char *walk;
+
+    /* Equivalent of "mkdir -p" */
+    for (walk = path + 1; *walk; ++walk) {
+        if (*walk != '/')
+            continue;
+
+        *walk = '\0';
+        mkdir(path, 0755);
+        *walk = '/';
+    }
+
+    if (mkdir(path, 0755) && errno != EEXIST)
+        return -BFDEV_EPERM;
+
+    return -BFDEV_ENOERR;
+}
+
+int
+state_path(char *buff, size_t size, const char *fmt, ...)
+{
+    const char *base;
+    va_list args;
+    int retval, len;
+
+    /*
+     * Small per-host state such as resume journals lives under
+     * $W80XPROG_STATE, or the XDG state directory by default.
+     */
+    if ((base = getenv("W80XPROG_STATE")))
+        len = snprintf(buff, size, "%s", base);
+    else if ((base = getenv("XDG_STATE_HOME")))
+        len = snprintf(buff, size, "%s/w80xprog", base);
+    else if ((base = getenv("HOME")))
+        len = snprintf(buff, size, "%s/.local/state/w80xprog", base);
+    else
+        len = snprintf(buff, size, "/tmp/w80xprog");
+
+    if (len < 0 || len >= size)
+        return -BFDEV_ENAMETOOLONG;
+
+    retval = state_mkdir(buff);
+    if (retval)
+        return retval;
+
+    if (len + 1 >= size)
+        return -BFDEV_ENAMETOOLONG;
+
+    buff[len++] = '/';
+    va_start(args, fmt);
+    retval = vsnprintf(buff + len, size - len, fmt, args);
+    va_end(args);
+
+    if (retval < 0 || retval >= size - len)
+        return -BFDEV_ENAMETOOLONG;
+
+    return -BFDEV_ENOERR;
+}
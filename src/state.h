@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <bfdev.h>
+
+/*
+ * Slot locks are held per open file description where the kernel has
+ * those. Elsewhere they fall back to process locks, which still keep
+ * processes apart, but are dropped when the process closes any other
+ * descriptor of the same file.
+ */
+#ifdef F_OFD_SETLK
+# define STATE_SETLK F_OFD_SETLK
+# define STATE_SETLKW F_OFD_SETLKW
+# define STATE_GETLK F_OFD_GETLK
+#else
+# define STATE_SETLK F_SETLK
+# define STATE_SETLKW F_SETLKW
+# define STATE_GETLK F_GETLK
+#endif
+
+extern int
+state_path(char *buff, size_t size, const char *fmt, ...);
+
+#endif /* _STATE_H_ */
@@ -0,0 +1,376 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <stream.h>
+#include <logger.h>
+
+#ifdef HAVE_LZMA
+# include <lzma.h>
+#endif
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+static const char *
+format_name[] = {
+    [STREAM_PLAIN] = "plain",
+    [STREAM_GZIP] = "gzip",
+    [STREAM_XZ] = "xz",
+    [STREAM_ZSTD] = "zstd",
+};
+
+enum stream_format
+stream_sniff(const void *data, size_t len)
+{
+    const uint8_t *magic = data;
+
+    if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return STREAM_GZIP;
+
+    if (len >= 6 && !memcmp(magic, "\xfd" "7zXZ\0", 6))
+        return STREAM_XZ;
+
+    if (len >= 4 && !memcmp(magic, "\x28\xb5\x2f\xfd", 4))
+        return STREAM_ZSTD;
+
+    return STREAM_PLAIN;
+}
+
+static int
+stream_fill(struct stream *stream)
+{
+    ssize_t retval;
+
+    if (stream->inpos < stream->inlen || stream->eof)
+        return -BFDEV_ENOERR;
+
+    retval = read(stream->fd, stream->inbuf, STREAM_INBUF);
+    if (retval < 0)
+        return -BFDEV_EIO;
+
+    stream->inpos = 0;
+    stream->inlen = retval;
+    stream->eof = !retval;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+decode_plain(struct stream *stream, uint8_t *buff, unsigned int len)
+{
+    ssize_t retval;
+    size_t xfer;
+
+    /* Hand over the sniffed bytes, then read straight into the caller */
+    if (stream->inpos < stream->inlen) {
+        xfer = bfdev_min(len, stream->inlen - stream->inpos);
+        memcpy(buff, stream->inbuf + stream->inpos, xfer);
+        stream->inpos += xfer;
+        return xfer;
+    }
+
+    retval = read(stream->fd, buff, len);
+    if (retval < 0)
+        return -BFDEV_EIO;
+
+    stream->finished = !retval;
+    return retval;
+}
+
+static int
+decode_gzip(struct stream *stream, uint8_t *buff, unsigned int len)
+{
+    z_stream *zs = stream->decoder;
+    int retval, state;
+
+    zs->next_out = buff;
+    zs->avail_out = len;
+
+    while (zs->avail_out && !stream->finished) {
+        retval = stream_fill(stream);
+        if (retval)
+            return retval;
+
+        if (stream->eof)
+            return -BFDEV_EBADMSG;
+
+        zs->next_in = stream->inbuf + stream->inpos;
+        zs->avail_in = stream->inlen - stream->inpos;
+
+        state = inflate(zs, Z_NO_FLUSH);
+        stream->inpos = stream->inlen - zs->avail_in;
+
+        if (state == Z_STREAM_END)
+            stream->finished = true;
+        else if (state != Z_OK && state != Z_BUF_ERROR)
+            return -BFDEV_EBADMSG;
+    }
+
+    return len - zs->avail_out;
+}
+
+#ifdef HAVE_LZMA
+static int
+decode_xz(struct stream *stream, uint8_t *buff, unsigned int len)
+{
+    lzma_stream *xz = stream->decoder;
+    lzma_ret state;
+    int retval;
+
+    xz->next_out = buff;
+    xz->avail_out = len;
+
+    while (xz->avail_out && !stream->finished) {
+        retval = stream_fill(stream);
+        if (retval)
+            return retval;
+
+        xz->next_in = stream->inbuf + stream->inpos;
+        xz->avail_in = stream->inlen - stream->inpos;
+
+        state = lzma_code(xz, stream->eof ? LZMA_FINISH : LZMA_RUN);
+        stream->inpos = stream->inlen - xz->avail_in;
+
+        if (state == LZMA_STREAM_END)
+            stream->finished = true;
+        else if (state == LZMA_MEMLIMIT_ERROR) {
+            /* A dictionary far larger than any flash, not worth the memory */
+            logger_printf(LOGGER_ERR, "\tStream: xz needs %llu KiB, "
+                          "limit is %u KiB\n",
+                          (unsigned long long)lzma_memusage(xz) / 1024,
+                          STREAM_XZ_MEMLIMIT / 1024);
+            return -BFDEV_ENOMEM;
+        } else if (state != LZMA_OK)
+            return -BFDEV_EBADMSG;
+    }
+
+    return len - xz->avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int
+decode_zstd(struct stream *stream, uint8_t *buff, unsigned int len)
+{
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    size_t state;
+    int retval;
+
+    output.dst = buff;
+    output.size = len;
+    output.pos = 0;
+
+    while (output.pos < len && !stream->finished) {
+        retval = stream_fill(stream);
+        if (retval)
+            return retval;
+
+        if (stream->eof)
+            return -BFDEV_EBADMSG;
+
+        input.src = stream->inbuf;
+        input.size = stream->inlen;
+        input.pos = stream->inpos;
+
+        state = ZSTD_decompressStream(stream->decoder, &output, &input);
+        stream->inpos = input.pos;
+
+        if (ZSTD_isError(state))
+            return -BFDEV_EBADMSG;
+        else if (!state)
+            stream->finished = true;
+    }
+
+    return output.pos;
+}
+#endif
+
+static int
+decoder_init(struct stream *stream)
+{
+    switch (stream->format) {
+        case STREAM_PLAIN:
+            return -BFDEV_ENOERR;
+
+        case STREAM_GZIP: {
+            z_stream *zs;
+
+            zs = calloc(1, sizeof(*zs));
+            if (!zs || inflateInit2(zs, 15 + 32) != Z_OK) {
+                free(zs);
+                return -BFDEV_ENOMEM;
+            }
+
+            stream->decoder = zs;
+            return -BFDEV_ENOERR;
+        }
+
+#ifdef HAVE_LZMA
+        case STREAM_XZ: {
+            lzma_stream *xz;
+
+            xz = calloc(1, sizeof(*xz));
+            if (!xz || lzma_stream_decoder(xz, STREAM_XZ_MEMLIMIT, 0) != LZMA_OK) {
+                free(xz);
+                return -BFDEV_ENOMEM;
+            }
+
+            stream->decoder = xz;
+            return -BFDEV_ENOERR;
+        }
+#endif
+
+#ifdef HAVE_ZSTD
+        case STREAM_ZSTD:
+            stream->decoder = ZSTD_createDStream();
+            if (!stream->decoder)
+                return -BFDEV_ENOMEM;
+
+            ZSTD_initDStream(stream->decoder);
+            return -BFDEV_ENOERR;
+#endif
+
+        default:
+            bfdev_log_err("\tStream: %s support not built in\n",
+                          format_name[stream->format]);
+            return -BFDEV_ENOTSUPP;
+    }
+}
+
+static void
+decoder_release(struct stream *stream)
+{
+    if (!stream->decoder)
+        return;
+
+    switch (stream->format) {
+        case STREAM_GZIP:
+            inflateEnd(stream->decoder);
+            free(stream->decoder);
+            break;
+
+#ifdef HAVE_LZMA
+        case STREAM_XZ:
+            lzma_end(stream->decoder);
+            free(stream->decoder);
+            break;
+#endif
+
+#ifdef HAVE_ZSTD
+        case STREAM_ZSTD:
+            ZSTD_freeDStream(stream->decoder);
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    stream->decoder = NULL;
+}
+
+int
+stream_open(struct stream **streamp, int fd)
+{
+    struct stream *stream;
+    int retval;
+
+    stream = malloc(sizeof(*stream));
+    if (!stream)
+        return -BFDEV_ENOMEM;
+
+    memset(stream, 0, sizeof(*stream));
+    stream->fd = fd;
+    image_check_init(&stream->check);
+
+    /* Memory use is the input buffer and decoder, whatever the image size */
+    retval = stream_fill(stream);
+    if (!retval) {
+        stream->format = stream_sniff(stream->inbuf, stream->inlen);
+        bfdev_log_debug("\tStream: %s input\n", format_name[stream->format]);
+        retval = decoder_init(stream);
+    }
+
+    if (retval) {
+        free(stream);
+        return retval;
+    }
+
+    *streamp = stream;
+    return -BFDEV_ENOERR;
+}
+
+static int
+stream_decode(struct stream *stream, uint8_t *buff, unsigned int len)
+{
+    switch (stream->format) {
+        case STREAM_GZIP:
+            return decode_gzip(stream, buff, len);
+
+#ifdef HAVE_LZMA
+        case STREAM_XZ:
+            return decode_xz(stream, buff, len);
+#endif
+
+#ifdef HAVE_ZSTD
+        case STREAM_ZSTD:
+            return decode_zstd(stream, buff, len);
+#endif
+
+        default:
+            return decode_plain(stream, buff, len);
+    }
+}
+
+int
+stream_read(struct stream *stream, void *buff, unsigned int len)
+{
+    unsigned int held;
+    int retval;
+
+    for (;;) {
+        held = stream->held;
+        memcpy(buff, stream->hold, held);
+        stream->held = 0;
+
+        retval = stream->finished ? 0 :
+                 stream_decode(stream, buff + held, len - held);
+        if (retval <= 0)
+            return retval ? retval : image_check_end(&stream->check);
+
+        /* Decoded bytes are checked before they are ever sent */
+        stream->total += retval;
+        retval = image_check_feed(&stream->check, buff + held, retval) ?:
+                 retval + held;
+        if (retval < 0)
+            return retval;
+
+        /* A header goes out only once all of it has passed the checks */
+        if (stream->check.state == IMAGE_CHECK_HEAD) {
+            stream->held = stream->check.fill;
+            retval -= stream->held;
+            memcpy(stream->hold, buff + retval, stream->held);
+        }
+
+        if (retval)
+            return retval;
+    }
+}
+
+void
+stream_close(struct stream *stream)
+{
+    decoder_release(stream);
+
+    if (stream->fd > STDERR_FILENO)
+        close(stream->fd);
+    free(stream);
+}
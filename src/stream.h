@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <bfdev.h>
+#include <image.h>
+
+#define STREAM_INBUF (16 * 1024)
+#define STREAM_SNIFF 6
+
+enum stream_format {
+    STREAM_PLAIN = 0,
+    STREAM_GZIP,
+    STREAM_XZ,
+    STREAM_ZSTD,
+};
+
+struct stream {
+    int fd;
+    enum stream_format format;
+    struct image_check check;
+    void *decoder;
+    bool finished;
+    size_t total;
+
+    /* Start of a header not yet complete, kept back from the wire */
+    uint8_t hold[sizeof(struct image_header)];
+    unsigned int held;
+
+    uint8_t inbuf[STREAM_INBUF];
+    size_t inpos;
+    size_t inlen;
+    bool eof;
+};
+
+extern enum stream_format
+stream_sniff(const void *data, size_t len);
+
+extern int
+stream_open(struct stream **streamp, int fd);
+
+extern int
+stream_read(struct stream *stream, void *buff, unsigned int len);
+
+extern void
+stream_close(struct stream *stream);
+
+#endif /* _STREAM_H_ */
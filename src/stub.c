@@ -0,0 +1,547 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <stub.h>
+#include <w80xprog.h>
+#include <w80xhw.h>
+#include <image.h>
+#include <term.h>
+#include <timeout.h>
+#include <progress.h>
+#include <logger.h>
+
+struct stub_source {
+    struct spinor_source source;
+    const uint8_t *data;
+    size_t pos;
+};
+
+static const char *
+stub_status_info[] = {
+    [STUB_OK] = "Operation complete",
+    [STUB_EFRAME] = "Bad frame",
+    [STUB_ECMD] = "Unknown command",
+    [STUB_EADDR] = "Bad address",
+    [STUB_EZIP] = "Bad compressed payload",
+    [STUB_EFLASH] = "Flash operation failed",
+};
+
+static uint8_t
+stub_txbuf[sizeof(struct stub_head) + STUB_FRAME_MAX];
+
+static uint8_t
+stub_rxbuf[sizeof(struct stub_head) + STUB_FRAME_MAX];
+
+static uint8_t
+stub_zipbuf[STUB_FRAME_MAX];
+
+static unsigned int
+stub_data = STUB_DATA_MAX;
+
+static int
+stub_recv(uint8_t cmd, unsigned int *length, double deadline)
+{
+    struct stub_head *head;
+    int retval;
+
+    head = (void *)stub_rxbuf;
+    do {
+        retval = term_recv(&head->sign, 1, deadline);
+        if (retval)
+            return retval;
+    } while (head->sign != STUB_SIGN);
+
+    retval = term_recv(&head->cmd, sizeof(*head) - 1, deadline);
+    if (retval)
+        return retval;
+
+    *length = bfdev_le16_to_cpu(head->length);
+    if (head->cmd != (cmd | STUB_REPLY) || !*length ||
+        *length > STUB_FRAME_MAX)
+        return -BFDEV_EBADMSG;
+
+    retval = term_recv(head + 1, *length, deadline);
+    if (retval)
+        return retval;
+
+    if (bfdev_le32_to_cpu(head->crc) != stub_crc(head, head + 1))
+        return -BFDEV_EBADMSG;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+stub_transfer(uint8_t cmd, const void *param, unsigned int plen,
+              const void *data, unsigned int dlen, void *reply,
+              unsigned int rlen, unsigned int units, unsigned int retry)
+{
+    struct stub_head *head;
+    enum timeout_class class;
+    unsigned int length, total, attempt;
+    double start, deadline;
+    uint8_t status;
+    int retval;
+
+    head = (void *)stub_txbuf;
+    head->sign = STUB_SIGN;
+    head->cmd = cmd;
+    head->length = bfdev_cpu_to_le16(plen + dlen);
+    if (plen)
+        memcpy(head + 1, param, plen);
+    if (dlen)
+        memcpy((void *)(head + 1) + plen, data, dlen);
+    head->crc = bfdev_cpu_to_le32(stub_crc(head, head + 1));
+
+    total = sizeof(*head) * 2 + plen + dlen + 1 + rlen;
+    class = units ? TIMEOUT_ERASE : TIMEOUT_LINK;
+
+    for (length = attempt = 0; attempt < retry; ++attempt) {
+        start = timeout_now();
+        retval = term_command(stub_txbuf, sizeof(*head) + plen + dlen);
+        if (retval < 0)
+            return retval;
+
+        deadline = timeout_deadline(class, total, units);
+        retval = stub_recv(cmd, &length, deadline);
+        if (retval == -BFDEV_ETIMEDOUT) {
+            timeout_backoff(class);
+            continue;
+        } else if (retval == -BFDEV_EBADMSG) {
+            logger_printf(LOGGER_DEBUG, "\tStub: corrupt reply to %#04x\n",
+                          cmd);
+            continue;
+        } else if (retval)
+            return retval;
+
+        /* The stub rejects damaged requests the same way */
+        status = stub_rxbuf[sizeof(*head)];
+        if (status == STUB_EFRAME)
+            continue;
+
+        /* Karn: only unambiguous first answers feed the estimator */
+        if (!attempt)
+            timeout_sample(class, start, total, units);
+
+        if (status != STUB_OK) {
+            logger_printf(LOGGER_ERR, "\tStub: [%#04x]: %s\n", status,
+                          status < BFDEV_ARRAY_SIZE(stub_status_info) ?
+                          stub_status_info[status] : "Unknown error");
+            return -BFDEV_ECONNABORTED;
+        }
+
+        if (length - 1 != rlen)
+            return -BFDEV_EBADMSG;
+
+        if (rlen)
+            memcpy(reply, stub_rxbuf + sizeof(*head) + 1, rlen);
+        return -BFDEV_ENOERR;
+    }
+
+    return length ? -BFDEV_EBADMSG : -BFDEV_ETIMEDOUT;
+}
+
+static int
+stub_sync(struct stub_sync *sync, unsigned int retry)
+{
+    int retval;
+
+    retval = stub_transfer(STUB_SYNC, NULL, 0, NULL, 0, &sync->version,
+                           sizeof(*sync) - 1, 0, retry);
+    if (retval)
+        return retval;
+
+    if (sync->version != STUB_VERSION)
+        return -BFDEV_EPROTO;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+stub_hash(uint32_t addr, unsigned int count,
+          uint8_t (*digest)[SHA256_DIGEST_SIZE])
+{
+    struct stub_range range;
+
+    range.addr = bfdev_cpu_to_le32(addr);
+    range.size = bfdev_cpu_to_le32(count * SPINOR_SECTOR_SIZE);
+
+    return stub_transfer(STUB_HASH, &range, sizeof(range), NULL, 0, digest,
+                         count * SHA256_DIGEST_SIZE, 0, STUB_RETRANS);
+}
+
+static int
+stub_read(uint32_t addr, uint8_t *buff, unsigned int len)
+{
+    struct stub_range range;
+    unsigned int xfer;
+    int retval;
+
+    for (; len; len -= xfer) {
+        xfer = bfdev_min(len, stub_data);
+        range.addr = bfdev_cpu_to_le32(addr);
+        range.size = bfdev_cpu_to_le32(xfer);
+
+        retval = stub_transfer(STUB_READ, &range, sizeof(range), NULL, 0,
+                               buff, xfer, 0, STUB_RETRANS);
+        if (retval)
+            return retval;
+
+        addr += xfer;
+        buff += xfer;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+stub_write(uint32_t addr, const uint8_t *data, unsigned int len,
+           struct stub_stat *stat)
+{
+    struct stub_range range;
+    unsigned int xfer, units;
+    uLongf zlen;
+    int retval;
+
+    for (; len; len -= xfer) {
+        xfer = bfdev_min(len, stub_data);
+        units = BFDEV_DIV_ROUND_UP(xfer, SPINOR_SECTOR_SIZE);
+        range.addr = bfdev_cpu_to_le32(addr);
+        range.size = bfdev_cpu_to_le32(xfer);
+
+        /* Only worth it when the frame actually gets smaller */
+        zlen = sizeof(stub_zipbuf);
+        if (compress2(stub_zipbuf, &zlen, data, xfer, Z_BEST_SPEED) == Z_OK &&
+            zlen < xfer) {
+            retval = stub_transfer(STUB_WRITE_ZIP, &range, sizeof(range),
+                                   stub_zipbuf, zlen, NULL, 0, units,
+                                   STUB_RETRANS);
+        } else {
+            zlen = xfer;
+            retval = stub_transfer(STUB_WRITE, &range, sizeof(range),
+                                   data, xfer, NULL, 0, units, STUB_RETRANS);
+        }
+
+        if (retval)
+            return retval;
+
+        stat->raw += xfer;
+        stat->wire += zlen;
+        addr += xfer;
+        data += xfer;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+stub_source_read(struct spinor_source *source, void *buff, unsigned int len)
+{
+    struct stub_source *stub;
+    unsigned int xfer;
+
+    stub = bfdev_container_of(source, struct stub_source, source);
+    xfer = bfdev_min(len, source->size - stub->pos);
+    memcpy(buff, stub->data + stub->pos, xfer);
+    stub->pos += xfer;
+
+    return xfer;
+}
+
+static int
+stub_upload(const char *path)
+{
+    struct stub_source stub;
+    struct stat stat;
+    void *map;
+    int fd, retval;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -BFDEV_ENOENT;
+
+    if (fstat(fd, &stat) || !stat.st_size) {
+        close(fd);
+        return -BFDEV_EINVAL;
+    }
+
+    map = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -BFDEV_ENOMEM;
+
+    /* The stub goes through secboot like any other image */
+    retval = image_validate(map, stat.st_size);
+    if (!retval) {
+        stub.source.read = stub_source_read;
+        stub.source.size = stat.st_size;
+        stub.data = map;
+        stub.pos = 0;
+        retval = spinor_flash(&stub.source, NULL, NULL);
+    }
+
+    munmap(map, stat.st_size);
+    return retval;
+}
+
+int
+stub_attach(const char *path, unsigned int *fid, size_t *capacity,
+            char *mac)
+{
+    struct stub_sync sync;
+    double start, deadline;
+    int retval;
+
+    bfdev_log_info("Stub attach:\n");
+
+    /* A stub left running by an earlier session answers right away */
+    retval = stub_sync(&sync, 1);
+    if (retval) {
+        retval = stub_upload(path);
+        if (retval)
+            return retval;
+
+        start = timeout_now();
+        deadline = start + STUB_BOOT / 1000.0;
+
+        do
+            retval = stub_sync(&sync, 1);
+        while (retval == -BFDEV_ETIMEDOUT && timeout_now() < deadline);
+
+        if (retval)
+            return retval;
+
+        bfdev_log_info("\tStub booted in %.3fs\n", timeout_now() - start);
+    }
+
+    stub_data = bfdev_min(bfdev_le16_to_cpu(sync.frame), STUB_DATA_MAX);
+    stub_data -= stub_data % SPINOR_SECTOR_SIZE;
+    if (!stub_data)
+        return -BFDEV_EPROTO;
+
+    *fid = bfdev_le32_to_cpu(sync.fid);
+    *capacity = bfdev_le32_to_cpu(sync.capacity);
+    snprintf(mac, ETH_STR_ALEN, "%02x:%02x:%02x:%02x:%02x:%02x",
+             sync.wmac[0], sync.wmac[1], sync.wmac[2],
+             sync.wmac[3], sync.wmac[4], sync.wmac[5]);
+    bfdev_log_info("\tVersion: %u, frame %u bytes, flash %zu KiB\n",
+                   sync.version, stub_data, *capacity / 1024);
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+stub_region_cmp(const void *a, const void *b)
+{
+    const struct stub_region *ra = a, *rb = b;
+
+    return (ra->addr > rb->addr) - (ra->addr < rb->addr);
+}
+
+static void
+stub_overlay(const struct stub_region *regions, unsigned int count,
+             uint32_t base, unsigned int sectors, uint8_t *buff,
+             unsigned int *covered)
+{
+    uint32_t start, end, walk, limit, xfer;
+    unsigned int index;
+
+    end = base + sectors * SPINOR_SECTOR_SIZE;
+    for (index = 0; index < count; ++index) {
+        start = bfdev_max(regions[index].addr, base);
+        limit = bfdev_min(regions[index].addr + regions[index].len, end);
+
+        for (walk = start; walk < limit; walk += xfer) {
+            xfer = bfdev_min(limit - walk, SPINOR_SECTOR_SIZE -
+                             (walk - base) % SPINOR_SECTOR_SIZE);
+            if (buff)
+                memcpy(buff + (walk - base), regions[index].data +
+                       (walk - regions[index].addr), xfer);
+            if (covered)
+                covered[(walk - base) / SPINOR_SECTOR_SIZE] += xfer;
+        }
+    }
+}
+
+static int
+stub_batch(const struct stub_region *regions, unsigned int count,
+           uint32_t base, unsigned int sectors, uint8_t *buff,
+           struct stub_stat *stat)
+{
+    uint8_t digest[STUB_HASH_MAX][SHA256_DIGEST_SIZE];
+    uint8_t expect[SHA256_DIGEST_SIZE];
+    unsigned int covered[STUB_HASH_MAX];
+    bool dirty[STUB_HASH_MAX];
+    struct sha256_ctx ctx;
+    unsigned int index, first, stale;
+    int retval;
+
+    memset(covered, 0, sizeof(covered));
+    stale = 0;
+    stub_overlay(regions, count, base, sectors, NULL, covered);
+
+    /* Bytes the images do not cover must survive, so read them back */
+    for (index = 0; index < sectors; ++index) {
+        if (covered[index] == SPINOR_SECTOR_SIZE)
+            continue;
+
+        retval = stub_read(base + index * SPINOR_SECTOR_SIZE,
+                           buff + index * SPINOR_SECTOR_SIZE,
+                           SPINOR_SECTOR_SIZE);
+        if (retval)
+            return retval;
+
+        stat->readback++;
+    }
+
+    stub_overlay(regions, count, base, sectors, buff, NULL);
+    retval = stub_hash(base, sectors, digest);
+    if (retval)
+        return retval;
+
+    for (index = 0; index < sectors; ++index) {
+        sha256_init(&ctx);
+        sha256_update(&ctx, buff + index * SPINOR_SECTOR_SIZE,
+                      SPINOR_SECTOR_SIZE);
+        sha256_final(&ctx, expect);
+
+        dirty[index] = !!memcmp(expect, digest[index], sizeof(expect));
+        stale += dirty[index];
+    }
+
+    /* Consecutive stale sectors go out as one run of frames */
+    for (index = 0; index < sectors; ++index) {
+        if (!dirty[index])
+            continue;
+
+        for (first = index; index < sectors && dirty[index]; ++index);
+        retval = stub_write(base + first * SPINOR_SECTOR_SIZE,
+                            buff + first * SPINOR_SECTOR_SIZE,
+                            (index - first) * SPINOR_SECTOR_SIZE, stat);
+        if (retval)
+            return retval;
+
+    }
+
+    stat->skipped += sectors - stale;
+    stat->written += stale;
+
+    if (!stale)
+        return -BFDEV_ENOERR;
+
+    /* Read the hashes again to prove what was written */
+    retval = stub_hash(base, sectors, digest);
+    if (retval)
+        return retval;
+
+    for (index = 0; index < sectors; ++index) {
+        if (!dirty[index])
+            continue;
+
+        sha256_init(&ctx);
+        sha256_update(&ctx, buff + index * SPINOR_SECTOR_SIZE,
+                      SPINOR_SECTOR_SIZE);
+        sha256_final(&ctx, expect);
+
+        if (memcmp(expect, digest[index], sizeof(expect))) {
+            logger_printf(LOGGER_ERR, "\tStub: verify failed at %#010x\n",
+                          base + index * SPINOR_SECTOR_SIZE);
+            return -BFDEV_EIO;
+        }
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+int
+stub_program(const struct stub_region *regions, unsigned int count,
+             struct stub_stat *stat)
+{
+    struct stub_region *sorted;
+    struct progress prog;
+    uint32_t sector, last, next = 0;
+    unsigned int index, sectors;
+    double start, elapsed;
+    uint8_t *buff;
+    size_t total;
+    int retval;
+
+    sorted = malloc(sizeof(*sorted) * count);
+    buff = malloc(STUB_HASH_MAX * SPINOR_SECTOR_SIZE);
+    if (!sorted || !buff) {
+        free(sorted);
+        free(buff);
+        return -BFDEV_ENOMEM;
+    }
+
+    memcpy(sorted, regions, sizeof(*sorted) * count);
+    qsort(sorted, count, sizeof(*sorted), stub_region_cmp);
+    memset(stat, 0, sizeof(*stat));
+
+    for (total = index = 0; index < count; ++index)
+        total += sorted[index].len;
+
+    bfdev_log_info("Stub program:\n");
+    progress_init(&prog, total);
+    start = timeout_now();
+    retval = -BFDEV_ENOERR;
+    logger_hot(true);
+
+    /* Walk the touched sectors in batches of one hash query each */
+    for (index = 0; index < count && !retval; ++index) {
+        if (!sorted[index].len)
+            continue;
+
+        sector = sorted[index].addr / SPINOR_SECTOR_SIZE;
+        last = (sorted[index].addr + sorted[index].len - 1) / SPINOR_SECTOR_SIZE;
+        if (sector * SPINOR_SECTOR_SIZE < next)
+            sector = next / SPINOR_SECTOR_SIZE;
+
+        for (; sector <= last; sector += sectors) {
+            sectors = bfdev_min(last - sector + 1, STUB_HASH_MAX);
+            retval = stub_batch(sorted, count, sector * SPINOR_SECTOR_SIZE,
+                                sectors, buff, stat);
+            if (retval)
+                break;
+
+            stat->sectors += sectors;
+        }
+
+        next = (last + 1) * SPINOR_SECTOR_SIZE;
+        progress_update(&prog, sorted[index].len);
+    }
+
+    logger_hot(false);
+    logger_printf(LOGGER_INFO, "\n");
+    free(sorted);
+    free(buff);
+
+    if (retval)
+        return retval;
+
+    elapsed = timeout_now() - start;
+    bfdev_log_info("\t%u sectors: %u unchanged, %u written, %u read back\n",
+                   stat->sectors, stat->skipped, stat->written, stat->readback);
+    bfdev_log_info("\t%zu bytes written as %zu on the wire, %.3fs\n",
+                   stat->raw, stat->wire, elapsed);
+
+    return -BFDEV_ENOERR;
+}
+
+int
+stub_reset(void)
+{
+    bfdev_log_info("Chip reset...\n");
+    return stub_transfer(STUB_RESET, NULL, 0, NULL, 0, NULL, 0, 0,
+                         STUB_RETRANS);
+}
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _STUB_H_
+#define _STUB_H_
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <bfdev.h>
+#include <sha256.h>
+
+/*
+ * Framed protocol spoken by the RAM flasher stub once secboot has
+ * handed over control, see doc/stub-protocol.md.
+ */
+#define STUB_SIGN 0xa5
+#define STUB_VERSION 2
+#define STUB_REPLY 0x80
+#define STUB_DATA_MAX (16 * 1024)
+#define STUB_FRAME_MAX (STUB_DATA_MAX + 64)
+#define STUB_HASH_MAX 64
+
+enum stub_command {
+    STUB_SYNC       = 0x01, /* Handshake and limits */
+    STUB_ERASE      = 0x02, /* Erase whole sectors */
+    STUB_WRITE      = 0x03, /* Erase and program sectors */
+    STUB_WRITE_ZIP  = 0x04, /* Same with a zlib payload */
+    STUB_HASH       = 0x05, /* SHA-256 of each sector */
+    STUB_READ       = 0x06, /* Flash readback */
+    STUB_RESET      = 0x07, /* Reboot the chip */
+};
+
+enum stub_status {
+    STUB_OK         = 0x00,
+    STUB_EFRAME     = 0x01, /* Bad length or crc */
+    STUB_ECMD       = 0x02, /* Unknown command */
+    STUB_EADDR      = 0x03, /* Range outside the flash or misaligned */
+    STUB_EZIP       = 0x04, /* Payload does not inflate */
+    STUB_EFLASH     = 0x05, /* Erase or program failed */
+};
+
+struct stub_head {
+    uint8_t sign;
+    uint8_t cmd;
+    bfdev_le16 length;
+    bfdev_le32 crc;
+} __bfdev_packed;
+
+struct stub_range {
+    bfdev_le32 addr;
+    bfdev_le32 size;
+} __bfdev_packed;
+
+struct stub_sync {
+    uint8_t status;
+    uint8_t version;
+    bfdev_le16 frame;
+    bfdev_le32 capacity;
+    bfdev_le32 fid;
+    uint8_t wmac[6];
+} __bfdev_packed;
+
+struct stub_region {
+    uint32_t addr;
+    uint32_t len;
+    const uint8_t *data;
+};
+
+struct stub_stat {
+    unsigned int sectors;
+    unsigned int skipped;
+    unsigned int written;
+    unsigned int readback;
+    size_t raw;
+    size_t wire;
+};
+
+static inline uint32_t
+stub_crc(const struct stub_head *head, const void *payload)
+{
+    uint32_t crc;
+
+    /* Covers the command and length, then the payload */
+    crc = bfdev_crc32(&head->cmd, 3, 0xffffffff);
+    return bfdev_crc32(payload, bfdev_le16_to_cpu(head->length), crc);
+}
+
+extern int
+stub_attach(const char *path, unsigned int *fid, size_t *capacity,
+            char *mac);
+
+extern int
+stub_program(const struct stub_region *regions, unsigned int count,
+             struct stub_stat *stat);
+
+extern int
+stub_reset(void);
+
+#endif /* _STUB_H_ */
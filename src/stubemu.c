@@ -0,0 +1,382 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <stubemu.h>
+#include <stub.h>
+#include <w80xhw.h>
+
+struct stubemu {
+    int master;
+    uint8_t *flash;
+    size_t capacity;
+    unsigned long frames;
+    uint8_t rxbuf[sizeof(struct stub_head) + STUB_FRAME_MAX];
+    uint8_t txbuf[sizeof(struct stub_head) + STUB_FRAME_MAX];
+    uint8_t zipbuf[STUB_DATA_MAX];
+};
+
+static const struct option
+options[] = {
+    {"help",     no_argument,       0, 'h'},
+    {"capacity", required_argument, 0, 'c'},
+    {"verbose",  no_argument,       0, 'v'},
+    { }, /* NULL */
+};
+
+static __bfdev_noreturn void
+usage(void)
+{
+    bfdev_log_err("Usage: w80xprog stub-emu [options] <flash-file>\n");
+    bfdev_log_err("\t-h, --help                display this message\n");
+    bfdev_log_err("\t-c, --capacity <bytes>    emulated flash size\n");
+    bfdev_log_err("\t-v, --verbose             print every frame\n");
+    exit(1);
+}
+
+static int
+emu_read(struct stubemu *emu, void *buff, size_t len)
+{
+    ssize_t retval;
+    size_t done;
+
+    for (done = 0; done < len; done += retval) {
+        retval = read(emu->master, buff + done, len - done);
+        if (retval <= 0)
+            return -BFDEV_EIO;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+emu_reply(struct stubemu *emu, uint8_t cmd, uint8_t status,
+          const void *data, size_t len)
+{
+    struct stub_head *head;
+
+    head = (void *)emu->txbuf;
+    head->sign = STUB_SIGN;
+    head->cmd = cmd | STUB_REPLY;
+    head->length = bfdev_cpu_to_le16(len + 1);
+    emu->txbuf[sizeof(*head)] = status;
+    if (len)
+        memmove(emu->txbuf + sizeof(*head) + 1, data, len);
+    head->crc = bfdev_cpu_to_le32(stub_crc(head, head + 1));
+
+    if (write(emu->master, emu->txbuf, sizeof(*head) + len + 1) < 0)
+        return -BFDEV_EIO;
+
+    return -BFDEV_ENOERR;
+}
+
+static uint8_t
+emu_range(struct stubemu *emu, const struct stub_range *range,
+          size_t *offset, size_t *size, bool sector)
+{
+    uint32_t addr;
+
+    addr = bfdev_le32_to_cpu(range->addr);
+    *size = bfdev_le32_to_cpu(range->size);
+
+    if (addr < SPINOR_BASE)
+        return STUB_EADDR;
+
+    *offset = addr - SPINOR_BASE;
+    if (*offset > emu->capacity || *size > emu->capacity - *offset)
+        return STUB_EADDR;
+
+    if (sector && *offset % SPINOR_SECTOR_SIZE)
+        return STUB_EADDR;
+
+    return STUB_OK;
+}
+
+static uint8_t
+emu_program(struct stubemu *emu, size_t offset, const uint8_t *data,
+            size_t size)
+{
+    size_t erase, index;
+
+    /* Erase every touched sector, then program like NOR: bits only clear */
+    erase = BFDEV_ALIGN(size, SPINOR_SECTOR_SIZE);
+    if (erase > emu->capacity - offset)
+        return STUB_EADDR;
+
+    memset(emu->flash + offset, 0xff, erase);
+    for (index = 0; index < size; ++index)
+        emu->flash[offset + index] &= data[index];
+
+    return STUB_OK;
+}
+
+static int
+emu_command(struct stubemu *emu, uint8_t cmd, const uint8_t *payload,
+            size_t length)
+{
+    static const uint8_t wmac[] = STUBEMU_WMAC;
+    const struct stub_range *range;
+    uint8_t digest[STUB_HASH_MAX][SHA256_DIGEST_SIZE];
+    struct stub_sync sync;
+    struct sha256_ctx ctx;
+    size_t offset, size, index;
+    unsigned int density;
+    uLongf zlen;
+    uint8_t status;
+
+    range = (const void *)payload;
+    if (cmd != STUB_SYNC && cmd != STUB_RESET && length < sizeof(*range))
+        return emu_reply(emu, cmd, STUB_EFRAME, NULL, 0);
+
+    switch (cmd) {
+        case STUB_SYNC:
+            sync.version = STUB_VERSION;
+            sync.frame = bfdev_cpu_to_le16(STUB_DATA_MAX);
+            sync.capacity = bfdev_cpu_to_le32(emu->capacity);
+
+            /* JEDEC density of the smallest part that holds the flash */
+            for (density = 0; ((size_t)1 << density) < emu->capacity; ++density)
+                ;
+            sync.fid = bfdev_cpu_to_le32(STUBEMU_VENDOR << 8 | density);
+            memcpy(sync.wmac, wmac, sizeof(sync.wmac));
+            return emu_reply(emu, cmd, STUB_OK, &sync.version,
+                             sizeof(sync) - 1);
+
+        case STUB_ERASE:
+            status = emu_range(emu, range, &offset, &size, true);
+            if (status == STUB_OK && size % SPINOR_SECTOR_SIZE)
+                status = STUB_EADDR;
+            if (status == STUB_OK)
+                memset(emu->flash + offset, 0xff, size);
+            return emu_reply(emu, cmd, status, NULL, 0);
+
+        case STUB_WRITE:
+            status = emu_range(emu, range, &offset, &size, true);
+            if (status == STUB_OK && size != length - sizeof(*range))
+                status = STUB_EFRAME;
+            if (status == STUB_OK)
+                status = emu_program(emu, offset, payload + sizeof(*range), size);
+            return emu_reply(emu, cmd, status, NULL, 0);
+
+        case STUB_WRITE_ZIP:
+            status = emu_range(emu, range, &offset, &size, true);
+            if (status == STUB_OK && size > STUB_DATA_MAX)
+                status = STUB_EFRAME;
+
+            zlen = size;
+            if (status == STUB_OK && (uncompress(emu->zipbuf, &zlen,
+                payload + sizeof(*range), length - sizeof(*range)) != Z_OK ||
+                zlen != size))
+                status = STUB_EZIP;
+
+            if (status == STUB_OK)
+                status = emu_program(emu, offset, emu->zipbuf, size);
+            return emu_reply(emu, cmd, status, NULL, 0);
+
+        case STUB_HASH:
+            status = emu_range(emu, range, &offset, &size, true);
+            if (status == STUB_OK && (size % SPINOR_SECTOR_SIZE ||
+                size > STUB_HASH_MAX * SPINOR_SECTOR_SIZE))
+                status = STUB_EADDR;
+            if (status != STUB_OK)
+                return emu_reply(emu, cmd, status, NULL, 0);
+
+            for (index = 0; index < size / SPINOR_SECTOR_SIZE; ++index) {
+                sha256_init(&ctx);
+                sha256_update(&ctx, emu->flash + offset +
+                              index * SPINOR_SECTOR_SIZE, SPINOR_SECTOR_SIZE);
+                sha256_final(&ctx, digest[index]);
+            }
+
+            return emu_reply(emu, cmd, STUB_OK, digest,
+                             index * SHA256_DIGEST_SIZE);
+
+        case STUB_READ:
+            status = emu_range(emu, range, &offset, &size, false);
+            if (status == STUB_OK && size > STUB_DATA_MAX)
+                status = STUB_EADDR;
+            if (status != STUB_OK)
+                return emu_reply(emu, cmd, status, NULL, 0);
+
+            return emu_reply(emu, cmd, STUB_OK, emu->flash + offset, size);
+
+        case STUB_RESET:
+            bfdev_log_info("\tReset after %lu frames\n", emu->frames);
+            msync(emu->flash, emu->capacity, MS_SYNC);
+            return emu_reply(emu, cmd, STUB_OK, NULL, 0);
+
+        default:
+            return emu_reply(emu, cmd, STUB_ECMD, NULL, 0);
+    }
+}
+
+static int
+emu_serve(struct stubemu *emu)
+{
+    struct stub_head *head;
+    size_t length;
+    int retval;
+
+    head = (void *)emu->rxbuf;
+    for (;;) {
+        retval = emu_read(emu, &head->sign, 1);
+        if (retval)
+            return retval;
+
+        if (head->sign != STUB_SIGN)
+            continue;
+
+        retval = emu_read(emu, &head->cmd, sizeof(*head) - 1);
+        if (retval)
+            return retval;
+
+        length = bfdev_le16_to_cpu(head->length);
+        if (length > STUB_FRAME_MAX) {
+            emu_reply(emu, head->cmd, STUB_EFRAME, NULL, 0);
+            continue;
+        }
+
+        retval = emu_read(emu, head + 1, length);
+        if (retval)
+            return retval;
+
+        emu->frames++;
+        bfdev_log_debug("\tframe %#04x, %zu bytes\n", head->cmd, length);
+
+        if (bfdev_le32_to_cpu(head->crc) != stub_crc(head, head + 1))
+            retval = emu_reply(emu, head->cmd, STUB_EFRAME, NULL, 0);
+        else
+            retval = emu_command(emu, head->cmd, (void *)(head + 1), length);
+
+        if (retval)
+            return retval;
+    }
+}
+
+static int
+emu_flash(struct stubemu *emu, const char *path)
+{
+    struct stat stat;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -BFDEV_ENOENT;
+
+    if (fstat(fd, &stat) || ftruncate(fd, emu->capacity)) {
+        close(fd);
+        return -BFDEV_EIO;
+    }
+
+    map = mmap(NULL, emu->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -BFDEV_ENOMEM;
+
+    /* A fresh backing file starts out as erased flash */
+    if ((size_t)stat.st_size < emu->capacity)
+        memset(map + stat.st_size, 0xff, emu->capacity - stat.st_size);
+
+    emu->flash = map;
+    return -BFDEV_ENOERR;
+}
+
+static int
+emu_open(struct stubemu *emu, int *slave)
+{
+    struct termios term;
+    const char *name;
+
+    emu->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (emu->master < 0)
+        return -BFDEV_ENODEV;
+
+    if (grantpt(emu->master) || unlockpt(emu->master))
+        return -BFDEV_ENODEV;
+
+    name = ptsname(emu->master);
+    if (!name)
+        return -BFDEV_ENODEV;
+
+    /* Holding the slave open keeps the master alive between sessions */
+    *slave = open(name, O_RDWR | O_NOCTTY);
+    if (*slave < 0)
+        return -BFDEV_ENODEV;
+
+    tcgetattr(*slave, &term);
+    cfmakeraw(&term);
+    tcsetattr(*slave, TCSANOW, &term);
+
+    bfdev_log_info("Stub emulator on %s\n", name);
+    return -BFDEV_ENOERR;
+}
+
+int
+stubemu_main(int argc, char *const argv[])
+{
+    struct stubemu *emu;
+    const char *errname;
+    int optidx, retval, slave;
+    size_t capacity;
+    char arg;
+
+    capacity = STUBEMU_CAPACITY;
+    for (;;) {
+        arg = getopt_long(argc, argv, "c:vh", options, &optidx);
+        if (arg == -1)
+            break;
+
+        switch (arg) {
+            case 'c':
+                capacity = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'v':
+                bfdev_log_default.record_level = BFDEV_LEVEL_DEBUG;
+                break;
+
+            case 'h': default:
+                usage();
+        }
+    }
+
+    if (argc - optind != 1 || !capacity || capacity % SPINOR_SECTOR_SIZE)
+        usage();
+
+    emu = malloc(sizeof(*emu));
+    if (!emu)
+        return -BFDEV_ENOMEM;
+
+    memset(emu, 0, sizeof(*emu));
+    emu->capacity = capacity;
+
+    retval = emu_flash(emu, argv[optind]);
+    if (!retval)
+        retval = emu_open(emu, &slave);
+    if (!retval) {
+        fflush(stdout);
+        retval = emu_serve(emu);
+    }
+
+    bfdev_errname(retval, &errname);
+    bfdev_log_err("Stub emulator stopped: %s\n", errname);
+
+    if (emu->flash)
+        munmap(emu->flash, emu->capacity);
+    free(emu);
+
+    return retval;
+}
@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _STUBEMU_H_
+#define _STUBEMU_H_
+
+#include <config.h>
+#include <errno.h>
+#include <bfdev.h>
+
+#define STUBEMU_CAPACITY (2 * 1024 * 1024)
+#define STUBEMU_VENDOR 0xc8
+#define STUBEMU_WMAC {0x01, 0x23, 0x45, 0x67, 0x89, 0xab}
+
+extern int
+stubemu_main(int argc, char *const argv[]);
+
+#endif /* _STUBEMU_H_ */
@@ -3,13 +3,47 @@
  * Copyright(c) 2021 John Sanpe <sanpeqf@gmail.com>
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <signal.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <term.h>
+#include <timeout.h>
+#include <logger.h>
 
-static int ttys;
+static struct term_port *tport;
+static volatile sig_atomic_t tcancel;
+static volatile double tcancel_time;
+
+void
+term_cancel(void)
+{
+    /* Called from signal handlers, only async-signal-safe work here */
+    if (!tcancel)
+        tcancel_time = timeout_now();
+    tcancel = 1;
+}
+
+bool
+term_cancelled(double *since)
+{
+    if (tcancel && since)
+        *since = tcancel_time;
+
+    return tcancel;
+}
+
+void
+term_resume(void)
+{
+    tcancel = 0;
+}
 
 int
 term_setspeed(unsigned int speed)
@@ -17,7 +51,7 @@ term_setspeed(unsigned int speed)
     struct termios term;
     int retval;
 
-    retval = tcgetattr(ttys, &term);
+    retval = tcgetattr(tport->fd, &term);
     if (retval)
         return retval;
 
@@ -25,17 +59,26 @@ term_setspeed(unsigned int speed)
     if (retval)
         return retval;
 
-    retval = tcflush(ttys, TCIOFLUSH);
+    /* Bytes from the old speed are garbage at the new one */
+    tport->head = tport->tail = tport->mark = 0;
+    retval = tcflush(tport->fd, TCIOFLUSH);
     if (retval)
         return retval;
 
-    retval = tcsetattr(ttys, TCSANOW, &term);
+    retval = tcsetattr(tport->fd, TCSANOW, &term);
     if (retval)
         return retval;
 
+    tport->speed = speed;
     return 0;
 }
 
+unsigned int
+term_getspeed(void)
+{
+    return tport->speed;
+}
+
 int
 term_setup(unsigned int speed, int databits, int stopbits, char parity)
 {
@@ -46,7 +89,7 @@ term_setup(unsigned int speed, int databits, int stopbits, char parity)
     if (retval)
         return retval;
 
-    retval = tcgetattr(ttys, &term);
+    retval = tcgetattr(tport->fd, &term);
     if (retval)
         return retval;
 
@@ -95,11 +138,11 @@ term_setup(unsigned int speed, int databits, int stopbits, char parity)
     term.c_cc[VTIME] = 0;
     term.c_cc[VMIN] = 0;
 
-    retval = tcflush(ttys, TCIOFLUSH);
+    retval = tcflush(tport->fd, TCIOFLUSH);
     if (retval)
         return retval;
 
-    retval = tcsetattr(ttys, TCSANOW, &term);
+    retval = tcsetattr(tport->fd, TCSANOW, &term);
     if (retval)
         return retval;
 
@@ -112,7 +155,7 @@ term_reset(bool enable)
     unsigned int state;
     int retval;
 
-    retval = ioctl(ttys, TIOCMGET, &state);
+    retval = ioctl(tport->fd, TIOCMGET, &state);
     if (retval)
         return retval;
 
@@ -121,54 +164,337 @@ term_reset(bool enable)
     else
         state &= ~TIOCM_RTS;
 
-    retval = ioctl(ttys, TIOCMSET, &state);
+    retval = ioctl(tport->fd, TIOCMSET, &state);
     if (retval)
         return retval;
 
     return 0;
 }
 
+static int
+term_fill(void)
+{
+    struct term_port *port = tport;
+    int retval;
+
+    if (tcancel)
+        return -BFDEV_ECANCELED;
+
+    /* Keep what is left at the front, scans want it contiguous */
+    if (port->head) {
+        memmove(port->rx, port->rx + port->head, port->tail - port->head);
+        port->mark -= bfdev_min(port->mark, port->head);
+        port->tail -= port->head;
+        port->head = 0;
+    }
+
+    if (port->tail == TERM_RXBUF)
+        return 0;
+
+    /* One read takes all that arrived, not just what was asked for */
+    retval = read(port->fd, port->rx + port->tail, TERM_RXBUF - port->tail);
+    if (retval > 0)
+        port->tail += retval;
+
+    return retval;
+}
+
+static inline void
+term_skip(void)
+{
+    /* What came in before the last command write can not answer it */
+    if (tport->head < tport->mark)
+        tport->head = tport->mark;
+}
+
+static unsigned int
+term_take(void *data, size_t size)
+{
+    struct term_port *port = tport;
+    size_t xfer;
+
+    term_skip();
+    xfer = bfdev_min(size, port->tail - port->head);
+    memcpy(data, port->rx + port->head, xfer);
+    port->head += xfer;
+
+    return xfer;
+}
+
 int
 term_read(void *data, size_t size)
 {
-    return read(ttys, data, size);
+    int retval;
+
+    if (tcancel)
+        return -BFDEV_ECANCELED;
+
+    term_skip();
+    if (tport->head == tport->tail) {
+        retval = term_fill();
+        if (retval <= 0)
+            return retval;
+    }
+
+    return term_take(data, size);
+}
+
+int
+term_poll(int timeout)
+{
+    struct pollfd pfd;
+
+    pfd.fd = tport->fd;
+    pfd.events = POLLIN;
+
+    return poll(&pfd, 1, timeout);
+}
+
+int
+term_wait(double deadline)
+{
+    double remain;
+    int retval;
+
+    remain = deadline - timeout_now();
+    if (remain <= 0)
+        return -BFDEV_ETIMEDOUT;
+
+    retval = term_poll(remain * 1000 + 1);
+    if (tcancel)
+        return -BFDEV_ECANCELED;
+    else if (retval < 0)
+        return retval;
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+term_more(double deadline)
+{
+    int retval;
+
+    retval = term_fill();
+    if (retval)
+        return retval < 0 ? retval : -BFDEV_ENOERR;
+
+    return term_wait(deadline) ?: -BFDEV_EAGAIN;
+}
+
+int
+term_recv(void *buffer, unsigned int length, double deadline)
+{
+    unsigned int index;
+    int retval;
+
+    for (index = 0;;) {
+        index += term_take(buffer + index, length - index);
+        if (index == length)
+            return -BFDEV_ENOERR;
+
+        retval = term_more(deadline);
+        if (retval == -BFDEV_ETIMEDOUT) {
+            logger_printf(LOGGER_DEBUG, "\ttimeout: expired with "
+                          "%u/%u bytes\n", index, length);
+            return retval;
+        } else if (retval && retval != -BFDEV_EAGAIN)
+            return retval;
+    }
+}
+
+static unsigned int
+term_rscan(uint8_t byte)
+{
+    struct term_port *port = tport;
+    unsigned int index;
+
+    /* Index just past the newest byte, zero when there is none */
+    for (index = port->tail; index > port->head; --index) {
+        if (port->rx[index - 1] == byte)
+            return index;
+    }
+
+    return 0;
+}
+
+int
+term_scan(uint8_t byte, double deadline)
+{
+    unsigned int found;
+    int retval;
+
+    for (;;) {
+        /* Prompts repeat while idle, only the newest one counts */
+        term_skip();
+        found = term_rscan(byte);
+        if (found) {
+            tport->head = found;
+            return -BFDEV_ENOERR;
+        }
+
+        /* Nothing in here is wanted, but a reply may follow it */
+        tport->head = tport->tail;
+
+        retval = term_more(deadline);
+        if (retval && retval != -BFDEV_EAGAIN)
+            return retval;
+    }
+}
+
+static unsigned int
+term_find(const char *prefix, unsigned int plen)
+{
+    struct term_port *port = tport;
+    unsigned int index, count;
+
+    /* Replies differ in case between ROM versions, "Mac:" or "MAC:" */
+    for (index = port->head; index + plen <= port->tail; ++index) {
+        for (count = 0; count < plen; ++count) {
+            if (tolower(port->rx[index + count]) != tolower(prefix[count]))
+                break;
+        }
+        if (count == plen)
+            return index;
+    }
+
+    return UINT_MAX;
+}
+
+int
+term_expect(const char *prefix, void *buffer, unsigned int length,
+            double deadline)
+{
+    struct term_port *port = tport;
+    unsigned int plen, found;
+    int retval;
+
+    plen = strlen(prefix);
+    BFDEV_BUG_ON(plen > length);
+
+    for (;;) {
+        term_skip();
+        found = term_find(prefix, plen);
+        if (found != UINT_MAX) {
+            /* Prompts, banner text and echoes ahead of the reply go */
+            port->head = found;
+            if (port->tail - port->head >= length) {
+                term_take(buffer, length);
+                return -BFDEV_ENOERR;
+            }
+        } else if (port->tail - port->head >= plen) {
+            /* Keep a tail that may be the start of the prefix */
+            port->head = port->tail - (plen - 1);
+        }
+
+        retval = term_more(deadline);
+        if (retval && retval != -BFDEV_EAGAIN)
+            return retval;
+    }
+}
+
+int
+term_mark(void)
+{
+    struct term_port *port = tport;
+    int retval;
+
+    /*
+     * Take in what the device sent so far without waiting. All of it
+     * predates the next write and is skipped by the reply readers, but
+     * nothing after it is lost the way a flush would lose it.
+     */
+    for (;;) {
+        if (port->tail == TERM_RXBUF)
+            port->head = port->tail = 0;
+
+        retval = term_fill();
+        if (retval <= 0)
+            break;
+    }
+
+    port->mark = port->tail;
+    return retval;
+}
+
+int
+term_command(const void *data, size_t size)
+{
+    int retval;
+
+    retval = term_mark();
+    if (retval < 0)
+        return retval;
+
+    return term_write(data, size);
 }
 
 int
 term_write(const void *data, size_t size)
 {
-    return write(ttys, data, size);
+    if (tcancel)
+        return -BFDEV_ECANCELED;
+
+    return write(tport->fd, data, size);
 }
 
 int
 term_print(const char *str)
 {
-    return write(ttys, str, strlen(str));
+    return write(tport->fd, str, strlen(str));
 }
 
-int term_flush(void)
+int
+term_drain(void)
 {
-    return tcflush(ttys, TCIFLUSH);
+    return tcdrain(tport->fd);
 }
 
 int
 term_open(const char *path)
 {
+    struct term_port *port;
     int retval;
 
-    ttys = open(path, O_RDWR | O_NOCTTY | O_NDELAY | O_SYNC);
-    if (ttys < 0)
-        return ttys;
+    port = calloc(1, sizeof(*port));
+    if (!port)
+        return -BFDEV_ENOMEM;
+
+    port->fd = open(path, O_RDWR | O_NOCTTY | O_NDELAY | O_SYNC);
+    if (port->fd < 0) {
+        free(port);
+        return -BFDEV_ENOENT;
+    }
 
-    retval = fcntl(ttys, F_SETFL, 0);
+    retval = fcntl(port->fd, F_SETFL, 0);
     if (retval < 0)
-        return retval;
+        goto failed;
+
+    /* Whatever path the process leaves by, hand the line back as found */
+    retval = tcgetattr(port->fd, &port->orig);
+    if (retval)
+        goto failed;
+
+    tport = port;
+    atexit(term_close);
 
     return 0;
+
+failed:
+    close(port->fd);
+    free(port);
+    return retval;
 }
 
 void
 term_close(void)
 {
-    close(ttys);
+    struct term_port *port = tport;
+
+    if (!port)
+        return;
+
+    tcsetattr(port->fd, TCSADRAIN, &port->orig);
+    close(port->fd);
+    free(port);
+    tport = NULL;
 }
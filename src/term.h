@@ -7,12 +7,44 @@
 #define _TERM_H_
 
 #include <config.h>
+#include <stdint.h>
 #include <errno.h>
+#include <termios.h>
 #include <bfdev.h>
 
+#define TERM_RXBUF 4096
+
+/*
+ * The port a process drives, with its receive ring. Bytes stay in the
+ * ring until consumed, and those in front of mark came in before the
+ * last command write.
+ */
+struct term_port {
+    int fd;
+    unsigned int speed;
+    struct termios orig;
+
+    uint8_t rx[TERM_RXBUF];
+    unsigned int head;
+    unsigned int tail;
+    unsigned int mark;
+};
+
+extern void
+term_cancel(void);
+
+extern bool
+term_cancelled(double *since);
+
+extern void
+term_resume(void);
+
 extern int
 term_setspeed(unsigned int speed);
 
+extern unsigned int
+term_getspeed(void);
+
 extern int
 term_setup(unsigned int speed, int databits, int stopbits, char parity);
 
@@ -22,6 +54,28 @@ term_reset(bool enable);
 extern int
 term_read(void *data, size_t len);
 
+extern int
+term_poll(int timeout);
+
+extern int
+term_wait(double deadline);
+
+extern int
+term_recv(void *buffer, unsigned int length, double deadline);
+
+extern int
+term_scan(uint8_t byte, double deadline);
+
+extern int
+term_expect(const char *prefix, void *buffer, unsigned int length,
+            double deadline);
+
+extern int
+term_mark(void);
+
+extern int
+term_command(const void *data, size_t len);
+
 extern int
 term_write(const void *data, size_t len);
 
@@ -29,7 +83,7 @@ extern int
 term_print(const char *str);
 
 extern int
-term_flush(void);
+term_drain(void);
 
 extern int
 term_open(const char *path);
@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <time.h>
+#include <timeout.h>
+#include <term.h>
+#include <logger.h>
+
+static const char *
+class_name[TIMEOUT_NR_CLASS] = {
+    [TIMEOUT_LINK] = "link",
+    [TIMEOUT_ERASE] = "erase",
+};
+
+static const unsigned int
+class_initial[TIMEOUT_NR_CLASS] = {
+    [TIMEOUT_LINK] = TIMEOUT_INITIAL,
+    [TIMEOUT_ERASE] = TIMEOUT_ERASE_SECTOR,
+};
+
+static struct timeout_rtt
+estimator[TIMEOUT_NR_CLASS];
+
+double
+timeout_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (double)ts.tv_nsec / 1000000000;
+}
+
+double
+timeout_wire(size_t bytes)
+{
+    unsigned int speed;
+
+    speed = term_getspeed();
+    if (!speed)
+        return 0;
+
+    /* One start bit, eight data bits and one stop bit */
+    return (double)bytes * 10 / speed;
+}
+
+static void
+rto_update(struct timeout_rtt *rtt)
+{
+    double rto;
+
+    /* Same shape as TCP: RTO = SRTT + max(G, 4 * RTTVAR) */
+    rto = rtt->srtt + bfdev_max(TIMEOUT_MIN / 1000.0, 4 * rtt->rttvar);
+    rto = bfdev_min(rto, TIMEOUT_MAX / 1000.0);
+    rtt->rto = rto;
+}
+
+double
+timeout_deadline(enum timeout_class class, size_t bytes, unsigned int units)
+{
+    double budget;
+
+    /*
+     * Every reply pays the wire time of the bytes in flight and one
+     * link turnaround, slow operations add their own per-unit budget.
+     */
+    budget = timeout_wire(bytes) + estimator[TIMEOUT_LINK].rto;
+    if (class != TIMEOUT_LINK) {
+        /* A few fast erases must not talk us out of a slow one */
+        budget += units * bfdev_max(estimator[class].rto,
+                                    TIMEOUT_ERASE_FLOOR / 1000.0);
+    }
+
+    logger_printf(LOGGER_DEBUG, "\ttimeout: %s deadline %.1fms "
+                  "(%zu bytes, %u units)\n", class_name[class],
+                  budget * 1000, bytes, units);
+
+    return timeout_now() + budget;
+}
+
+void
+timeout_sample(enum timeout_class class, double start,
+               size_t bytes, unsigned int units)
+{
+    struct timeout_rtt *rtt;
+    double sample, delta;
+
+    sample = timeout_now() - start - timeout_wire(bytes);
+    if (class != TIMEOUT_LINK) {
+        if (!units)
+            class = TIMEOUT_LINK;
+        else {
+            sample -= estimator[TIMEOUT_LINK].srtt;
+            sample /= units;
+        }
+    }
+
+    rtt = &estimator[class];
+    sample = bfdev_max(sample, 0);
+
+    if (!rtt->samples++) {
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
+    } else {
+        delta = rtt->srtt - sample;
+        if (delta < 0)
+            delta = -delta;
+
+        rtt->rttvar = 0.75 * rtt->rttvar + 0.25 * delta;
+        rtt->srtt = 0.875 * rtt->srtt + 0.125 * sample;
+    }
+
+    rto_update(rtt);
+    logger_printf(LOGGER_DEBUG, "\ttimeout: %s sample %.2fms, srtt %.2fms, "
+                  "rttvar %.2fms, rto %.1fms\n", class_name[class],
+                  sample * 1000, rtt->srtt * 1000, rtt->rttvar * 1000,
+                  rtt->rto * 1000);
+}
+
+int
+timeout_srtt(enum timeout_class class, double *srtt)
+{
+    if (!estimator[class].samples)
+        return -BFDEV_ENODATA;
+
+    *srtt = estimator[class].srtt;
+    return -BFDEV_ENOERR;
+}
+
+void
+timeout_seed(enum timeout_class class, double srtt)
+{
+    struct timeout_rtt *rtt;
+
+    /* A prior, not a sample, the first measurement still replaces it */
+    rtt = &estimator[class];
+    if (rtt->samples)
+        return;
+
+    rtt->srtt = srtt;
+    rtt->rttvar = srtt / 2;
+    rto_update(rtt);
+    logger_printf(LOGGER_DEBUG, "\ttimeout: %s seeded, srtt %.2fms, "
+                  "rto %.1fms\n", class_name[class], srtt * 1000,
+                  rtt->rto * 1000);
+}
+
+void
+timeout_backoff(enum timeout_class class)
+{
+    struct timeout_rtt *rtt;
+
+    rtt = &estimator[class];
+    rtt->rto = bfdev_min(rtt->rto * 2, TIMEOUT_MAX / 1000.0);
+    logger_printf(LOGGER_DEBUG, "\ttimeout: %s backoff, rto %.1fms\n",
+                  class_name[class], rtt->rto * 1000);
+}
+
+void
+timeout_init(void)
+{
+    unsigned int class;
+
+    for (class = 0; class < TIMEOUT_NR_CLASS; ++class) {
+        estimator[class].samples = 0;
+        estimator[class].srtt = 0;
+        estimator[class].rttvar = 0;
+        estimator[class].rto = class_initial[class] / 1000.0;
+    }
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _TIMEOUT_H_
+#define _TIMEOUT_H_
+
+#include <config.h>
+#include <stddef.h>
+#include <bfdev.h>
+
+enum timeout_class {
+    TIMEOUT_LINK = 0,   /* Turnaround of replies and acks */
+    TIMEOUT_ERASE,      /* Erase time of one flash sector */
+    TIMEOUT_NR_CLASS,
+};
+
+struct timeout_rtt {
+    double srtt;
+    double rttvar;
+    double rto;
+    unsigned int samples;
+};
+
+extern double
+timeout_now(void);
+
+extern double
+timeout_wire(size_t bytes);
+
+extern double
+timeout_deadline(enum timeout_class class, size_t bytes, unsigned int units);
+
+extern void
+timeout_sample(enum timeout_class class, double start,
+               size_t bytes, unsigned int units);
+
+extern int
+timeout_srtt(enum timeout_class class, double *srtt);
+
+extern void
+timeout_seed(enum timeout_class class, double srtt);
+
+extern void
+timeout_backoff(enum timeout_class class);
+
+extern void
+timeout_init(void);
+
+#endif /* _TIMEOUT_H_ */
@@ -15,6 +15,9 @@
 #define OPCODE_DATA(opcode) (((opcode) >> 0) & 0xff)
 #define OPCODE_LEN(opcode) (((opcode) >> 8) & 0xff)
 #define PAYLOAD_SIZE 1024
+#define SPINOR_SECTOR_SIZE 4096
+#define SPINOR_PAGE_SIZE 256
+#define SPINOR_BASE 0x08000000
 
 enum xmodem_types {
     XMODEM_SOH  = 0x02,
@@ -111,6 +114,35 @@ struct spinor_erase {
     bfdev_le16 count;
 } __bfdev_packed;
 
+#define IMAGE_MAGIC 0xa0ffff9f
+#define IMAGE_SIGN_SIZE 128
+
+#define IMAGE_ATTR_TYPE(attr) (((attr) >> 0) & 0x0f)
+#define IMAGE_ATTR_SIGN BFDEV_BIT(8)
+#define IMAGE_ATTR_ZIP BFDEV_BIT(16)
+
+enum image_types {
+    IMAGE_TYPE_SECBOOT  = 0x00, /* Secure boot loader */
+    IMAGE_TYPE_FLASHOS  = 0x01, /* Application run from flash */
+    IMAGE_TYPE_CPFT     = 0x02, /* Factory test firmware */
+    IMAGE_TYPE_USER     = 0x0e, /* User defined data */
+};
+
+struct image_header {
+    bfdev_le32 magic;
+    bfdev_le32 attr;
+    bfdev_le32 addr;
+    bfdev_le32 length;
+    bfdev_le32 header;
+    bfdev_le32 upgrade;
+    bfdev_le32 checksum;
+    bfdev_le32 updno;
+    uint8_t version[16];
+    bfdev_le32 reserved[2];
+    bfdev_le32 next;
+    bfdev_le32 hcrc;
+} __bfdev_packed;
+
 /* Secboot reply: "Secboot V0.0[\r\n]" */
 #define REPLY_SECBOOT_LEN 12
 
@@ -126,4 +158,7 @@ struct spinor_erase {
 /* Gain reply: "G:FFFFFFFF...[\n]" */
 #define REPLY_GAIN_LEN 96
 
+/* Error reply: "E:C[\n]" */
+#define REPLY_ERROR_LEN 3
+
 #endif  /* _W80XHW_H_ */
@@ -13,7 +13,12 @@
 #include <w80xprog.h>
 #include <w80xhw.h>
 #include <term.h>
+#include <timeout.h>
+#include <pipeline.h>
 #include <progress.h>
+#include <realtime.h>
+#include <board.h>
+#include <logger.h>
 
 struct status_info {
     char code;
@@ -71,7 +76,7 @@ error_table[] = {
     { }, /* NULL */
 };
 
-static const char *
+const char *
 status_info(char error)
 {
     unsigned int index;
@@ -140,178 +145,429 @@ atoh(const char *src, uint8_t *mac, unsigned int len)
 }
 
 static int
-wait_busy(void)
+wait_busy(unsigned int timeout)
 {
-    unsigned int count;
-    uint8_t value;
     int retval;
 
-    for (count = 0; count < WAIT_TIMES; ++count) {
-        retval = term_read(&value, 1);
-        if (retval < 0)
-            return retval;
+    /* A prompt already buffered counts, no need to wait for the next */
+    retval = term_scan(RETURN_NOMAL, timeout_now() + timeout / 1000.0);
+    if (retval == -BFDEV_ETIMEDOUT) {
+        bfdev_log_debug("\ttimeout: no prompt within %ums\n", timeout);
+        return -BFDEV_EBUSY;
+    }
 
-        BFDEV_BUG_ON(retval > 1);
-        if (retval && value == RETURN_NOMAL)
-            return -BFDEV_ENOERR;
+    return retval;
+}
 
-        /* Sending interval: 120ms */
-        usleep(120000);
-    }
+static unsigned int
+opcode_build(struct opcode_transfer *trans, enum opcode_types opcode,
+             const void *param)
+{
+    unsigned int psize;
+    uint16_t cksum;
+
+    trans->head.sign = 0x21;
+    trans->head.reserved = 0x00;
+    trans->head.length = OPCODE_LEN(opcode);
+    trans->content.opcode = bfdev_cpu_to_le32(OPCODE_DATA(opcode));
+
+    psize = OPCODE_LEN(opcode) - sizeof(trans->content);
+    if (psize)
+        memcpy(trans->content.param, param, psize);
+
+    /* Checksum should skip itself */
+    cksum = bfdev_crc_itut(&trans->content.opcode, OPCODE_LEN(opcode) - 2, 0xffff);
+    trans->content.checksum = bfdev_cpu_to_le16(cksum);
 
-    return -BFDEV_EBUSY;
+    return sizeof(struct opcode_head) + OPCODE_LEN(opcode);
 }
 
 static int
-wait_read(void *buffer, unsigned int length)
+opcode_transfer(enum opcode_types opcode, void *param, const char *prefix,
+                void *buffer, unsigned int length)
 {
-    unsigned int count, index;
+    uint8_t trans[BATCH_FRAME_MAX];
+    unsigned int tsize;
+    double start, deadline;
     int retval;
 
-    index = 0;
-    for (count = 0; count < WAIT_TIMES; ++count) {
-        retval = term_read(buffer + index, length - index);
-        if (retval < 0)
-            return retval;
+    retval = wait_busy(TIMEOUT_PROMPT);
+    if (retval)
+        return retval;
 
+    tsize = opcode_build((void *)trans, opcode, param);
+
+    /* A prompt that came in after the one above is not the reply */
+    start = timeout_now();
+    retval = term_command(trans, tsize);
+    if (retval < 0)
+        return retval;
+
+    /* Replies with text are found by their prefix, past any prompt */
+    if (buffer) {
+        deadline = timeout_deadline(TIMEOUT_LINK, tsize + length, 0);
+        if (prefix)
+            retval = term_expect(prefix, buffer, length, deadline);
+        else
+            retval = term_recv(buffer, length, deadline);
         if (retval) {
-            index += retval;
-            count = 0;
+            if (retval == -BFDEV_ETIMEDOUT)
+                timeout_backoff(TIMEOUT_LINK);
+            return retval;
         }
 
-        BFDEV_BUG_ON(index > length);
-        if (index == length)
-            return -BFDEV_ENOERR;
-
-        /* Sending interval: 100ms */
-        usleep(100000);
+        timeout_sample(TIMEOUT_LINK, start, tsize + length, 0);
     }
 
-    return -BFDEV_EBUSY;
+    return -BFDEV_ENOERR;
 }
 
+struct xmodem_flight {
+    double start;
+    unsigned int len;
+    unsigned int units;
+    bool resent;
+};
+
+static unsigned int
+xmodem_window = 1;
+
 static int
-opcode_transfer(enum opcode_types opcode, void *param,
-                void *buffer, unsigned int length)
+xmodem_drain(unsigned int pending)
 {
-    struct opcode_transfer *trans;
-    unsigned int tsize, psize;
-    uint16_t cksum;
+    double deadline;
+    uint8_t value;
     int retval;
 
-    tsize = sizeof(struct opcode_head) + OPCODE_LEN(opcode);
-    trans = malloc(tsize);
-    if (!trans)
-        return -BFDEV_ENOMEM;
+    /* Let the device answer what is still in flight, then forget it */
+    deadline = timeout_deadline(TIMEOUT_LINK, sizeof(struct xmodem_packet) *
+                                pending + 1, 0);
+    while (pending--) {
+        retval = term_recv(&value, 1, deadline);
+        if (retval == -BFDEV_ETIMEDOUT)
+            break;
+        else if (retval)
+            return retval;
 
-    term_flush();
-    retval = wait_busy();
-    if (retval)
-        return retval;
+        if (value == XMODEM_CAN)
+            return -BFDEV_ECANCELED;
+    }
 
-    trans->head.sign = 0x21;
-    trans->head.reserved = 0x00;
-    trans->head.length = OPCODE_LEN(opcode);
-    trans->content.opcode = bfdev_cpu_to_le32(OPCODE_DATA(opcode));
+    /* Answers still on their way are older than the resend */
+    return term_mark();
+}
 
-    psize = OPCODE_LEN(opcode) - sizeof(trans->content);
-    if (psize)
-        memcpy(trans->content.param, param, psize);
+static double
+xmodem_grace(enum timeout_class class, unsigned int units)
+{
+    double now;
 
-    /* Checksum should skip itself */
-    cksum = bfdev_crc_itut(&trans->content.opcode, OPCODE_LEN(opcode) - 2, 0xffff);
-    trans->content.checksum = bfdev_cpu_to_le16(cksum);
+    /* A few more timeouts, the estimate was just proven too tight */
+    now = timeout_now();
+    return now + XMODEM_SETTLE * (timeout_deadline(class, 0, units) - now);
+}
 
-    term_flush();
-    retval = term_write(trans, tsize);
-    if (retval < 0)
-        return retval;
+static int
+xmodem_settle(void)
+{
+    double deadline;
+    unsigned int count;
+    uint8_t value;
+    int retval;
 
-    if (buffer) {
-        retval = wait_read(buffer, length);
-        if (retval)
+    /*
+     * Every packet resent after a timeout may have reached the device
+     * twice, and a duplicate is acked again. Drop those extra answers
+     * before the next packet, or each would be taken as its ACK.
+     */
+    deadline = xmodem_grace(TIMEOUT_LINK, 0);
+    for (count = 0;; ++count) {
+        retval = term_recv(&value, 1, deadline);
+        if (retval == -BFDEV_ETIMEDOUT)
+            break;
+        else if (retval)
             return retval;
+
+        if (value == XMODEM_CAN)
+            return -BFDEV_ECANCELED;
     }
 
-    free(trans);
+    if (count)
+        logger_printf(LOGGER_DEBUG, "\ttimeout: %u late answers "
+                      "dropped\n", count);
+
     return -BFDEV_ENOERR;
 }
 
 static int
-xmodem_transfer(uint8_t *src, unsigned int size)
+xmodem_cancel(unsigned int inflight)
+{
+    uint8_t cancel[XMODEM_CAN_COUNT];
+    unsigned int retry;
+    double since;
+    int retval;
+
+    term_cancelled(&since);
+    term_resume();
+
+    logger_printf(LOGGER_WARN, "\n\tTransfer interrupted, cancelling\n");
+
+    /* The device only looks for CAN where a packet may start */
+    if (inflight)
+        xmodem_drain(inflight);
+
+    /*
+     * A packet cut short by the signal swallows the first sequence as
+     * payload, the device then times it out and waits for the next.
+     */
+    memset(cancel, XMODEM_CAN, sizeof(cancel));
+    for (retry = 0; retry < XMODEM_CAN_RETRY; ++retry) {
+        retval = term_write(cancel, sizeof(cancel));
+        if (retval < 0)
+            return retval;
+
+        if (!wait_busy(TIMEOUT_PROMPT)) {
+            logger_printf(LOGGER_INFO, "\tCancelled, port ready %.1fms "
+                          "after abort\n", (timeout_now() - since) * 1000);
+            return -BFDEV_ECANCELED;
+        }
+    }
+
+    logger_printf(LOGGER_ERR, "\tDevice did not return to the prompt\n");
+    return -BFDEV_ETIMEDOUT;
+}
+
+static int
+xmodem_transfer(struct spinor_source *source, spinor_ack_t ack, void *pdata)
 {
+    struct xmodem_flight flight[XMODEM_WINDOW_MAX], *base;
     struct progress prog;
-    struct xmodem_packet packet;
-    unsigned int xfer, retry;
-    uint8_t count, value;
-    uint16_t cksum;
+    struct pipeline pipe;
+    struct rt_hist hist;
+    struct xmodem_packet *packet;
+    enum timeout_class class;
+    unsigned int retry, window, inflight, resend, faults, rewinds;
+    unsigned int index, units, offset, sent, pending;
+    double deadline, acked;
+    bool late, stalled;
+    uint8_t value;
     int retval;
 
-    term_flush();
-    retval = wait_busy();
+    retval = wait_busy(TIMEOUT_PROMPT);
     if (retval)
         return retval;
 
-    progress_init(&prog, size);
-    for (count = 1; (xfer = bfdev_min(size, PAYLOAD_SIZE)); size -= xfer) {
-        memcpy(packet.payload, src, xfer);
-        if (xfer < PAYLOAD_SIZE)
-            memset(packet.payload + xfer, 0x1a, PAYLOAD_SIZE - xfer);
+    /* Prompts go on until the first packet is in, skip what came so far */
+    retval = term_mark();
+    if (retval < 0)
+        return retval;
 
-        cksum = bfdev_crc_itut(packet.payload, PAYLOAD_SIZE, 0);
-        retry = XMODEM_RETRANS;
+    retval = pipeline_start(&pipe, source);
+    if (retval)
+        return retval;
 
-        packet.types = XMODEM_SOH;
-        packet.checksum = bfdev_cpu_to_be16(cksum);
+    progress_init(&prog, source->size);
+    window = xmodem_window;
+    retry = XMODEM_RETRANS;
+    offset = sent = pending = 0;
+    inflight = resend = 0;
+    faults = rewinds = 0;
+    late = stalled = false;
+    memset(&hist, 0, sizeof(hist));
+    acked = 0;
+
+    /* Nothing in the loop may block on the terminal, logs are queued */
+    logger_hot(true);
+
+    for (;;) {
+        /* Keep up to a window of packets on the wire */
+        while (inflight < window) {
+            packet = pipeline_next(&pipe, &flight[inflight].len);
+            if (!packet)
+                break;
+
+            /* The first packet of each sector also waits for its erase */
+            flight[inflight].units = !(sent % SPINOR_SECTOR_SIZE);
+            flight[inflight].resent = inflight < resend;
+            flight[inflight].start = timeout_now();
+
+            retval = term_write(packet, sizeof(*packet));
+            if (retval < 0)
+                goto finish;
+
+            /* Host latency from the last ACK to the packet it let out */
+            if (acked) {
+                rt_hist_add(&hist, flight[inflight].start - acked);
+                acked = 0;
+            }
 
-retry:
-        if (bfdev_unlikely(!retry--)) {
-            bfdev_log_err("\tAbort Transfer after twenty retries\n");
-            retval = -BFDEV_ETIMEDOUT;
-            goto abort;
+            sent += flight[inflight++].len;
         }
 
-        packet.count = count;
-        packet.verify = ~(uint8_t)count;
+        /* Book-keeping for ACKs waits until the next packet is out */
+        if (pending) {
+            progress_update(&prog, pending);
+            if (ack)
+                ack(offset, pdata);
+            pending = 0;
+        }
 
-        retval = term_write(&packet, sizeof(packet));
-        if (retval < 0)
-            return retval;
+        if (!inflight) {
+            retval = atomic_load(&pipe.ring.error);
+            if (retval)
+                goto abort;
+            break;
+        }
 
-        retval = wait_read(&value, 1);
-        if (retval)
-            return retval;
+        /* Answers come back in order, the next one is for the base */
+        base = &flight[0];
+        class = base->units ? TIMEOUT_ERASE : TIMEOUT_LINK;
+        for (units = index = 0; index < inflight; ++index)
+            units += flight[index].units;
+
+        deadline = timeout_deadline(class, sizeof(*packet) * inflight + 1, units);
+        retval = term_recv(&value, 1, deadline);
+        if (retval == -BFDEV_ETIMEDOUT) {
+            /* Late is not lost, the device may still be busy writing */
+            timeout_backoff(class);
+            retval = term_recv(&value, 1, xmodem_grace(class, units));
+        }
 
-        if (bfdev_unlikely(value != XMODEM_ACK)) {
-            if (value == XMODEM_NAK) {
-                bfdev_log_err("\tTransfer Retry\n");
-                goto retry;
+        if (retval == -BFDEV_ETIMEDOUT) {
+            logger_printf(LOGGER_ERR, "\tTransfer Timeout\n");
+            board_retry(true);
+            faults = XMODEM_WINDOW_FAULTS;
+
+            /*
+             * Silence says nothing about which packets got through, a
+             * go-back could resend some the device already took. Stop
+             * sending ahead and give what is in flight one more round,
+             * only then take them as dropped.
+             */
+            if (inflight > 1 && !stalled) {
+                if (window > 1)
+                    logger_printf(LOGGER_WARN, "\tSend-ahead: falling back to stop-and-wait\n");
+                window = 1;
+                stalled = true;
+                continue;
             }
 
-            if (value == XMODEM_CAN) {
-                bfdev_log_err("\tTransfer Cancelled\n");
-                retval = -BFDEV_ECANCELED;
-            } else {
-                bfdev_log_err("\tUnknow Retval %#04x\n", value);
-                retval = -BFDEV_EREMOTEIO;
+            /*
+             * Only a lone packet is sure to be acked twice when resent.
+             * After a window gave up, late answers are still owed for
+             * the packets that were ahead, they are counted in order.
+             */
+            late = inflight == 1 && window == xmodem_window;
+            goto resend;
+        } else if (retval)
+            goto finish;
+
+        if (bfdev_likely(value == XMODEM_ACK)) {
+            acked = timeout_now();
+
+            /* Karn: retransmitted packets give ambiguous samples */
+            if (!base->resent)
+                timeout_sample(class, base->start, sizeof(*packet) + 1, base->units);
+
+            pipeline_done(&pipe);
+            pending += base->len;
+            offset += base->len;
+
+            memmove(flight, flight + 1, --inflight * sizeof(*flight));
+            retry = XMODEM_RETRANS;
+            stalled = false;
+            faults = 0;
+            if (resend)
+                resend--;
+
+            /* A timeout drops to stop-and-wait, nothing else is in flight */
+            if (late && !inflight) {
+                retval = xmodem_settle();
+                if (retval)
+                    goto abort;
+                late = false;
+                acked = 0;
             }
+            continue;
+        }
+
+        if (value == XMODEM_NAK) {
+            logger_printf(LOGGER_ERR, "\tTransfer Retry\n");
+            board_retry(false);
+            goto resend;
+        }
+
+        if (value == XMODEM_CAN) {
+            logger_printf(LOGGER_ERR, "\tTransfer Cancelled\n");
+            retval = -BFDEV_ECANCELED;
+            goto abort;
+        }
 
+        /* One more prompt may cross the first packet on the wire */
+        if (value == RETURN_NOMAL && !offset && !base->resent && --retry)
+            continue;
+
+        logger_printf(LOGGER_ERR, "\tUnknow Retval %#04x\n", value);
+        board_status(value);
+        if (window == 1) {
+            retval = -BFDEV_EREMOTEIO;
+            goto abort;
+        }
+        faults = XMODEM_WINDOW_FAULTS;
+
+resend:
+        if (bfdev_unlikely(!--retry)) {
+            logger_printf(LOGGER_ERR, "\tAbort Transfer after twenty retries\n");
+            retval = -BFDEV_ETIMEDOUT;
             goto abort;
         }
 
-        progress_update(&prog, xfer);
-        src += xfer;
-        count++;
+        if (inflight > 1) {
+            retval = xmodem_drain(inflight - 1);
+            if (retval)
+                goto abort;
+        }
+
+        /* Go back N, unless the device keeps failing without progress */
+        if (window > 1 && ++faults > XMODEM_WINDOW_FAULTS) {
+            logger_printf(LOGGER_WARN, "\tSend-ahead: falling back to stop-and-wait\n");
+            window = 1;
+        }
+
+        pipeline_rewind(&pipe);
+        sent = offset;
+        resend = inflight;
+        inflight = 0;
+        rewinds++;
     }
 
-    printf("\n");
-    value = XMODEM_EOT;
-    retval = term_write(&value, 1);
-    if (retval < 0)
-        return retval;
+    logger_hot(false);
+    logger_printf(LOGGER_INFO, "\n");
+    pipeline_stop(&pipe);
+    pipeline_report(&pipe);
+    rt_hist_report(&hist);
 
-    retval = wait_read(&value, 1);
-    if (retval)
+    if (xmodem_window > 1)
+        logger_printf(LOGGER_INFO, "\tSend-ahead: window %u of %u, "
+                      "%u go-backs\n", window, xmodem_window, rewinds);
+
+    for (retry = XMODEM_RETRANS; retry; --retry) {
+        value = XMODEM_EOT;
+        retval = term_write(&value, 1);
+        if (retval < 0)
+            break;
+
+        deadline = timeout_deadline(TIMEOUT_LINK, 2, 0);
+        retval = term_recv(&value, 1, deadline);
+        if (retval != -BFDEV_ETIMEDOUT)
+            break;
+
+        timeout_backoff(TIMEOUT_LINK);
+    }
+
+    if (term_cancelled(NULL))
+        return xmodem_cancel(0);
+    else if (retval < 0)
         return retval;
 
     if (value != XMODEM_ACK)
@@ -322,16 +578,25 @@ retry:
 abort:
     value = XMODEM_EOT;
     term_write(&value, 1);
+finish:
+    logger_hot(false);
+    if (pending && ack)
+        ack(offset, pdata);
+    pipeline_stop(&pipe);
+
+    if (term_cancelled(NULL))
+        retval = xmodem_cancel(inflight);
+
     return retval;
 }
 
 int
-spinor_flash(uint8_t *src, size_t size)
+spinor_flash(struct spinor_source *source, spinor_ack_t ack, void *pdata)
 {
     int retval;
 
     bfdev_log_info("Chip Flash:\n");
-    retval = xmodem_transfer(src, size);
+    retval = xmodem_transfer(source, ack, pdata);
     if (retval)
         return retval;
 
@@ -339,24 +604,12 @@ spinor_flash(uint8_t *src, size_t size)
 }
 
 int
-spinor_erase(uint16_t index, uint16_t size)
+spinor_window(unsigned int packets)
 {
-    struct spinor_erase param = {};
-    uint8_t state;
-    int retval;
-
-    bfdev_log_info("Chip Erase:\n");
-    param.index = bfdev_cpu_to_le16(index & 0x7fff);
-    param.count = bfdev_cpu_to_le16(BFDEV_DIV_ROUND_UP(size, 4096));
-
-    retval = opcode_transfer(OPCODE_ERASE_SPINOR, &param, &state, 1);
-    if (retval)
-        return retval;
-
-    bfdev_log_info("\t[%#04x]: %s\n", state, status_info(state));
-    if (state != RETURN_NOMAL)
-        return -BFDEV_ECONNABORTED;
+    if (!packets || packets > XMODEM_WINDOW_MAX)
+        return -BFDEV_EINVAL;
 
+    xmodem_window = packets;
     return -BFDEV_ENOERR;
 }
 
@@ -370,7 +623,7 @@ serial_speed(uint32_t speed)
     bfdev_log_info("Setting speed:\n");
     param.speed = bfdev_cpu_to_le32(speed),
 
-    retval = opcode_transfer(OPCODE_SET_FREQ, &param, &state, 1);
+    retval = opcode_transfer(OPCODE_SET_FREQ, &param, NULL, &state, 1);
     if (retval)
         return retval;
 
@@ -381,78 +634,282 @@ serial_speed(uint32_t speed)
     return -BFDEV_ENOERR;
 }
 
+static int
+batch_add(struct batch *batch, const char *name,
+          enum opcode_types opcode, const void *param)
+{
+    struct batch_cmd *cmd;
+
+    if (batch->count == BATCH_MAX)
+        return -BFDEV_EFBIG;
+
+    cmd = &batch->cmds[batch->count++];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->name = name;
+    cmd->size = opcode_build((void *)cmd->frame, opcode, param);
+
+    return -BFDEV_ENOERR;
+}
+
+void
+batch_init(struct batch *batch)
+{
+    batch->count = 0;
+}
+
 int
-flash_bmac(const char *mac)
+batch_erase(struct batch *batch, uint16_t index, uint16_t size)
 {
-    struct mac_flash param = {};
-    uint8_t state;
+    struct spinor_erase param = {};
     int retval;
 
-    bfdev_log_info("Flash BT MAC:\n");
-    if (atoh(mac, &param.index[0], 6)) {
-        bfdev_log_err("\tIncorrect format\n");
-        return -BFDEV_EINVAL;
-    }
+    param.index = bfdev_cpu_to_le16(index & 0x7fff);
+    param.count = bfdev_cpu_to_le16(BFDEV_DIV_ROUND_UP(size, SPINOR_SECTOR_SIZE));
 
-    retval = opcode_transfer(OPCODE_SET_BT_MAC, &param, &state, 1);
+    retval = batch_add(batch, "Chip Erase", OPCODE_ERASE_SPINOR, &param);
     if (retval)
         return retval;
 
-    bfdev_log_info("\t[%#04x]: %s\n", state, status_info(state));
-    if (state != RETURN_NOMAL)
-        return -BFDEV_ECONNABORTED;
-
+    /* Erase replies only after the whole range is gone */
+    batch->cmds[batch->count - 1].units = bfdev_le16_to_cpu(param.count);
     return -BFDEV_ENOERR;
 }
 
 int
-flash_wmac(const char *mac)
+batch_bmac(struct batch *batch, const char *mac)
 {
     struct mac_flash param = {};
-    uint8_t state;
-    int retval;
 
-    bfdev_log_info("Flash WIFI MAC:\n");
     if (atoh(mac, &param.index[0], 6)) {
-        bfdev_log_err("\tincorrect format\n");
+        bfdev_log_err("\tIncorrect BT MAC format\n");
+        return -BFDEV_EINVAL;
+    }
+
+    return batch_add(batch, "Flash BT MAC", OPCODE_SET_BT_MAC, &param);
+}
+
+int
+batch_wmac(struct batch *batch, const char *mac)
+{
+    struct mac_flash param = {};
+
+    if (atoh(mac, &param.index[0], 6)) {
+        bfdev_log_err("\tIncorrect WIFI MAC format\n");
+        return -BFDEV_EINVAL;
+    }
+
+    return batch_add(batch, "Flash WIFI MAC", OPCODE_SET_NET_MAC, &param);
+}
+
+int
+batch_gain(struct batch *batch, const char *gain)
+{
+    struct gain_flash param = {};
+
+    if (atoh(gain, &param.index[0], 84)) {
+        bfdev_log_err("\tIncorrect RF GAIN format\n");
         return -BFDEV_EINVAL;
     }
 
-    retval = opcode_transfer(OPCODE_SET_NET_MAC, &param, &state, 1);
+    return batch_add(batch, "Flash RF GAIN", OPCODE_SET_GAIN, &param);
+}
+
+int
+batch_gain_raw(struct batch *batch, const uint8_t *gain)
+{
+    struct gain_flash param;
+
+    memcpy(param.index, gain, sizeof(param.index));
+    return batch_add(batch, "Flash RF GAIN", OPCODE_SET_GAIN, &param);
+}
+
+int
+batch_run(struct batch *batch)
+{
+    struct batch_cmd *cmd;
+    enum timeout_class class;
+    unsigned int index;
+    double start, deadline;
+    int retval;
+
+    if (!batch->count)
+        return -BFDEV_ENOERR;
+
+    bfdev_log_info("Command batch:\n");
+
+    /* Only the first command waits for the prompt */
+    retval = wait_busy(TIMEOUT_PROMPT);
     if (retval)
         return retval;
 
-    bfdev_log_info("\t[%#04x]: %s\n", state, status_info(state));
-    if (state != RETURN_NOMAL)
-        return -BFDEV_ECONNABORTED;
+    for (index = 0; index < batch->count; ++index) {
+        cmd = &batch->cmds[index];
+        class = cmd->units ? TIMEOUT_ERASE : TIMEOUT_LINK;
+
+        /*
+         * The status of the previous command is the go-ahead for the
+         * next one. A prompt that came in since is older than this
+         * write and is not mistaken for its status.
+         */
+        start = timeout_now();
+        retval = term_command(cmd->frame, cmd->size);
+        if (retval < 0)
+            return retval;
+
+        deadline = timeout_deadline(class, cmd->size + 1, cmd->units);
+        retval = term_recv(&cmd->status, 1, deadline);
+        if (retval) {
+            if (retval == -BFDEV_ETIMEDOUT)
+                timeout_backoff(class);
+            bfdev_log_err("\t[%u] %s: no status\n", index, cmd->name);
+            return retval;
+        }
+
+        timeout_sample(class, start, cmd->size + 1, cmd->units);
+        cmd->elapsed = timeout_now() - start;
+        board_status(cmd->status);
+
+        bfdev_log_info("\t[%u] %s: [%#04x] %s, %.1fms\n", index, cmd->name,
+                       cmd->status, status_info(cmd->status),
+                       cmd->elapsed * 1000);
+
+        if (cmd->status != RETURN_NOMAL)
+            return -BFDEV_ECONNABORTED;
+    }
 
     return -BFDEV_ENOERR;
 }
 
+int
+spinor_erase(uint16_t index, uint16_t size)
+{
+    struct batch batch;
+    int retval;
+
+    batch_init(&batch);
+    retval = batch_erase(&batch, index, size);
+    if (retval)
+        return retval;
+
+    return batch_run(&batch);
+}
+
+int
+flash_bmac(const char *mac)
+{
+    struct batch batch;
+    int retval;
+
+    batch_init(&batch);
+    retval = batch_bmac(&batch, mac);
+    if (retval)
+        return retval;
+
+    return batch_run(&batch);
+}
+
+int
+flash_wmac(const char *mac)
+{
+    struct batch batch;
+    int retval;
+
+    batch_init(&batch);
+    retval = batch_wmac(&batch, mac);
+    if (retval)
+        return retval;
+
+    return batch_run(&batch);
+}
+
 int
 flash_gain(const char *gain)
 {
-    struct gain_flash param = {};
-    uint8_t state;
+    struct batch batch;
     int retval;
 
-    bfdev_log_info("Flash RF GAIN:\n");
-    if (atoh(gain, &param.index[0], 84)) {
-        bfdev_log_err("\tincorrect format\n");
-        return -BFDEV_EINVAL;
-    }
+    batch_init(&batch);
+    retval = batch_gain(&batch, gain);
+    if (retval)
+        return retval;
 
-    retval = opcode_transfer(OPCODE_SET_GAIN, &param, &state, 1);
+    return batch_run(&batch);
+}
+
+int
+chip_spinor(unsigned int *fid, size_t *capacity)
+{
+    uint8_t buff[REPLY_FLASH_LEN + 1];
+    unsigned int vendor, density;
+    int retval;
+
+    retval = opcode_transfer(OPCODE_GET_SPINOR, NULL, "FID:", buff,
+                             REPLY_FLASH_LEN);
     if (retval)
         return retval;
 
-    bfdev_log_info("\t[%#04x]: %s\n", state, status_info(state));
-    if (state != RETURN_NOMAL)
-        return -BFDEV_ECONNABORTED;
+    /* JEDEC density byte is log2 of the size in bytes */
+    buff[REPLY_FLASH_LEN] = '\0';
+    if (sscanf((void *)buff, "FID:%x,%x", &vendor, &density) != 2 ||
+        density < 0x10 || density > 0x1f)
+        return -BFDEV_EBADMSG;
 
+    *fid = vendor << 8 | density;
+    *capacity = (size_t)1 << density;
     return -BFDEV_ENOERR;
 }
 
+int
+chip_wmac(char *buff)
+{
+    uint8_t reply[REPLY_MAC_LEN + 1];
+    int retval;
+
+    retval = opcode_transfer(OPCODE_GET_NET_MAC, NULL, "Mac:", reply,
+                             REPLY_MAC_LEN);
+    if (retval)
+        return retval;
+
+    reply[REPLY_MAC_LEN] = '\0';
+    format_haddr(reply);
+    memcpy(buff, reply, ETH_STR_ALEN);
+
+    return -BFDEV_ENOERR;
+}
+
+int
+chip_error(char *status)
+{
+    uint8_t reply[REPLY_ERROR_LEN];
+    int retval;
+
+    /* Last error of the ROM, set by the image checks after an EOT */
+    retval = opcode_transfer(OPCODE_GET_ERROR, NULL, "E:", reply,
+                             REPLY_ERROR_LEN);
+    if (retval)
+        return retval;
+
+    *status = reply[2];
+    return -BFDEV_ENOERR;
+}
+
+int
+chip_probe(char *mac, unsigned int timeout)
+{
+    int retval;
+
+    /* Secboot keeps prompting, a rebooted chip stays silent */
+    retval = term_mark();
+    if (retval < 0)
+        return retval;
+
+    retval = wait_busy(timeout);
+    if (retval)
+        return retval;
+
+    return chip_wmac(mac);
+}
+
 int
 chip_info(void)
 {
@@ -460,7 +917,8 @@ chip_info(void)
     int retval;
 
     bfdev_log_info("Chip information:\n");
-    retval = opcode_transfer(OPCODE_GET_BT_MAC, NULL, buff, REPLY_MAC_LEN);
+    retval = opcode_transfer(OPCODE_GET_BT_MAC, NULL, "Mac:", buff,
+                             REPLY_MAC_LEN);
     if (retval)
         return retval;
 
@@ -468,7 +926,8 @@ chip_info(void)
     format_haddr(buff);
     bfdev_log_info("\tBT MAC: %s\n", buff);
 
-    retval = opcode_transfer(OPCODE_GET_NET_MAC, NULL, buff, REPLY_MAC_LEN);
+    retval = opcode_transfer(OPCODE_GET_NET_MAC, NULL, "Mac:", buff,
+                             REPLY_MAC_LEN);
     if (retval)
         return retval;
 
@@ -476,21 +935,24 @@ chip_info(void)
     format_haddr(buff);
     bfdev_log_info("\tWIFI MAC: %s\n", buff);
 
-    retval = opcode_transfer(OPCODE_GET_SPINOR, NULL, buff, REPLY_FLASH_LEN);
+    retval = opcode_transfer(OPCODE_GET_SPINOR, NULL, "FID:", buff,
+                             REPLY_FLASH_LEN);
     if (retval)
         return retval;
 
     buff[REPLY_FLASH_LEN] = '\0';
     bfdev_log_info("\tFlash: %s\n", buff);
 
-    retval = opcode_transfer(OPCODE_GET_VERSION, NULL, buff, REPLY_ROM_LEN);
+    retval = opcode_transfer(OPCODE_GET_VERSION, NULL, "R:", buff,
+                             REPLY_ROM_LEN);
     if (retval)
         return retval;
 
     buff[REPLY_ROM_LEN] = '\0';
     bfdev_log_info("\tROM: %s\n", buff);
 
-    retval = opcode_transfer(OPCODE_GET_GAIN, NULL, buff, REPLY_GAIN_LEN);
+    retval = opcode_transfer(OPCODE_GET_GAIN, NULL, "G:", buff,
+                             REPLY_GAIN_LEN);
     if (retval)
         return retval;
 
@@ -506,7 +968,7 @@ chip_reset(void)
     int retval;
 
     bfdev_log_info("Chip reset...\n");
-    retval = opcode_transfer(OPCODE_REBOOT, NULL, NULL, 0);
+    retval = opcode_transfer(OPCODE_REBOOT, NULL, NULL, NULL, 0);
     if (retval)
         return retval;
 
@@ -514,25 +976,31 @@ chip_reset(void)
 }
 
 int
-entry_secboot(void)
+entry_secboot(bool reset)
 {
     uint8_t buff[3], version[256];
-    unsigned int count, index;
+    unsigned int count;
     int retval;
 
     bfdev_log_info("Entry secboot:\n");
-    term_reset(true);
-    usleep(5000);
 
-    term_flush();
-    term_print("AT+Z\r\n");
-    term_reset(false);
+    /* A fixture has already pulsed the reset line for us */
+    if (reset) {
+        term_reset(true);
+        usleep(5000);
+
+        term_mark();
+        term_print("AT+Z\r\n");
+        term_reset(false);
+    }
+
+    /* Output from before the reset is no answer to the escapes */
+    term_mark();
 
     buff[0] = 0x1b;
     buff[1] = 0x1b;
     buff[2] = 0x1b;
 
-    index = 0;
     memset(version, 0, sizeof(version));
 
     for (count = 0; count < SECBOOT_RETRANS; ++count) {
@@ -540,23 +1008,18 @@ entry_secboot(void)
         if (retval < 0)
             return retval;
 
-        retval = term_read(version + index, REPLY_SECBOOT_LEN - index);
-        if (retval < 0)
-            return retval;
-
-        index += retval;
-        BFDEV_BUG_ON(index > REPLY_SECBOOT_LEN);
-
-        if (index == REPLY_SECBOOT_LEN)
+        /* Boot banner and AT echo may come first, skip to the reply */
+        retval = term_expect("Secboot", version, REPLY_SECBOOT_LEN,
+                             timeout_now() + 0.002);
+        if (retval != -BFDEV_ETIMEDOUT)
             break;
-
-        usleep(2000);
     }
 
-    if (strncmp((void *)version, "Secboot", 7)) {
+    if (retval == -BFDEV_ETIMEDOUT) {
         bfdev_log_err("\tChip error\n");
         return -BFDEV_EPERM;
-    }
+    } else if (retval)
+        return retval;
 
     bfdev_log_info("\tVersion: %s\n", version);
     sleep(1);
@@ -12,12 +12,63 @@
 
 #define ETH_ALEN 6
 #define ETH_HEX_ALEN 12
+#define ETH_STR_ALEN 18
+
+#define BATCH_MAX 8
+#define BATCH_FRAME_MAX 96 /* Opcode head and SET_GAIN, the largest */
+
+/* One pre-built secboot command, and its status and round trip */
+struct batch_cmd {
+    const char *name;
+    uint8_t frame[BATCH_FRAME_MAX];
+    unsigned int size;
+    unsigned int units;
+    uint8_t status;
+    double elapsed;
+};
+
+struct batch {
+    struct batch_cmd cmds[BATCH_MAX];
+    unsigned int count;
+};
+
+typedef void (*spinor_ack_t)(size_t done, void *pdata);
+
+/* read() runs on the packet producer thread, ack on the caller's */
+struct spinor_source {
+    int (*read)(struct spinor_source *source, void *buff, unsigned int len);
+    size_t size;
+};
+
+extern void
+batch_init(struct batch *batch);
+
+extern int
+batch_erase(struct batch *batch, uint16_t index, uint16_t size);
+
+extern int
+batch_bmac(struct batch *batch, const char *mac);
+
+extern int
+batch_wmac(struct batch *batch, const char *mac);
+
+extern int
+batch_gain(struct batch *batch, const char *gain);
+
+extern int
+batch_gain_raw(struct batch *batch, const uint8_t *gain);
+
+extern int
+batch_run(struct batch *batch);
 
 extern int
 flash_gain(const char *bmac);
 
 extern int
-spinor_flash(uint8_t *src, size_t size);
+spinor_flash(struct spinor_source *source, spinor_ack_t ack, void *pdata);
+
+extern int
+spinor_window(unsigned int packets);
 
 extern int
 spinor_erase(uint16_t index, uint16_t size);
@@ -31,6 +82,21 @@ flash_bmac(const char *bmac);
 extern int
 flash_wmac(const char *wmac);
 
+extern const char *
+status_info(char error);
+
+extern int
+chip_spinor(unsigned int *fid, size_t *capacity);
+
+extern int
+chip_wmac(char *buff);
+
+extern int
+chip_error(char *status);
+
+extern int
+chip_probe(char *mac, unsigned int timeout);
+
 extern int
 chip_info(void);
 
@@ -38,6 +104,6 @@ extern int
 chip_reset(void);
 
 extern int
-entry_secboot(void);
+entry_secboot(bool reset);
 
 #endif /* _W80XPROG_H_ */
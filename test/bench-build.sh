@@ -0,0 +1,60 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+#
+# Time the image builder against the packaging flow it replaces. Not run
+# by ctest, numbers depend on the host.
+# Usage: bench-build.sh <w80xprog> [MiB] [runs]
+# $BASELINE, when set, is the old packaging command (for example the
+# vendor wm_tool line), run in the work directory on app.bin and user.bin.
+# Without it the floor is a plain cat of the inputs into one file.
+#
+
+prog=$1
+size=${2:-8}
+runs=${3:-5}
+
+. "$(dirname "$0")/lib.sh"
+
+# now: wall clock in seconds, sub-second where the host allows it
+now() {
+    perl -MTime::HiRes=time -e 'printf "%.6f\n", time' 2> /dev/null ||
+        date +%s
+}
+
+# bench <label> <command>: best of $runs, in MB/s over both inputs
+bench() {
+    best=
+    run=0
+    while [ $run -lt $runs ]; do
+        start=$(now)
+        (cd "$work" && eval "$2") > /dev/null 2>&1 || {
+            echo "$1: failed"
+            exit 1
+        }
+        end=$(now)
+        best=$(echo "$start $end $best" | awk '{
+            t = $2 - $1
+            print (NF < 3 || t < $3) ? t : $3 }')
+        run=$((run + 1))
+    done
+    echo "$1 $best" | awk -v bytes=$total '{
+        rate = $2 > 0 ? bytes / $2 / 1000000 : 0
+        printf "%-10s %8.3fms %8.1f MB/s\n", $1, $2 * 1000, rate }'
+}
+
+head -c $((size * 1048576 * 3 / 4)) /dev/urandom > "$work/app.bin"
+head -c $((size * 1048576 / 4)) /dev/urandom > "$work/user.bin"
+total=$((size * 1048576))
+
+echo "$size MiB of input, best of $runs runs"
+bench build "\"$prog\" build -o out.fls app:0x08010000:app.bin \
+    user:0x08c00000:user.bin"
+if [ -n "$BASELINE" ]; then
+    bench baseline "$BASELINE"
+else
+    bench cat "cat app.bin user.bin > out.bin"
+fi
+
+exit 0
@@ -0,0 +1,37 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# The builder has to refuse parts whose header or payload overlap, before
+# it writes any output. Disjoint parts are fine in any order.
+# Usage: build.sh <w80xprog>
+#
+
+prog=$1
+
+. "$(dirname "$0")/lib.sh"
+
+head -c 100000 /dev/urandom > "$work/app.bin"
+head -c 5000 /dev/urandom > "$work/user.bin"
+
+"$prog" build -o "$work/both.fls" app:0x08010000:"$work/app.bin" \
+    user:0x08020000:"$work/user.bin" > "$work/build.log" 2>&1 && {
+    cat "$work/build.log"
+    echo "overlapping parts were not refused"
+    exit 1
+}
+cat "$work/build.log"
+
+if ! grep -q "Illegal image flash address" "$work/build.log" ||
+   [ -e "$work/both.fls" ]; then
+    echo "overlap was not reported before the output"
+    exit 1
+fi
+
+"$prog" build -o "$work/both.fls" user:0x08040000:"$work/user.bin" \
+    app:0x08010000:"$work/app.bin" > "$work/build.log" 2>&1 || {
+    cat "$work/build.log"
+    echo "disjoint parts were refused"
+    exit 1
+}
+
+exit 0
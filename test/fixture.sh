@@ -0,0 +1,55 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+#
+# Two sockets of a fixture reset through a gpio-sim chip, then flashed in
+# parallel. Needs root and gpio-sim, skipped otherwise.
+# Usage: fixture.sh <w80xprog>
+#
+
+prog=$1
+
+. "$(dirname "$0")/lib.sh"
+
+config=/sys/kernel/config/gpio-sim
+[ -d $config ] || modprobe gpio-sim 2> /dev/null
+if [ ! -d $config ] || [ ! -w $config ]; then
+    echo "gpio-sim not available"
+    exit 77
+fi
+
+sim=$config/w80xprog-$$
+mkdir $sim $sim/bank0 || exit 77
+trap '[ -n "$emus" ] && kill $emus; echo 0 > $sim/live
+      rmdir $sim/bank0 $sim; rm -rf "$work"' EXIT
+echo 4 > $sim/bank0/num_lines
+echo 1 > $sim/live || exit 77
+chip=$(cat $sim/bank0/chip_name)
+
+make_image app 300000
+start_emu emu1
+port1=$port
+start_emu emu2
+port2=$port
+
+"$prog" -X $chip:0,1:2 -o -f "$work/app.fls" -p "$port1" -p "$port2" \
+    > "$work/host.log" 2>&1
+status=$?
+cat "$work/host.log"
+
+# Built without the character device, nothing to drive
+if grep -q "support not built in" "$work/host.log"; then
+    exit 77
+fi
+[ $status = 0 ] || exit 1
+
+check_stream emu1 app
+check_stream emu2 app
+
+if ! grep -q "Reset 2 sockets, pulse" "$work/host.log"; then
+    echo "sockets were not reset through the chip"
+    exit 1
+fi
+
+exit 0
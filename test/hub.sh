@@ -0,0 +1,71 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+#
+# Two boards behind one hub of a mock sysfs tree, flashed at once with a
+# single transfer slot: one has to wait for the other. A board on a
+# platform UART runs without the scheduler.
+# Usage: hub.sh <w80xprog>
+#
+
+prog=$1
+
+. "$(dirname "$0")/lib.sh"
+
+# mock_port <port> <hub port>: put a tty below USB hub 1-1
+mock_port() {
+    device=$work/sys/devices/pci0000:00/usb1/1-1/1-1.$2/1-1.$2:1.0
+    mkdir -p "$device" "$work/sys/class/tty/$(basename "$1")"
+    ln -s "$device" "$work/sys/class/tty/$(basename "$1")/device"
+}
+
+export W80XPROG_SYSFS=$work/sys
+make_image app 300000
+
+for board in 1 2; do
+    start_emu emu$board -l 3000
+    mock_port "$port" $board
+    "$prog" -p "$port" -o -f "$work/app.fls" -H 1 \
+        > "$work/host$board.log" 2>&1 &
+    eval host$board=$!
+done
+
+fail=0
+for board in 1 2; do
+    eval wait \$host$board || fail=1
+    cat "$work/host$board.log"
+done
+[ $fail = 0 ] || exit 1
+
+for board in 1 2; do
+    check_stream emu$board app
+    if ! grep -q "Hub 1-1: slot 0 of 1, 1 transfers running" \
+        "$work/host$board.log"; then
+        echo "board $board did not run alone on the hub"
+        exit 1
+    fi
+done
+
+if ! cat "$work/host1.log" "$work/host2.log" | grep -q "slots busy, waiting"; then
+    echo "no board waited for the slot"
+    exit 1
+fi
+
+start_emu emu3
+device=$work/sys/devices/platform/serial8250/tty/ttyS0
+mkdir -p "$device" "$work/sys/class/tty/$(basename "$port")"
+ln -s "$device" "$work/sys/class/tty/$(basename "$port")/device"
+"$prog" -p "$port" -o -f "$work/app.fls" -H 1 > "$work/host3.log" 2>&1 || {
+    cat "$work/host3.log"
+    exit 1
+}
+
+check_stream emu3 app
+if ! grep -q "Not on a USB hub, running alone" "$work/host3.log"; then
+    cat "$work/host3.log"
+    echo "platform UART was taken for a hub port"
+    exit 1
+fi
+
+exit 0
@@ -0,0 +1,48 @@
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+#
+# Shared by the test scripts, sourced after $prog is set.
+#
+
+work=$(mktemp -d) || exit 77
+emus=
+emulator=secboot-emu
+trap '[ -n "$emus" ] && kill $emus; rm -rf "$work"' EXIT
+export W80XPROG_STATE=$work/state
+
+# make_image <name> <bytes>: a random app image in $work/<name>.fls
+make_image() {
+    head -c $2 /dev/urandom > "$work/$1.bin"
+    "$prog" build -o "$work/$1.fls" app:0x08010000:"$work/$1.bin" \
+        > /dev/null || exit 1
+}
+
+# start_emu <name> [options]: a $emulator logging to $work/<name>.log,
+# receiving into $work/<name>.stream, its terminal in $port
+start_emu() {
+    name=$1
+    shift
+
+    "$prog" $emulator "$@" "$work/$name.stream" > "$work/$name.log" 2>&1 &
+    emus="$emus $!"
+
+    for wait in 1 2 3 4 5 6 7 8 9 10; do
+        port=$(sed -n 's/.*emulator on //p' "$work/$name.log")
+        [ -n "$port" ] && return
+        sleep 0.2
+    done
+
+    # No pseudo terminals here, nothing to test against
+    cat "$work/$name.log"
+    exit 77
+}
+
+# check_stream <name> <image>: the emulator got the image intact
+check_stream() {
+    size=$(wc -c < "$work/$2.fls")
+    if ! head -c $size "$work/$1.stream" | cmp -s - "$work/$2.fls"; then
+        echo "$1: received stream differs from the image"
+        exit 1
+    fi
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# A transfer cancelled halfway through a single image has to resume
+# inside it: the next run sends the tail as a sub-image placed right
+# after the acknowledged sectors, and the chip's check has to pass.
+# Usage: resume.sh <w80xprog> <packet>
+#
+
+prog=$1
+cut=$2
+
+. "$(dirname "$0")/lib.sh"
+
+# field <file> <offset>: little endian 32 bit word
+field() {
+    od -An -tu4 -j $2 -N4 "$1" | tr -d ' '
+}
+
+make_image app 300000
+start_emu emu -c $cut
+
+"$prog" -p "$port" -o -f "$work/app.fls" > "$work/host.log" 2>&1 && {
+    cat "$work/host.log"
+    echo "cancelled transfer did not fail"
+    exit 1
+}
+
+"$prog" -p "$port" -o -f "$work/app.fls" > "$work/host.log" 2>&1
+status=$?
+cat "$work/host.log"
+if [ $status != 0 ]; then
+    cat "$work/emu.log"
+    exit 1
+fi
+
+if ! grep -q "Resume: .* image 0 from" "$work/host.log" ||
+   ! grep -q "checked by the chip" "$work/host.log"; then
+    echo "run did not resume inside the image"
+    exit 1
+fi
+
+# What the first run got through, then the sub-image
+base=$(((cut - 1) * 1024))
+head -c $base "$work/emu.stream" > "$work/first"
+if ! head -c $base "$work/app.fls" | cmp -s - "$work/first"; then
+    echo "first run differs from the image"
+    exit 1
+fi
+
+tail -c +$((base + 1)) "$work/emu.stream" > "$work/second"
+addr=$(field "$work/app.fls" 8)
+length=$(field "$work/app.fls" 12)
+subaddr=$(field "$work/second" 8)
+sublength=$(field "$work/second" 12)
+skip=$((subaddr - addr))
+
+if [ $((subaddr % 4096)) != 0 ] || [ $skip -le 0 ] ||
+   [ $((skip + 64)) -gt $base ] || [ $((skip + sublength)) != $length ]; then
+    echo "sub-image at $subaddr+$sublength does not fit $addr+$length"
+    exit 1
+fi
+
+tail -c +$((64 + skip + 1)) "$work/app.fls" > "$work/tail"
+if ! tail -c +65 "$work/second" | head -c $sublength |
+     cmp -s - "$work/tail"; then
+    echo "sub-image payload differs from the image tail"
+    exit 1
+fi
+
+exit 0
@@ -0,0 +1,55 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# A streamed image whose second header is misplaced has to fail on that
+# header, before any of it reaches the chip. A good image piped in short
+# writes, its headers split across reads, has to pass intact.
+# Usage: stream.sh <w80xprog> <type>:<addr> <expect>
+#
+
+prog=$1
+second=$2
+expect=$3
+
+. "$(dirname "$0")/lib.sh"
+
+make_image app 100000
+"$prog" build -o "$work/second.fls" $second:"$work/app.bin" \
+    > /dev/null || exit 1
+
+start_emu good
+perl -e 'binmode STDIN; binmode STDOUT; $| = 1;
+         while (read(STDIN, $buff, 37)) { print $buff; }' \
+    < "$work/app.fls" | "$prog" -p "$port" -o -f - > "$work/host.log" 2>&1 || {
+    cat "$work/host.log"
+    exit 1
+}
+check_stream good app
+
+if ! "$prog" audit | grep -q ",01:23:45:67:89:ab,"; then
+    "$prog" audit
+    echo "audit record lacks the wifi mac"
+    exit 1
+fi
+
+cat "$work/app.fls" "$work/second.fls" | gzip > "$work/both.fls.gz"
+start_emu bad
+"$prog" -p "$port" -o -f "$work/both.fls.gz" > "$work/host.log" 2>&1 && {
+    cat "$work/host.log"
+    echo "misplaced image was not refused"
+    exit 1
+}
+cat "$work/host.log"
+
+if ! grep -q -e "$expect" "$work/host.log"; then
+    echo "output does not match: $expect"
+    exit 1
+fi
+
+# Nothing past the first image may have been sent
+if [ $(wc -c < "$work/bad.stream") -gt $(wc -c < "$work/app.fls") ]; then
+    echo "misplaced header reached the chip"
+    exit 1
+fi
+
+exit 0
@@ -0,0 +1,55 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+#
+# Flash an image through a running stub emulator and compare its flash
+# file with the image. A second flash of the same image has to find
+# every sector unchanged.
+# Usage: stub.sh <w80xprog>
+#
+
+prog=$1
+
+. "$(dirname "$0")/lib.sh"
+
+# extract <offset> <bytes>: a range of the emulated flash
+extract() {
+    dd if="$work/stub.stream" bs=1024 skip=$(($1 / 1024)) count=$(($2 / 1024 + 1)) \
+        2> /dev/null | head -c $2
+}
+
+make_image app 300000
+emulator=stub-emu
+start_emu stub
+
+for run in 1 2; do
+    "$prog" -p "$port" -S "$work/app.fls" -f "$work/app.fls" \
+        > "$work/host$run.log" 2>&1 || {
+        cat "$work/host$run.log" "$work/stub.log"
+        exit 1
+    }
+    cat "$work/host$run.log"
+done
+
+# The header sits in the 1 KiB slot below the payload at 0x08010000
+head -c 64 "$work/app.fls" > "$work/app.head"
+if ! extract $((0x10000 - 1024)) 64 | cmp -s - "$work/app.head" ||
+   ! extract $((0x10000)) 300000 | cmp -s - "$work/app.bin"; then
+    echo "emulated flash differs from the image"
+    exit 1
+fi
+
+if ! grep -q "unchanged, 0 written" "$work/host2.log"; then
+    echo "second flash rewrote sectors"
+    exit 1
+fi
+
+# The stub names the board for the audit log
+if ! "$prog" audit | grep -q ",01:23:45:67:89:ab,"; then
+    "$prog" audit
+    echo "audit record lacks the wifi mac"
+    exit 1
+fi
+
+exit 0
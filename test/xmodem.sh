@@ -0,0 +1,48 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright(c) 2024 John Sanpe <sanpeqf@gmail.com>
+#
+# Flash an image into the secboot emulator and compare what arrived.
+# Usage: xmodem.sh <w80xprog> [emulator options] -- [flasher options]
+# $EXPECT, when set, must match the flasher output. With $FAILS set
+# the flasher has to fail instead.
+#
+
+prog=$1
+shift
+
+emuopts=
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    emuopts="$emuopts $1"
+    shift
+done
+[ $# -gt 0 ] && shift
+
+. "$(dirname "$0")/lib.sh"
+
+make_image app 300000
+start_emu emu $emuopts
+
+"$prog" -p "$port" -o -f "$work/app.fls" "$@" > "$work/host.log" 2>&1
+status=$?
+cat "$work/host.log"
+
+if [ -n "$FAILS" ]; then
+    if [ $status = 0 ]; then
+        echo "flasher did not fail"
+        exit 1
+    fi
+elif [ $status != 0 ]; then
+    cat "$work/emu.log"
+    exit 1
+else
+    check_stream emu app
+fi
+
+if [ -n "$EXPECT" ] && ! grep -q -e "$EXPECT" "$work/host.log"; then
+    echo "output does not match: $EXPECT"
+    exit 1
+fi
+
+exit 0